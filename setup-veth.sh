@@ -0,0 +1,12 @@
+#!/bin/sh
+# Puts 10.199.0.2 behind a veth pair in the ipc-bench namespace, e.g.:
+#   ip netns exec ipc-bench socket-udp-server ...
+#   socket-udp-client -A 10.199.0.2 ...
+ip netns del ipc-bench 2>/dev/null
+ip netns add ipc-bench
+ip link add ipc-bench0 type veth peer name ipc-bench1 netns ipc-bench
+ip addr add 10.199.0.1/24 dev ipc-bench0
+ip link set ipc-bench0 up
+ip -n ipc-bench addr add 10.199.0.2/24 dev ipc-bench1
+ip -n ipc-bench link set ipc-bench1 up
+ip -n ipc-bench link set lo up
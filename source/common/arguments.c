@@ -1,3 +1,5 @@
+#include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -45,8 +47,8 @@ void parse_arguments(Arguments *arguments, int argc, char *argv[]) {
 
 		switch (option) {
 			case -1: return;
-			case 's': arguments->size = atoi(optarg); break;
-			case 'c': arguments->count = atoi(optarg); break;
+			case 's': arguments->size = parse_size(optarg); break;
+			case 'c': arguments->count = parse_count(optarg); break;
 			default: continue;
 		}
 	}
@@ -86,3 +88,37 @@ int check_flag(const char *flag, int argc, char *argv[]) {
 
 	return false;
 }
+
+size_t parse_size(const char *text) {
+	char *end;
+	int shift = 0;
+
+	errno = 0;
+	unsigned long long value = strtoull(text, &end, 10);
+	switch (tolower(*end)) {
+		case 'k': shift = 10; ++end; break;
+		case 'm': shift = 20; ++end; break;
+		case 'g': shift = 30; ++end; break;
+	}
+
+	if (errno || end == text || *end != '\0' || value == 0 ||
+			value > (SIZE_MAX >> shift) || text[0] == '-') {
+		fprintf(stderr, "Invalid size \"%s\"\n", text);
+		exit(EXIT_FAILURE);
+	}
+
+	return (size_t)value << shift;
+}
+
+uint64_t parse_count(const char *text) {
+	char *end;
+
+	errno = 0;
+	unsigned long long value = strtoull(text, &end, 10);
+	if (errno || end == text || *end != '\0' || value == 0 || text[0] == '-') {
+		fprintf(stderr, "Invalid count \"%s\"\n", text);
+		exit(EXIT_FAILURE);
+	}
+
+	return value;
+}
@@ -1,14 +1,17 @@
 #ifndef IPC_BENCH_ARGUMENTS_H
 #define IPC_BENCH_ARGUMENTS_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #define DEFAULT_MESSAGE_COUNT 1000
 #define DEFAULT_MESSAGE_SIZE 4096
 
 void print_usage();
 
 typedef struct Arguments {
-	int size;
-	int count;
+	size_t size;
+	uint64_t count;
 
 } Arguments;
 
@@ -16,4 +19,15 @@ void parse_arguments(Arguments* arguments, int argc, char* argv[]);
 
 int check_flag(const char* name, int argc, char* argv[]);
 
+/**
+ * Parses a byte count with an optional binary suffix (k, m, g; e.g. "4g").
+ * Exits with an error for malformed or zero values.
+ */
+size_t parse_size(const char* text);
+
+/**
+ * Parses a (non-zero) message count. Exits with an error if malformed.
+ */
+uint64_t parse_count(const char* text);
+
 #endif /* IPC_BENCH_ARGUMENTS_H */
@@ -1,13 +1,25 @@
 #include <assert.h>
+#include <inttypes.h>
 #include <math.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include <time.h>
 
 #include "common/arguments.h"
 #include "common/benchmarks.h"
 
+#define MAXIMUM_TAGS 16
+
+static struct {
+	char name[32];
+	char value[128];
+} tags[MAXIMUM_TAGS];
+static int tag_count = 0;
+
 bench_t now() {
 #ifdef __MACH__
 	return ((double)clock()) / CLOCKS_PER_SEC * 1e9;
@@ -20,14 +32,35 @@ bench_t now() {
 #endif
 }
 
-void setup_benchmarks(Benchmarks* bench) {
+void setup_benchmarks(Benchmarks* bench, size_t count) {
 	bench->minimum = INT32_MAX;
 	bench->maximum = 0;
 	bench->sum = 0;
 	bench->squared_sum = 0;
+
+	bench->sample_count = 0;
+	// Allocated up front, so that no sample pays for growing the array
+	bench->sample_capacity = count ? count : 1;
+	bench->samples = malloc(bench->sample_capacity * sizeof(bench_t));
+	if (!bench->samples) {
+		perror("malloc()");
+		exit(EXIT_FAILURE);
+	}
+
+	noise_sample(&bench->noise);
 	bench->total_start = now();
 }
 
+static void record_sample(Benchmarks* bench, bench_t time) {
+	// Percentiles over only a prefix of the run would not match the average
+	if (bench->sample_count == bench->sample_capacity) {
+		fprintf(stderr, "More than the %zu measurements set up!\n",
+						bench->sample_capacity);
+		exit(EXIT_FAILURE);
+	}
+	bench->samples[bench->sample_count++] = time;
+}
+
 void benchmark(Benchmarks* bench) {
 	const bench_t time = now() - bench->single_start;
 
@@ -41,26 +74,85 @@ void benchmark(Benchmarks* bench) {
 
 	bench->sum += time;
 	bench->squared_sum += (time * time);
+
+	record_sample(bench, time);
+}
+
+static int compare_samples(const void* left, const void* right) {
+	const bench_t a = *(const bench_t*)left;
+	const bench_t b = *(const bench_t*)right;
+	return (a > b) - (a < b);
+}
+
+// Nearest-rank percentile over the sorted samples
+static bench_t percentile(const Benchmarks* bench, double rank) {
+	size_t index = (size_t)ceil(rank / 100.0 * bench->sample_count);
+	if (index > 0) {
+		--index;
+	}
+	return bench->samples[index];
+}
+
+void benchmark_tag(const char* name, const char* format, ...) {
+	va_list arguments;
+	int index;
+
+	for (index = 0; index < tag_count; ++index) {
+		if (strcmp(tags[index].name, name) == 0) {
+			break;
+		}
+	}
+	if (index == MAXIMUM_TAGS) {
+		fprintf(stderr, "Too many result tags; Ignoring \"%s\"\n", name);
+		return;
+	}
+	if (index == tag_count) {
+		snprintf(tags[index].name, sizeof(tags[index].name), "%s", name);
+		++tag_count;
+	}
+
+	va_start(arguments, format);
+	vsnprintf(tags[index].value, sizeof(tags[index].value), format, arguments);
+	va_end(arguments);
 }
 
 void evaluate(Benchmarks* bench, Arguments* args) {
 	assert(args->count > 0);
 	const bench_t total_time = now() - bench->total_start;
+	NoiseSample noise;
+	noise_sample(&noise);
+
 	const double average = ((double)bench->sum) / args->count;
 
 	double sigma = bench->squared_sum / args->count;
 	sigma = sqrt(sigma - (average * average));
 
-	int messageRate = (int)(args->count / (total_time / 1e9));
+	uint64_t messageRate = (uint64_t)(args->count / (total_time / 1e9));
 
 	printf("\n============ RESULTS ================\n");
-	printf("Message size:       %d\n", args->size);
-	printf("Message count:      %d\n", args->count);
+	printf("Message size:       %zu\n", args->size);
+	printf("Message count:      %" PRIu64 "\n", args->count);
+	for (int index = 0; index < tag_count; ++index) {
+		// Align with the other labels ("Message count:      ")
+		int padding = 19 - (int)strlen(tags[index].name);
+		printf("%s:%*s%s\n", tags[index].name, padding > 0 ? padding : 1, "",
+					 tags[index].value);
+	}
 	printf("Total duration:     %.3f\tms\n", total_time / 1e6);
 	printf("Average duration:   %.3f\tus\n", average / 1000.0);
 	printf("Minimum duration:   %.3f\tus\n", bench->minimum / 1000.0);
 	printf("Maximum duration:   %.3f\tus\n", bench->maximum / 1000.0);
 	printf("Standard deviation: %.3f\tus\n", sigma / 1000.0);
-	printf("Message rate:       %d\tmsg/s\n", messageRate);
+	if (bench->sample_count > 0) {
+		qsort(bench->samples, bench->sample_count, sizeof(bench_t), compare_samples);
+		printf("50th percentile:    %.3f\tus\n", percentile(bench, 50) / 1000.0);
+		printf("99th percentile:    %.3f\tus\n", percentile(bench, 99) / 1000.0);
+		printf("99.9th percentile:  %.3f\tus\n", percentile(bench, 99.9) / 1000.0);
+	}
+	printf("Message rate:       %" PRIu64 "\tmsg/s\n", messageRate);
+	noise_report(&bench->noise, &noise);
 	printf("=====================================\n");
+
+	free(bench->samples);
+	bench->samples = NULL;
 }
@@ -1,6 +1,10 @@
 #ifndef IPC_BENCH_BENCHMARKS_H
 #define IPC_BENCH_BENCHMARKS_H
 
+#include <stddef.h>
+
+#include "common/noise.h"
+
 struct Arguments;
 
 typedef unsigned long long bench_t;
@@ -24,14 +28,34 @@ typedef struct Benchmarks {
 	// Squared sum (for standard deviation)
 	bench_t squared_sum;
 
+	// Every single measurement (for percentiles)
+	bench_t *samples;
+	size_t sample_count;
+	size_t sample_capacity;
+
+	// Platform counters at the start of the run
+	NoiseSample noise;
+
 } Benchmarks;
 
 bench_t now();
 
-void setup_benchmarks(Benchmarks *bench);
+/**
+ * Starts a run of (at most) count measurements; the sample array for the
+ * percentiles is sized for all of them here, outside the measured loop, and
+ * any measurement beyond them is fatal.
+ */
+void setup_benchmarks(Benchmarks *bench, size_t count);
 
 void benchmark(Benchmarks *bench);
 
 void evaluate(Benchmarks *bench, struct Arguments *args);
 
+/**
+ * Attaches a "<name>: <value>" label to the printed results, e.g. the active
+ * interference profile. Setting the same name again replaces the value.
+ */
+void benchmark_tag(const char *name, const char *format, ...)
+		__attribute__((format(printf, 2, 3)));
+
 #endif /* IPC_BENCH_BENCHMARKS_H */
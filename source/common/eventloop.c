@@ -0,0 +1,81 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+
+#include "common/eventloop.h"
+
+void event_loop_init(EventLoop *loop) {
+  if ((loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    perror("epoll_create1()");
+    exit(EXIT_FAILURE);
+  }
+  loop->source_count = 0;
+  loop->wakeup_count = 0;
+  loop->event_count = 0;
+}
+
+static void add(EventLoop *loop, int fd, EventSource *source) {
+  struct epoll_event event = {.events = EPOLLIN, .data.ptr = source};
+
+  if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+    perror("epoll_ctl()");
+    exit(EXIT_FAILURE);
+  }
+  ++loop->source_count;
+}
+
+void event_loop_add(EventLoop *loop, EventSource *source) {
+  add(loop, source->fd, source);
+}
+
+void event_loop_watch(EventLoop *loop, int fd) { add(loop, fd, NULL); }
+
+static void drain(EventSource *source) {
+  uint64_t dump;
+
+  /* A non-blocking fd may have been drained by an earlier wake-up */
+  if (source->event_size &&
+      (read(source->fd, &dump, source->event_size) < 0) &&
+      (errno != EAGAIN) && (errno != EINTR)) {
+    perror("read()");
+    exit(EXIT_FAILURE);
+  }
+}
+
+__attribute__((hot)) int event_loop_run_once(EventLoop *loop,
+                                             int timeout_ms) {
+  struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+  int count;
+
+  while ((count = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS,
+                             timeout_ms)) < 0)
+    if (errno != EINTR) {
+      perror("epoll_wait()");
+      exit(EXIT_FAILURE);
+    }
+
+  for (int i = 0; i < count; ++i) {
+    EventSource *source = events[i].data.ptr;
+    /* A watched fd; its waiter reads it itself */
+    if (!source)
+      continue;
+    drain(source);
+    source->handler(source);
+  }
+
+  if (count) {
+    ++loop->wakeup_count;
+    loop->event_count += count;
+  }
+  return count;
+}
+
+void event_loop_close(EventLoop *loop) {
+  if (close(loop->epoll_fd)) {
+    perror("close()");
+    exit(EXIT_FAILURE);
+  }
+}
@@ -0,0 +1,49 @@
+#ifndef IPC_BENCH_EVENTLOOP_H
+#define IPC_BENCH_EVENTLOOP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * An epoll loop over many interrupt fds (UIO devices, usernet ports or
+ * ivshmem-server eventfds) with a handler per fd. One thread sleeps on all
+ * of its channels at once and serves whichever fire, and a non-blocking fd
+ * no longer means spinning on EAGAIN.
+ */
+#define EVENT_LOOP_MAX_EVENTS 64
+
+typedef struct EventSource EventSource;
+typedef void (*EventHandler)(EventSource *source);
+
+struct EventSource {
+  int fd;
+  /* Drained before the handler: 4 for UIO, 8 for an eventfd, 0 for none */
+  size_t event_size;
+  EventHandler handler;
+  void *context;
+};
+
+typedef struct EventLoop {
+  int epoll_fd;
+  int source_count;
+
+  uint64_t wakeup_count;
+  uint64_t event_count;
+} EventLoop;
+
+void event_loop_init(EventLoop *loop);
+/* `source` must stay valid until the loop is closed */
+void event_loop_add(EventLoop *loop, EventSource *source);
+/* Adds `fd` without a handler, only to wake event_loop_run_once() */
+void event_loop_watch(EventLoop *loop, int fd);
+/**
+ * Sleeps up to `timeout_ms` (-1 for ever) for any source to fire, then
+ * drains and hands every ready one to its handler. Interrupts coalesce, so
+ * handlers check their channel's state rather than count wake-ups.
+ *
+ * \return The number of sources served.
+ */
+int event_loop_run_once(EventLoop *loop, int timeout_ms);
+void event_loop_close(EventLoop *loop);
+
+#endif /* IPC_BENCH_EVENTLOOP_H */
@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "common/benchmarks.h"
+#include "common/interference.h"
+
+#define STREAM_BUFFER_SIZE (64UL << 20)
+#define STREAM_CHUNK_SIZE (1UL << 20)
+#define CHASE_DEFAULT_LLC_SIZE (32UL << 20)
+#define CACHE_LINE_SIZE 64
+
+enum interference_kind { STREAM, CHASE, SYSCALL };
+
+struct chase_node {
+  struct chase_node *next;
+  char padding[CACHE_LINE_SIZE - sizeof(struct chase_node *)];
+};
+
+struct interference_worker {
+  pthread_t thread;
+  enum interference_kind kind;
+  int cpu;
+};
+
+static struct interference_worker workers[INTERFERENCE_MAX_THREADS];
+static int worker_count = 0;
+
+static atomic_int running;
+static pthread_barrier_t ready;
+
+static size_t llc_size(void) {
+  unsigned long size;
+  char unit = 'B';
+
+  FILE *file = fopen("/sys/devices/system/cpu/cpu0/cache/index3/size", "r");
+  if (!file)
+    return CHASE_DEFAULT_LLC_SIZE;
+  if (fscanf(file, "%lu%c", &size, &unit) < 1)
+    size = CHASE_DEFAULT_LLC_SIZE;
+  else if (unit == 'K')
+    size <<= 10;
+  else if (unit == 'M')
+    size <<= 20;
+  fclose(file);
+
+  return size;
+}
+
+static void *xmalloc(size_t size) {
+  void *memory = malloc(size);
+  if (!memory) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  return memory;
+}
+
+static void run_stream(void) {
+  const size_t half = STREAM_BUFFER_SIZE / 2;
+  char *buffer = xmalloc(STREAM_BUFFER_SIZE);
+  memset(buffer, 0x5A, STREAM_BUFFER_SIZE);
+
+  pthread_barrier_wait(&ready);
+
+  while (atomic_load_explicit(&running, memory_order_relaxed))
+    for (size_t offset = 0; offset < half; offset += STREAM_CHUNK_SIZE)
+      memcpy(buffer + half + offset, buffer + offset, STREAM_CHUNK_SIZE);
+
+  free(buffer);
+}
+
+static void run_chase(void) {
+  const size_t count = 2 * llc_size() / sizeof(struct chase_node);
+  struct chase_node *nodes = xmalloc(count * sizeof(struct chase_node));
+  size_t *order = xmalloc(count * sizeof(size_t));
+  unsigned int seed = (unsigned int)(uintptr_t)nodes;
+
+  /* A single random cycle through all nodes defeats the prefetchers */
+  for (size_t i = 0; i < count; ++i)
+    order[i] = i;
+  for (size_t i = count - 1; i > 0; --i) {
+    size_t j = rand_r(&seed) % (i + 1);
+    size_t tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+  for (size_t i = 0; i < count; ++i)
+    nodes[order[i]].next = &nodes[order[(i + 1) % count]];
+  free(order);
+
+  pthread_barrier_wait(&ready);
+
+  struct chase_node *volatile cursor = nodes;
+  while (atomic_load_explicit(&running, memory_order_relaxed))
+    for (int step = 0; step < 1024; ++step)
+      cursor = cursor->next;
+
+  free(nodes);
+}
+
+static void run_syscall(void) {
+  pthread_barrier_wait(&ready);
+
+  while (atomic_load_explicit(&running, memory_order_relaxed))
+    syscall(SYS_getppid);
+}
+
+static void *interference_main(void *argument) {
+  struct interference_worker *worker = argument;
+
+  switch (worker->kind) {
+  case STREAM:
+    run_stream();
+    break;
+  case CHASE:
+    run_chase();
+    break;
+  case SYSCALL:
+    run_syscall();
+    break;
+  }
+
+  return NULL;
+}
+
+static void add_workers(enum interference_kind kind, int threads,
+                        int first_cpu, int last_cpu) {
+  for (int i = 0; i < threads; ++i) {
+    if (worker_count == INTERFERENCE_MAX_THREADS) {
+      fprintf(stderr, "Interference profile exceeds %d threads!\n",
+              INTERFERENCE_MAX_THREADS);
+      exit(EXIT_FAILURE);
+    }
+    workers[worker_count].kind = kind;
+    workers[worker_count].cpu =
+        (first_cpu < 0) ? -1
+                        : first_cpu + (i % (last_cpu - first_cpu + 1));
+    ++worker_count;
+  }
+}
+
+static void parse_profile(const char *profile) {
+  char *copy = strdup(profile);
+  char *saveptr;
+  enum interference_kind kind;
+
+  for (char *entry = strtok_r(copy, ",", &saveptr); entry;
+       entry = strtok_r(NULL, ",", &saveptr)) {
+    int threads = 1, first_cpu = -1, last_cpu = -1;
+    size_t length = strcspn(entry, ":@");
+
+    if (!strncmp(entry, "stream", length) && length == strlen("stream"))
+      kind = STREAM;
+    else if (!strncmp(entry, "chase", length) && length == strlen("chase"))
+      kind = CHASE;
+    else if (!strncmp(entry, "syscall", length) && length == strlen("syscall"))
+      kind = SYSCALL;
+    else {
+      fprintf(stderr, "Unknown interference kind in \"%s\"!\n", entry);
+      exit(EXIT_FAILURE);
+    }
+
+    char *cursor = entry + length;
+    if (*cursor == ':')
+      threads = strtol(cursor + 1, &cursor, 10);
+    if (*cursor == '@') {
+      first_cpu = last_cpu = strtol(cursor + 1, &cursor, 10);
+      if (*cursor == '-')
+        last_cpu = strtol(cursor + 1, &cursor, 10);
+    }
+    if (*cursor || threads < 1 || last_cpu < first_cpu) {
+      fprintf(stderr, "Malformed interference entry \"%s\"!\n", entry);
+      exit(EXIT_FAILURE);
+    }
+
+    add_workers(kind, threads, first_cpu, last_cpu);
+  }
+
+  free(copy);
+}
+
+void interference_start(const char *profile) {
+  benchmark_tag("Interference", "%s", profile ? profile : "none");
+  if (!profile)
+    return;
+
+  parse_profile(profile);
+
+  atomic_store(&running, 1);
+  pthread_barrier_init(&ready, NULL, worker_count + 1);
+
+  for (int i = 0; i < worker_count; ++i) {
+    pthread_attr_t attributes;
+    struct sched_param param = {.sched_priority = 0};
+    pthread_attr_init(&attributes);
+    /* Noisy neighbors stay CFS tasks even under a SCHED_FIFO benchmark */
+    pthread_attr_setinheritsched(&attributes, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attributes, SCHED_OTHER);
+    pthread_attr_setschedparam(&attributes, &param);
+    if (workers[i].cpu >= 0) {
+      cpu_set_t cpuset;
+      CPU_ZERO(&cpuset);
+      CPU_SET(workers[i].cpu, &cpuset);
+      pthread_attr_setaffinity_np(&attributes, sizeof(cpuset), &cpuset);
+    }
+    const int res = pthread_create(&workers[i].thread, &attributes,
+                                   interference_main, &workers[i]);
+    if (res) {
+      fprintf(stderr, "pthread_create(): %s\n", strerror(res));
+      exit(EXIT_FAILURE);
+    }
+    pthread_attr_destroy(&attributes);
+  }
+
+  /* Buffers are allocated and initialized before the measurement starts */
+  pthread_barrier_wait(&ready);
+  fprintf(stderr, "Interference started: %s (%d threads)\n", profile,
+          worker_count);
+}
+
+void interference_stop(void) {
+  if (!worker_count)
+    return;
+
+  atomic_store(&running, 0);
+  for (int i = 0; i < worker_count; ++i)
+    pthread_join(workers[i].thread, NULL);
+
+  pthread_barrier_destroy(&ready);
+  worker_count = 0;
+}
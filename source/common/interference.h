@@ -0,0 +1,27 @@
+#ifndef IPC_BENCH_INTERFERENCE_H
+#define IPC_BENCH_INTERFERENCE_H
+
+/**
+ * Background load co-located with the measured loop.
+ *
+ * A profile is a comma-separated list of `<kind>[:<threads>][@<cpu>[-<cpu>]]`
+ * entries, where <kind> is one of
+ *   stream  - memory-bandwidth streaming (memcpy over a buffer >> LLC)
+ *   chase   - LLC-thrashing pointer chase over 2x the LLC size
+ *   syscall - tight loop of cheap system calls
+ * Threads are pinned round-robin to the given CPU range, if any.
+ * e.g. "stream:2@2-3,chase@4,syscall@5"
+ */
+#define INTERFERENCE_MAX_THREADS 64
+
+/**
+ * Spawns the threads of `profile` and returns once all of them are loaded and
+ * running. A NULL profile starts nothing. Either way, the results are tagged
+ * with the active profile.
+ */
+void interference_start(const char *profile);
+
+/* Stops and joins all threads started by interference_start(). */
+void interference_stop(void);
+
+#endif /* IPC_BENCH_INTERFERENCE_H */
@@ -2,34 +2,250 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <x86gprintrin.h>
 
 #include "common/common.h"
 #include "common/ivshmem.h"
+#include "common/layout.h"
+#include "common/pending.h"
+#include "common/realtime.h"
+
+void ivshmem_region_init(IvshmemRegion *region, int fd, size_t size,
+                         off_t mmap_offset, int is_windowable) {
+  region->fd = fd;
+  region->size = size;
+  region->mmap_offset = mmap_offset;
+  region->is_windowable = is_windowable;
+
+  region->mapping_count = 0;
+  region->is_window = 0;
+
+  region->open_time = 0;
+  region->map_time = 0;
+  region->touch_time = 0;
+
+  fprintf(stderr, "ivshmem_size == %zu\n", size);
+}
+
+void ivshmem_region_open(IvshmemRegion *region, const char *path, int flags,
+                         size_t size_force) {
+  bench_t start = now();
+  off_t mmap_offset = 0;
+  size_t size;
+
+  int fd = open(path, flags);
+  if (fd < 0) {
+    perror("open()");
+    exit(EXIT_FAILURE);
+  }
+
+  if (size_force)
+    size = size_force;
+  else {
+    struct stat st;
+    if (fstat(fd, &st)) {
+      perror("fstat()");
+      exit(EXIT_FAILURE);
+    }
+    size = st.st_size;
+
+    if (!size) {
+      /* Try usernet_ivshmem's way */
+      if (ioctl(fd, IOCTL_GETSIZE, &size) < 0) {
+        perror("ioctl(IOCTL_GETSIZE)");
+        exit(EXIT_FAILURE);
+      }
+      mmap_offset = IVSHMEM_MMAP_MEM_OFFSET;
+    }
+  }
+
+  /* Plain files and kvmfr-style devices map at any page offset */
+  ivshmem_region_init(region, fd, size, mmap_offset, !mmap_offset);
+  region->open_time = now() - start;
+}
+
+static IvshmemMapping *find_mapping(IvshmemRegion *region, size_t offset,
+                                    size_t length) {
+  for (int i = 0; i < region->mapping_count; ++i) {
+    IvshmemMapping *mapping = &region->mappings[i];
+    if ((offset >= mapping->offset) &&
+        (offset + length <= mapping->offset + mapping->size))
+      return mapping;
+  }
+  return NULL;
+}
+
+void *ivshmem_region_map(IvshmemRegion *region, size_t offset, size_t length,
+                         int is_window, int prefault_threads) {
+  const size_t page_size = getpagesize();
+  size_t mapped_size = 0;
+  bench_t start;
+
+  if ((offset > region->size) || (length > region->size - offset)) {
+    fprintf(stderr, "%zu bytes at %zu do not fit into the %zu bytes region!\n",
+            length, offset, region->size);
+    exit(EXIT_FAILURE);
+  }
+
+  if (is_window && !region->is_windowable) {
+    warn("This device cannot map a window; Map the whole region");
+    is_window = 0;
+  }
+  region->is_window = is_window;
+
+  IvshmemMapping *mapping = find_mapping(region, offset, length);
+  if (!mapping) {
+    if (region->mapping_count == IVSHMEM_REGION_MAX_MAPPINGS) {
+      fprintf(stderr, "Too many mappings of the ivshmem region!\n");
+      exit(EXIT_FAILURE);
+    }
+    mapping = &region->mappings[region->mapping_count++];
+
+    if (is_window) {
+      mapping->offset = offset & ~(page_size - 1);
+      mapping->size = ((offset + length + page_size - 1) & ~(page_size - 1)) -
+                      mapping->offset;
+    } else {
+      mapping->offset = 0;
+      mapping->size = region->size;
+    }
+
+    start = now();
+    mapping->memory =
+        mmap(NULL, mapping->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+             region->fd, region->mmap_offset + mapping->offset);
+    if (mapping->memory == MAP_FAILED) {
+      perror("mmap()");
+      exit(EXIT_FAILURE);
+    }
+    region->map_time += now() - start;
+
+    /* Read-only: other peers may already be using their slots */
+    start = now();
+    if (prefault_threads)
+      prefault_memory_parallel(mapping->memory, mapping->size, 0,
+                               prefault_threads);
+    region->touch_time += now() - start;
+  }
+
+  void *memory = mapping->memory + (offset - mapping->offset);
+  if (!prefault_threads) {
+    start = now();
+    prefault_memory(memory, length, 0);
+    region->touch_time += now() - start;
+  }
+
+  for (int i = 0; i < region->mapping_count; ++i)
+    mapped_size += region->mappings[i].size;
+  benchmark_tag("Mapping", "%s (%zu of %zu bytes)",
+                region->is_window ? "window" : "whole region", mapped_size,
+                region->size);
+  benchmark_tag("Startup", "open %.3f ms, mmap %.3f ms, touch %.3f ms",
+                region->open_time / 1e6, region->map_time / 1e6,
+                region->touch_time / 1e6);
+
+  return memory;
+}
+
+void ivshmem_region_close(IvshmemRegion *region) {
+  for (int i = 0; i < region->mapping_count; ++i)
+    if (munmap(region->mappings[i].memory, region->mappings[i].size)) {
+      perror("munmap()");
+      exit(EXIT_FAILURE);
+    }
+  if (close(region->fd)) {
+    perror("close()");
+    exit(EXIT_FAILURE);
+  }
+}
 
 void userspace_shm_wait(uint32_t *guard, const uint32_t expect) {
-  while (*guard != expect)
+  while (shm_consume(guard) != expect)
     __pause(); // Optimization for spin loop
 }
 
-void uio_wait(int fd, uint32_t *guard, uint32_t expect,
-              struct ivshmem_reg *reg_ptr, struct IvshmemArgs *args) {
+static const char *const UIO_WAIT_MODE_NAMES[] = {
+    [UIO_WAIT_READ] = "read",
+    [UIO_WAIT_URING] = "uring",
+    [UIO_WAIT_SQPOLL] = "sqpoll",
+};
+#define UIO_WAIT_MODE_COUNT                                                    \
+  (sizeof(UIO_WAIT_MODE_NAMES) / sizeof(UIO_WAIT_MODE_NAMES[0]))
+
+const char *uio_wait_mode_name(UioWaitMode mode) {
+  return UIO_WAIT_MODE_NAMES[mode];
+}
+
+static int uio_wait_mode_parse(const char *name) {
+  for (size_t mode = 0; mode < UIO_WAIT_MODE_COUNT; ++mode)
+    if (!strcmp(name, UIO_WAIT_MODE_NAMES[mode]))
+      return mode;
+  return -1;
+}
+
+static void uio_uring_post(UioUring *uio) {
+  struct io_uring_sqe *sqe = uring_get_sqe(&uio->ring);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = uio->fd;
+  sqe->addr = (uintptr_t)&uio->count;
+  sqe->len = sizeof(uio->count);
+  /* The UIO fd has no file position */
+  sqe->off = -1;
+  uring_submit(&uio->ring);
+}
+
+void uio_uring_init(UioUring *uio, int fd, struct IvshmemArgs *args) {
+  uring_init(&uio->ring, 2, args->uio_wait_mode == UIO_WAIT_SQPOLL);
+  uio->fd = fd;
+  uio_uring_post(uio);
+}
+
+void uio_uring_close(UioUring *uio) { uring_close(&uio->ring); }
+
+/* Like read(): spins for the posted read to complete, then re-posts it */
+static ssize_t uio_uring_read(UioUring *uio) {
+  struct io_uring_cqe *cqe;
+  while (!(cqe = uring_peek_cqe(&uio->ring)))
+    __pause();
+
+  const int res = cqe->res;
+  uring_cqe_seen(&uio->ring);
+  uio_uring_post(uio);
+
+  if (res < 0) {
+    errno = -res;
+    return -1;
+  }
+  return res;
+}
+
+void uio_wait(int fd, UioUring *uring, EventLoop *waiter, uint32_t *guard,
+              uint32_t expect, struct ivshmem_reg *reg_ptr,
+              struct IvshmemArgs *args) {
   int ret;
   uint32_t dump;
   do
     /* Be careful, It might return not sizeof(uint32_t) even if successful! */
-    if ((ret = read(fd, &dump, sizeof(uint32_t)) > 0)) {
-      if (*guard == expect)
+    if ((ret = (uring ? uio_uring_read(uring)
+                      : read(fd, &dump, sizeof(uint32_t))) > 0)) {
+      if (shm_consume(guard) == expect)
         return;
-      else // This interrupt is not for me... Ring me again.
-        reg_ptr->doorbell = IVSHMEM_DOORBELL_MSG(reg_ptr->ivposition, 0);
-    }
+      /* An own vector only fires for this channel; it was a stale count */
+      if (args->is_vector_per_channel)
+        continue;
+      // This interrupt is not for me... Ring me again.
+      reg_ptr->doorbell = IVSHMEM_DOORBELL_MSG(reg_ptr->ivposition, 0);
+    } else if (waiter && (errno == EAGAIN))
+      event_loop_run_once(waiter, -1);
   /* There can be still EAGAIN happening even if it is blocking mode! */
   while (likely((errno == 0) || (errno == EAGAIN) || (errno == EINTR)));
   perror("read()");
@@ -38,15 +254,62 @@ void uio_wait(int fd, uint32_t *guard, uint32_t expect,
 void uio_notify(uint32_t *guard, uint32_t expect, struct ivshmem_reg *reg_ptr,
                 struct IvshmemArgs *args) {
   /* Post the memory update first. */
-  userspace_shm_notify(guard, expect);
+  shm_publish(guard, expect, args->fence);
   /* Then, send interrupt. */
-  reg_ptr->doorbell = IVSHMEM_DOORBELL_MSG(args->peer_id, 0);
+  reg_ptr->doorbell =
+      IVSHMEM_DOORBELL_MSG(args->peer_id, ivshmem_vector(args));
 }
 
-void usernet_intr_wait(int fd, struct IvshmemArgs *args) {
+int uio_open_channel(const IvshmemArgs *args, int channel) {
+  const char *path = args->intr_dev_path;
+  size_t prefix = strlen(path);
+  const int flags = O_RDWR | O_ASYNC | (args->is_nonblock ? O_NONBLOCK : 0);
+  char channel_path[256];
+  int fd;
+
+  while (prefix && (path[prefix - 1] >= '0') && (path[prefix - 1] <= '9'))
+    --prefix;
+  if (prefix == strlen(path)) {
+    fprintf(stderr, "-n needs a numbered UIO device (e.g. /dev/uio0) as -I\n");
+    exit(EXIT_FAILURE);
+  }
+  snprintf(channel_path, sizeof(channel_path), "%.*s%d", (int)prefix, path,
+           atoi(path + prefix) + channel);
+
+  if ((fd = open(channel_path, flags)) < 0) {
+    perror("open(ivshmem_uiofd)");
+    exit(EXIT_FAILURE);
+  }
+  return fd;
+}
+
+void uio_doorbell_wait(uint32_t *guard, uint32_t expect, void *doorbell) {
+  UioDoorbell *uio = doorbell;
+  uint32_t dump;
+
+  /* Interrupts coalesce; only the guard tells what actually happened */
+  while (__atomic_load_n(guard, __ATOMIC_ACQUIRE) != expect)
+    if (read(uio->fd, &dump, sizeof(dump)) < 0) {
+      if (uio->waiter && (errno == EAGAIN))
+        event_loop_run_once(uio->waiter, -1);
+      else if ((errno != EAGAIN) && (errno != EINTR)) {
+        perror("read()");
+        exit(EXIT_FAILURE);
+      }
+    }
+}
+void uio_doorbell_notify(void *doorbell) {
+  UioDoorbell *uio = doorbell;
+  uio->reg_ptr->doorbell = IVSHMEM_DOORBELL_MSG(uio->args->peer_id,
+                                                ivshmem_vector(uio->args));
+}
+
+void usernet_intr_wait(int fd, EventLoop *waiter, struct IvshmemArgs *args) {
   do
     if (!ioctl(fd, IOCTL_WAIT, -1))
       return;
+    else if (waiter && (errno == EAGAIN))
+      event_loop_run_once(waiter, -1);
   while (likely(((errno == EAGAIN) && args->is_nonblock) || (errno == EINTR)));
   perror("ioctl(IOCTL_WAIT)");
   exit(EXIT_FAILURE);
@@ -60,22 +323,138 @@ void usernet_intr_notify(int fd, struct IvshmemArgs *args) {
   exit(EXIT_FAILURE);
 }
 
+void usernet_connect(int fd, struct IvshmemArgs *args) {
+  if (ioctl(fd, IOCTL_BIND, args->shmem_index)) {
+    perror("ioctl(IOCTL_BIND)");
+    exit(EXIT_FAILURE);
+  }
+  if (ioctl(fd, IOCTL_CLEAR, 0)) {
+    perror("ioctl(IOCTL_CLEAR)");
+    exit(EXIT_FAILURE);
+  }
+  if (ioctl(fd, IOCTL_CONNECT,
+            USERNET_IVSHMEM_IDENT(args->peer_id, args->shmem_index))) {
+    perror("ioctl(IOCTL_CONNECT)");
+    exit(EXIT_FAILURE);
+  }
+}
+
+int usernet_open_channel(IvshmemArgs *args, int channel) {
+  const int flags = O_RDWR | O_ASYNC | (args->is_nonblock ? O_NONBLOCK : 0);
+  const int first = args->shmem_index;
+  int fd;
+
+  if ((fd = open(args->intr_dev_path, flags)) < 0) {
+    perror("open()");
+    exit(EXIT_FAILURE);
+  }
+  args->shmem_index = first + channel;
+  usernet_connect(fd, args);
+  args->shmem_index = first;
+  return fd;
+}
+
+/* Spin at least this long (ns), or a waiter would never learn to spin again */
+#define USERNET_MIN_SPIN 1000
+
+void usernet_poller_init(UsernetPoller *poller, int fd, EventLoop *waiter,
+                         struct IvshmemArgs *args) {
+  poller->fd = fd;
+  poller->waiter = waiter;
+  poller->args = args;
+  poller->max_spin = args->poll_spin_us * 1000;
+  if (poller->max_spin < USERNET_MIN_SPIN)
+    poller->max_spin = USERNET_MIN_SPIN;
+  poller->spin_limit = poller->max_spin;
+  poller->wait_count = 0;
+  poller->sleep_count = 0;
+}
+
+void usernet_poll_wait(UsernetPoller *poller, uint32_t *guard,
+                       uint32_t expect) {
+  const bench_t start = now();
+  bench_t spun = 0;
+  uint32_t value;
+
+  ++poller->wait_count;
+  /* The peer may have marked our last value before it consumed it */
+  while (((value = shm_consume(guard)) & ~USERNET_SLEEPING) != expect) {
+    if ((spun = now() - start) < poller->spin_limit) {
+      __pause();
+      continue;
+    }
+
+    /* Ask for a signal, unless the peer has published in the meantime */
+    if (!__atomic_compare_exchange_n(guard, &value, value | USERNET_SLEEPING,
+                                     0, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE))
+      continue;
+    ++poller->sleep_count;
+    /* Signals left over from before may wake us early */
+    while ((shm_consume(guard) & ~USERNET_SLEEPING) != expect)
+      usernet_intr_wait(poller->fd, poller->waiter, poller->args);
+
+    /* The peer takes longer than the limit; spinning was wasted */
+    poller->spin_limit -= (poller->spin_limit - USERNET_MIN_SPIN) / 8;
+    return;
+  }
+
+  /* Move toward twice this wait, within the -U threshold */
+  uint64_t target = 2 * spun;
+  if (target < USERNET_MIN_SPIN)
+    target = USERNET_MIN_SPIN;
+  else if (target > poller->max_spin)
+    target = poller->max_spin;
+  poller->spin_limit += ((int64_t)target - (int64_t)poller->spin_limit) / 8;
+}
+void usernet_poll_notify(UsernetPoller *poller, uint32_t *guard,
+                         uint32_t value) {
+  /* A full barrier: the payload goes first, then the peer's mark is read */
+  if (__atomic_exchange_n(guard, value, __ATOMIC_SEQ_CST) & USERNET_SLEEPING)
+    usernet_intr_notify(poller->fd, poller->args);
+}
+
 static void ivshmem_usage(const char *progname) {
   printf("Usage: %s [OPTION]...\n"
          "  -b <block_size> (default is %d)\n"
          "  -c <count> (default is %d)\n"
-         "  -I <intr_dev_path>\n"
+         "  -I <intr_dev_path> (ivshmem-server socket for ivshmem-eventfd)\n"
          "  -M <mem_dev_path>\n"
          "  -S <mem_size_force>\n"
          "  -A <peer_address>\n"
          "  -i <shmem_index> (default is 0)\n"
+         "  -V: Use the vector of the shared memory index, not vector 0\n"
+         "  -Q <channels>: Serve this many slots behind one doorbell\n"
+         "  -n <channels>: Serve this many slots, a vector or port each, from "
+         "one thread (implies -V)\n"
+         "  -f <fence>: auto, none, sfence, mfence or locked before the guard "
+         "store\n"
+         "  -U <spin_us>: Poll a guard (usernet), sleeping in IOCTL_WAIT after "
+         "this long\n"
+         "  -u <wait>: read, uring or sqpoll on the UIO fd (default is "
+         "read)\n"
+         "  -E <hint>: auto, none, cldemote, clwb or clflushopt on the "
+         "written payload\n"
          "  -R: Reset previous interrupts (default is `false`)"
          "  -N: Non-block mode (default is `false`)\n"
-         "  -D: Debug mode (default is `false`)\n",
-         progname, DEFAULT_MESSAGE_COUNT, DEFAULT_MESSAGE_SIZE);
+         "  -D: Debug mode (default is `false`)\n"
+         "  -X <interference_profile> (e.g., `stream:2@2-3,chase@4`)\n"
+         "  -P <server_cpu>,<client_cpu>: Pin both peers\n"
+         "  -F <priority>: SCHED_FIFO with mlockall (default is CFS)\n"
+         "  -H: Disable transparent hugepages (default is `false`)\n"
+         "  -W: Map only the pages of the used slot (default is `false`)\n"
+         "  -j <threads>: Prefault the whole mapping with this many threads\n"
+         "  -L <layout>: legacy, aligned, aligned-2m or stamped (default is "
+         "legacy)\n"
+         "  -B <buffers>: Stream STC through 1-%d buffers (default is "
+         "ping-pong)\n"
+         "  -k <chunk>: Stream each message in chunks of this size (e.g., "
+         "`64m`)\n",
+         progname, DEFAULT_MESSAGE_COUNT, DEFAULT_MESSAGE_SIZE,
+         LAYOUT_MAX_BUFFERS);
 }
-void ivshmem_parse_args(IvshmemArgs *args, int argc, char *argv[]) {
-  int c;
+void ivshmem_parse_args(IvshmemArgs *args, int argc, char *argv[],
+                        int caps) {
+  int c, layout, fence, hint, mode;
 
   args->count = DEFAULT_MESSAGE_COUNT;
   args->size = DEFAULT_MESSAGE_SIZE;
@@ -87,6 +466,12 @@ void ivshmem_parse_args(IvshmemArgs *args, int argc, char *argv[]) {
   args->peer_id = -1;
 
   args->shmem_index = 0;
+  args->is_vector_per_channel = 0;
+  args->channel_count = 0;
+  args->loop_channel_count = 0;
+
+  args->fence = FENCE_AUTO;
+  args->hint = HINT_NONE;
 
   args->is_reset = 0;
 
@@ -94,13 +479,34 @@ void ivshmem_parse_args(IvshmemArgs *args, int argc, char *argv[]) {
 
   args->is_debug = 0;
 
-  while ((c = getopt(argc, argv, "hRNDb:c:I:M:A:i:")) != -1) {
+  args->interference = NULL;
+
+  args->server_cpu = -1;
+  args->client_cpu = -1;
+
+  args->rt_priority = 0;
+  args->is_thp_disabled = 0;
+
+  args->is_window = 0;
+  args->prefault_threads = 0;
+
+  args->layout = LAYOUT_LEGACY;
+
+  args->buffer_count = 0;
+  args->chunk_size = 0;
+
+  args->poll_spin_us = 0;
+  args->uio_wait_mode = UIO_WAIT_READ;
+
+  while ((c = getopt(argc, argv,
+                      "hRNDHWVb:c:I:M:S:A:i:X:P:F:j:L:B:k:Q:n:f:E:U:u:")) !=
+         -1) {
     switch (c) {
     case 'b': /* Block size */
-      args->size = atoi(optarg);
+      args->size = parse_size(optarg);
       break;
     case 'c': /* Count */
-      args->count = atoi(optarg);
+      args->count = parse_count(optarg);
       break;
 
     case 'I': /* Interrupt device path */
@@ -120,6 +526,26 @@ void ivshmem_parse_args(IvshmemArgs *args, int argc, char *argv[]) {
     case 'i': /* Memory index */
       args->shmem_index = atoi(optarg);
       break;
+    case 'V': /* Vector per channel */
+      args->is_vector_per_channel = 1;
+      break;
+    case 'n': /* Event-loop channels */
+      args->loop_channel_count = atoi(optarg);
+      if ((args->loop_channel_count < 1) ||
+          (args->loop_channel_count > LAYOUT_MAX_SLOTS)) {
+        fprintf(stderr, "-n expects 1 to %d channels\n", LAYOUT_MAX_SLOTS);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'Q': /* Channel group */
+      args->channel_count = atoi(optarg);
+      if ((args->channel_count < 1) ||
+          (args->channel_count > PENDING_MAX_CHANNELS)) {
+        fprintf(stderr, "-Q expects 1 to %d channels\n",
+                PENDING_MAX_CHANNELS);
+        exit(EXIT_FAILURE);
+      }
+      break;
 
     case 'R': /* Reset previous interrupts */
       args->is_reset = 1;
@@ -133,6 +559,87 @@ void ivshmem_parse_args(IvshmemArgs *args, int argc, char *argv[]) {
       args->is_debug = 1;
       break;
 
+    case 'X': /* Interference profile */
+      args->interference = optarg;
+      break;
+
+    case 'P': /* CPU pinning */
+      if ((sscanf(optarg, "%d,%d", &args->server_cpu, &args->client_cpu) !=
+           2) ||
+          (args->server_cpu < 0) || (args->client_cpu < 0)) {
+        fprintf(stderr, "-P expects <server_cpu>,<client_cpu>\n");
+        exit(EXIT_FAILURE);
+      }
+      break;
+
+    case 'F': /* SCHED_FIFO priority */
+      args->rt_priority = atoi(optarg);
+      if ((args->rt_priority < sched_get_priority_min(SCHED_FIFO)) ||
+          (args->rt_priority > sched_get_priority_max(SCHED_FIFO))) {
+        fprintf(stderr, "Invalid SCHED_FIFO priority %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'H': /* Disable THP */
+      args->is_thp_disabled = 1;
+      break;
+
+    case 'W': /* Window mapping */
+      args->is_window = 1;
+      break;
+    case 'j': /* Prefault threads */
+      args->prefault_threads = atoi(optarg);
+      if (args->prefault_threads < 0) {
+        fprintf(stderr, "Invalid prefault thread count %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+
+    case 'L': /* Slot layout */
+      if ((layout = layout_parse(optarg)) < 0) {
+        fprintf(stderr, "Unknown layout \"%s\"\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      args->layout = layout;
+      break;
+
+    case 'B': /* Streaming buffers */
+      args->buffer_count = atoi(optarg);
+      if ((args->buffer_count < 1) ||
+          (args->buffer_count > LAYOUT_MAX_BUFFERS)) {
+        fprintf(stderr, "-B expects 1 to %d buffers\n", LAYOUT_MAX_BUFFERS);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'k': /* Chunk size */
+      args->chunk_size = parse_size(optarg);
+      break;
+    case 'U': /* Poll threshold */
+      args->poll_spin_us = parse_count(optarg);
+      break;
+    case 'u': /* UIO wait */
+      if ((mode = uio_wait_mode_parse(optarg)) < 0) {
+        fprintf(stderr, "Unknown UIO wait \"%s\"\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      args->uio_wait_mode = mode;
+      break;
+
+    case 'f': /* Publish fence */
+      if ((fence = publish_fence_parse(optarg)) < FENCE_AUTO) {
+        fprintf(stderr, "Unknown fence \"%s\"\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      args->fence = fence;
+      break;
+    case 'E': /* Cache-line hint */
+      if ((hint = publish_hint_parse(optarg)) < HINT_AUTO) {
+        fprintf(stderr, "Unknown hint \"%s\"\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      args->hint = hint;
+      break;
+
     case 'h': /* help */
     default:
       ivshmem_usage(argv[0]);
@@ -140,4 +647,104 @@ void ivshmem_parse_args(IvshmemArgs *args, int argc, char *argv[]) {
       break;
     }
   }
+
+  if ((args->layout == LAYOUT_STAMPED) && !(caps & IVSHMEM_CAP_STAMPED)) {
+    fprintf(stderr, "Only ivshmem-shm polls stamped lines; Drop -L stamped\n");
+    exit(EXIT_FAILURE);
+  }
+  if (args->loop_channel_count && !(caps & IVSHMEM_CAP_EVENT_LOOP)) {
+    fprintf(stderr, "Only ivshmem-eventfd, -uio and -usernet run an event "
+                    "loop; Drop -n\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (args->chunk_size && !args->buffer_count) {
+    fprintf(stderr, "Chunks are streamed; Use 2 buffers\n");
+    args->buffer_count = 2;
+  }
+  if (args->loop_channel_count) {
+    if (args->buffer_count || args->channel_count ||
+        (args->layout == LAYOUT_STAMPED)) {
+      fprintf(stderr, "Event-loop channels run ping-pong on guards; Drop -B, "
+                      "-k, -Q and -L stamped\n");
+      exit(EXIT_FAILURE);
+    }
+    if (args->layout == LAYOUT_LEGACY) {
+      fprintf(stderr, "Event-loop channels need the region directory; Use "
+                      "-L aligned\n");
+      args->layout = LAYOUT_ALIGNED;
+    }
+    if (args->poll_spin_us) {
+      fprintf(stderr, "Event-loop channels sleep in epoll; Ignore -U\n");
+      args->poll_spin_us = 0;
+    }
+    /* Channel i takes the vector of its slot, -i plus i, as -V would */
+    args->is_vector_per_channel = 1;
+  }
+  if ((args->layout == LAYOUT_STAMPED) &&
+      (args->buffer_count || args->channel_count)) {
+    fprintf(stderr, "Stamped lines replace the guards; Drop -B, -k and -Q\n");
+    exit(EXIT_FAILURE);
+  }
+  if (args->channel_count) {
+    if (args->buffer_count) {
+      fprintf(stderr, "Channel groups run ping-pong; Drop -B and -k\n");
+      exit(EXIT_FAILURE);
+    }
+    if (args->layout == LAYOUT_LEGACY) {
+      fprintf(stderr, "Channel groups need the region directory; Use -L "
+                      "aligned\n");
+      args->layout = LAYOUT_ALIGNED;
+    }
+  }
+  if (args->buffer_count && (args->layout == LAYOUT_LEGACY)) {
+    fprintf(stderr, "Streaming needs a guard per buffer; Use -L aligned\n");
+    args->layout = LAYOUT_ALIGNED;
+  }
+
+  if (args->rt_priority && (args->server_cpu >= 0) &&
+      (args->server_cpu == args->client_cpu))
+    warn("SCHED_FIFO peers sharing a CPU starve each other; Pin them "
+         "apart with -P");
+}
+
+size_t ivshmem_chunk_size(const IvshmemArgs *args) {
+  if (args->chunk_size && (args->chunk_size < args->size))
+    return args->chunk_size;
+  return args->size;
+}
+
+int ivshmem_vector(const IvshmemArgs *args) {
+  return args->is_vector_per_channel ? args->shmem_index : 0;
+}
+
+void ivshmem_resolve_fence(IvshmemArgs *args) {
+  if (args->fence == FENCE_AUTO)
+    args->fence = args->mem_dev_path ? publish_fence_for(args->mem_dev_path)
+                                     : FENCE_NONE;
+  benchmark_tag("Fence", "%s", publish_fence_name(args->fence));
+}
+
+void ivshmem_resolve_hint(IvshmemArgs *args) {
+  const PublishHint hint = publish_hint_resolve(args->hint);
+
+  if ((args->hint != HINT_AUTO) && (hint != args->hint))
+    fprintf(stderr, "This CPU has no %s; Use %s\n",
+            publish_hint_name(args->hint), publish_hint_name(hint));
+  args->hint = hint;
+  if (hint != HINT_NONE)
+    benchmark_tag("Hint", "%s", publish_hint_name(hint));
+}
+
+EventLoop *ivshmem_waiter_init(EventLoop *loop, int fd,
+                               const IvshmemArgs *args) {
+  if (!args->is_nonblock)
+    return NULL;
+  event_loop_init(loop);
+  event_loop_watch(loop, fd);
+  return loop;
+}
+void ivshmem_waiter_close(EventLoop *waiter) {
+  if (waiter)
+    event_loop_close(waiter);
 }
@@ -1,7 +1,14 @@
 #ifndef IPC_BENCH_IVSHMEM_H
 #define IPC_BENCH_IVSHMEM_H
 
+#include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
+
+#include "common/benchmarks.h"
+#include "common/eventloop.h"
+#include "common/publish.h"
+#include "common/uring.h"
 
 /* H/W-specific */
 
@@ -58,9 +65,31 @@ enum usernet_ivshmem_ioctl_cmds {
   IOCTL_CLOSE,
 };
 
+typedef enum IvshmemLayout {
+  /* Guard word right in front of the payload, packed at the region's tail */
+  LAYOUT_LEGACY,
+  /* Region directory, cache-line-aligned payloads, guards on own lines */
+  LAYOUT_ALIGNED,
+  /* Same, with payloads on 2 MiB boundaries */
+  LAYOUT_ALIGNED_2M,
+  /* Aligned, with a version stamp in every payload line (ivshmem-shm) */
+  LAYOUT_STAMPED,
+} IvshmemLayout;
+
+/* How ivshmem-uio learns of an interrupt */
+typedef enum UioWaitMode {
+  /* A blocking read() per interrupt */
+  UIO_WAIT_READ,
+  /* A read kept posted on an io_uring, its completion polled in userspace */
+  UIO_WAIT_URING,
+  /* Same, with a kernel thread re-posting the read (IORING_SETUP_SQPOLL) */
+  UIO_WAIT_SQPOLL,
+} UioWaitMode;
+const char *uio_wait_mode_name(UioWaitMode mode);
+
 typedef struct IvshmemArgs {
-  int count;
-  int size;
+  uint64_t count;
+  size_t size;
 
   const char *intr_dev_path;
   const char *mem_dev_path;
@@ -69,24 +98,205 @@ typedef struct IvshmemArgs {
   int peer_id;
 
   int shmem_index;
+  /* Ring and wait on vector `shmem_index` instead of vector 0 */
+  int is_vector_per_channel;
+  /* Serves this many slots from `shmem_index` on as one channel group */
+  int channel_count;
+  /* Serves this many slots, each on its own vector, from one epoll loop */
+  int loop_channel_count;
+
+  /* Orders the payload before the guard; see ivshmem_resolve_fence() */
+  PublishFence fence;
+  /* Pushes the payload toward the LLC before publishing (ivshmem-shm) */
+  PublishHint hint;
 
   int is_reset;
 
   int is_nonblock;
 
   int is_debug;
+
+  const char *interference;
+
+  int server_cpu;
+  int client_cpu;
+
+  int rt_priority;
+  int is_thp_disabled;
+
+  int is_window;
+  int prefault_threads;
+
+  IvshmemLayout layout;
+
+  /* Streams STC through this many buffers; 0 for ping-pong */
+  int buffer_count;
+  /* Splits each streamed message into chunks of this size; 0 for none */
+  size_t chunk_size;
+
+  /* usernet: poll a guard for up to this long before IOCTL_WAIT; 0 for none */
+  uint64_t poll_spin_us;
+  /* ivshmem-uio: how uio_wait() learns of interrupts */
+  UioWaitMode uio_wait_mode;
 } IvshmemArgs;
-void ivshmem_parse_args(IvshmemArgs *args, int argc, char *argv[]);
+/* Options that only some of the ivshmem binaries implement */
+#define IVSHMEM_CAP_STAMPED (1 << 0) /* -L stamped */
+#define IVSHMEM_CAP_EVENT_LOOP (1 << 1) /* -n */
+
+/* Options outside `caps` are usage errors */
+void ivshmem_parse_args(IvshmemArgs *args, int argc, char *argv[], int caps);
+/* Bytes per slot buffer: the chunk size if smaller than a message */
+size_t ivshmem_chunk_size(const IvshmemArgs *args);
+/* The MSI-X vector (or eventfd) of this channel */
+int ivshmem_vector(const IvshmemArgs *args);
+/* Picks the fence of the memory device's mapping type unless -f is given */
+void ivshmem_resolve_fence(IvshmemArgs *args);
+/* Falls back from the -E hint to one that this CPU supports */
+void ivshmem_resolve_hint(IvshmemArgs *args);
+/**
+ * With -N, sets `loop` up to watch the non-blocking `fd`, so that a wait
+ * finding no interrupt sleeps in epoll_wait() instead of spinning on EAGAIN.
+ *
+ * \return `loop`, or NULL without -N.
+ */
+EventLoop *ivshmem_waiter_init(EventLoop *loop, int fd,
+                               const IvshmemArgs *args);
+void ivshmem_waiter_close(EventLoop *waiter);
+
+#define IVSHMEM_REGION_MAX_MAPPINGS 4
 
-#define userspace_shm_notify(guard, update) ((void)(*guard = update))
+typedef struct IvshmemMapping {
+  void *memory;
+  size_t offset;
+  size_t size;
+} IvshmemMapping;
+
+/* The shared memory region of an ivshmem device (or of a stand-in file) */
+typedef struct IvshmemRegion {
+  int fd;
+  size_t size;
+  /* Where the region starts in the mmap() offset space of `fd` */
+  off_t mmap_offset;
+  /* UIO-style devices select whole maps by offset and cannot map windows */
+  int is_windowable;
+
+  /* The parts of the region actually mapped */
+  IvshmemMapping mappings[IVSHMEM_REGION_MAX_MAPPINGS];
+  int mapping_count;
+  int is_window;
+
+  bench_t open_time;
+  bench_t map_time;
+  bench_t touch_time;
+} IvshmemRegion;
+
+/**
+ * Opens `path` and determines the region size: `size_force` if non-zero,
+ * then the file size, then usernet_ivshmem's IOCTL_GETSIZE.
+ */
+void ivshmem_region_open(IvshmemRegion *region, const char *path, int flags,
+                         size_t size_force);
+/* Adopts an fd opened by the caller, e.g. the UIO interrupt device */
+void ivshmem_region_init(IvshmemRegion *region, int fd, size_t size,
+                         off_t mmap_offset, int is_windowable);
+
+/**
+ * Maps the region and returns the address of the `length` bytes at `offset`.
+ * With `is_window`, only the pages covering those bytes are mapped. The
+ * mapping is then read-touched: entirely by `prefault_threads` threads, or
+ * just the requested bytes if it is 0. The startup costs are reported along
+ * with the results. May be called again for other parts of the region; an
+ * existing mapping is reused if it covers them.
+ */
+void *ivshmem_region_map(IvshmemRegion *region, size_t offset, size_t length,
+                         int is_window, int prefault_threads);
+/* Unmaps all parts of the region and closes its fd */
+void ivshmem_region_close(IvshmemRegion *region);
+
+#define userspace_shm_notify(guard, update)                                    \
+  shm_publish((guard), (update), FENCE_NONE)
 void userspace_shm_wait(uint32_t *guard, const uint32_t expect);
 
-void uio_wait(int fd, uint32_t *guard, uint32_t expect,
-              struct ivshmem_reg *reg_ptr, struct IvshmemArgs *args);
+/**
+ * A 4-byte read kept posted on the UIO fd. Its completion is polled from the
+ * CQ ring, so that a waiter only enters the kernel to re-post the read, and
+ * not even then with SQPOLL.
+ */
+typedef struct UioUring {
+  Uring ring;
+  int fd;
+  uint32_t count;
+} UioUring;
+/* Sets the ring up in the -u mode and posts the first read */
+void uio_uring_init(UioUring *uio, int fd, struct IvshmemArgs *args);
+void uio_uring_close(UioUring *uio);
+
+/**
+ * Waits on `uring` if not NULL, or in read() on `fd`; a non-blocking `fd`
+ * sleeps in `waiter` (see ivshmem_waiter_init()) between its reads.
+ */
+void uio_wait(int fd, UioUring *uring, EventLoop *waiter, uint32_t *guard,
+              uint32_t expect, struct ivshmem_reg *reg_ptr,
+              struct IvshmemArgs *args);
 void uio_notify(uint32_t *guard, uint32_t expect, struct ivshmem_reg *reg_ptr,
                 struct IvshmemArgs *args);
 
-void usernet_intr_wait(int fd, struct IvshmemArgs *args);
+/**
+ * Opens the UIO device of event-loop channel `channel` (-n). UIO has one
+ * wait fd per device, i.e. per vector, and channel i uses the vector of its
+ * slot, -i plus i: -I names the device of channel 0's vector, and channel i
+ * takes the device numbered i past it (/dev/uio0, /dev/uio1, ...).
+ */
+int uio_open_channel(const struct IvshmemArgs *args, int channel);
+
+/* ShmStream doorbell of UIO peers (see shm_stream_set_doorbell()) */
+typedef struct UioDoorbell {
+  int fd;
+  /* NULL unless -N (see ivshmem_waiter_init()) */
+  EventLoop *waiter;
+  struct ivshmem_reg *reg_ptr;
+  struct IvshmemArgs *args;
+} UioDoorbell;
+void uio_doorbell_wait(uint32_t *guard, uint32_t expect, void *doorbell);
+void uio_doorbell_notify(void *doorbell);
+
+/* Binds the own port, clears stale interrupts and connects to the peer's */
+void usernet_connect(int fd, struct IvshmemArgs *args);
+/* With -N, sleeps in `waiter` (see ivshmem_waiter_init()) on EAGAIN */
+void usernet_intr_wait(int fd, EventLoop *waiter, struct IvshmemArgs *args);
 void usernet_intr_notify(int fd, struct IvshmemArgs *args);
+/**
+ * Opens another port for event-loop channel `channel` (-n): the one numbered
+ * that far past -i, connected to the same port of the peer.
+ */
+int usernet_open_channel(struct IvshmemArgs *args, int channel);
+
+/**
+ * Polled usernet signaling: data-ready goes through a guard word, and the
+ * ioctls only put a waiter to sleep and wake it up. A waiter that spun past
+ * its limit marks the guard with USERNET_SLEEPING before IOCTL_WAIT; the
+ * notifier exchanges the guard and signals only if it finds the mark. The
+ * limit adapts to twice the recent waits, capped by -U.
+ */
+#define USERNET_SLEEPING 0x80000000U
+
+typedef struct UsernetPoller {
+  int fd;
+  EventLoop *waiter;
+  struct IvshmemArgs *args;
+
+  /* Nanoseconds */
+  uint64_t max_spin;
+  uint64_t spin_limit;
+
+  uint64_t wait_count;
+  uint64_t sleep_count;
+} UsernetPoller;
+void usernet_poller_init(UsernetPoller *poller, int fd, EventLoop *waiter,
+                         struct IvshmemArgs *args);
+void usernet_poll_wait(UsernetPoller *poller, uint32_t *guard,
+                       uint32_t expect);
+void usernet_poll_notify(UsernetPoller *poller, uint32_t *guard,
+                         uint32_t value);
 
 #endif /* IPC_BENCH_IVSHMEM_H */
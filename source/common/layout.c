@@ -0,0 +1,268 @@
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common/benchmarks.h"
+#include "common/layout.h"
+#include "common/stamped.h"
+
+static const char *const LAYOUT_NAMES[] = {
+    [LAYOUT_LEGACY] = "legacy",
+    [LAYOUT_ALIGNED] = "aligned",
+    [LAYOUT_ALIGNED_2M] = "aligned-2m",
+    [LAYOUT_STAMPED] = "stamped",
+};
+#define LAYOUT_COUNT (sizeof(LAYOUT_NAMES) / sizeof(LAYOUT_NAMES[0]))
+
+const char *layout_name(IvshmemLayout layout) { return LAYOUT_NAMES[layout]; }
+
+int layout_parse(const char *name) {
+  for (size_t layout = 0; layout < LAYOUT_COUNT; ++layout)
+    if (!strcmp(name, LAYOUT_NAMES[layout]))
+      return layout;
+  return -1;
+}
+
+static size_t align_up(size_t value, size_t alignment) {
+  return (value + alignment - 1) & ~(alignment - 1);
+}
+
+/* Stamped buffers spend the last word of every line on its stamp */
+static size_t buffer_bytes(const IvshmemArgs *args) {
+  if (args->layout == LAYOUT_STAMPED)
+    return stamped_size(ivshmem_chunk_size(args));
+  return ivshmem_chunk_size(args);
+}
+
+static void attach_legacy(IvshmemSlot *slot, IvshmemRegion *region,
+                          IvshmemArgs *args, int guard_count, int is_owner) {
+  const size_t guard_size = guard_count * sizeof(uint32_t);
+  const size_t slot_size = args->size + guard_size;
+
+  void *memory = ivshmem_region_map(
+      region, region->size - (args->shmem_index + 1) * slot_size, slot_size,
+      args->is_window, args->prefault_threads);
+  if (is_owner)
+    memset(memory, 0, slot_size);
+
+  if (guard_count)
+    slot->guards[0] = memory;
+  slot->buffers[0] = memory + guard_size;
+}
+
+static void format_directory(LayoutDirectory *directory, size_t region_size) {
+  if ((directory->magic == LAYOUT_MAGIC) &&
+      (directory->version == LAYOUT_VERSION) &&
+      (directory->region_size == region_size))
+    return;
+
+  fprintf(stderr, "Formatting the region directory (version %d)\n",
+          LAYOUT_VERSION);
+  memset(directory, 0, sizeof(*directory));
+  directory->version = LAYOUT_VERSION;
+  directory->region_size = region_size;
+  /* Peers treat the directory as valid once the magic shows up */
+  __atomic_store_n(&directory->magic, LAYOUT_MAGIC, __ATOMIC_RELEASE);
+}
+
+static void validate_directory(LayoutDirectory *directory,
+                               size_t region_size) {
+  if (__atomic_load_n(&directory->magic, __ATOMIC_ACQUIRE) != LAYOUT_MAGIC) {
+    fprintf(stderr, "No region directory found; Start the server first!\n");
+    exit(EXIT_FAILURE);
+  }
+  if (directory->version != LAYOUT_VERSION) {
+    fprintf(stderr, "Region layout version %u, expected %d!\n",
+            directory->version, LAYOUT_VERSION);
+    exit(EXIT_FAILURE);
+  }
+  if (directory->region_size != region_size) {
+    fprintf(stderr,
+            "Region directory describes %" PRIu64 " bytes, mapped %zu!\n",
+            directory->region_size, region_size);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static int entries_overlap(const LayoutSlotEntry *a, const LayoutSlotEntry *b) {
+  const uint64_t a_end = a->payload_offset + a->buffer_size * a->buffer_count;
+  const uint64_t b_end = b->payload_offset + b->buffer_size * b->buffer_count;
+  return (a->payload_offset < b_end) && (b->payload_offset < a_end);
+}
+
+static void place_slot(LayoutDirectory *directory, LayoutSlotEntry *entry,
+                       int index, size_t region_size) {
+  const size_t data_start = align_up(sizeof(*directory), getpagesize());
+  const size_t stride = entry->buffer_size * entry->buffer_count;
+
+  /* Slot i sits where i slots of the same size would end */
+  entry->payload_offset =
+      align_up(data_start + index * stride, entry->alignment);
+  if (entry->payload_offset + stride > region_size) {
+    fprintf(stderr, "Slot %d (%zu bytes) does not fit into the region!\n",
+            index, stride);
+    exit(EXIT_FAILURE);
+  }
+
+  for (int other = 0; other < LAYOUT_MAX_SLOTS; ++other) {
+    if ((other == index) || !directory->slots[other].buffer_count)
+      continue;
+    if (entries_overlap(entry, &directory->slots[other])) {
+      fprintf(stderr,
+              "Slot %d overlaps slot %d of a different size; Use the same "
+              "-b for all slots or clear the region\n",
+              index, other);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+static void validate_slot(const LayoutSlotEntry *found,
+                          const LayoutSlotEntry *expected, int index,
+                          size_t region_size) {
+  if ((found->buffer_size != expected->buffer_size) ||
+      (found->buffer_count != expected->buffer_count) ||
+      (found->guard_count != expected->guard_count) ||
+      (found->alignment != expected->alignment)) {
+    fprintf(stderr,
+            "Slot %d holds %u x %" PRIu64 " bytes with %u guards at %" PRIu64
+            " B alignment, expected %u x %" PRIu64 " bytes with %u guards at "
+            "%" PRIu64 " B alignment!\n",
+            index, found->buffer_count, found->buffer_size, found->guard_count,
+            found->alignment, expected->buffer_count, expected->buffer_size,
+            expected->guard_count, expected->alignment);
+    exit(EXIT_FAILURE);
+  }
+  if ((found->payload_offset % found->alignment) ||
+      (found->payload_offset + found->buffer_size * found->buffer_count >
+       region_size)) {
+    fprintf(stderr, "Slot %d has a corrupted offset %" PRIu64 "!\n", index,
+            found->payload_offset);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void attach_aligned(IvshmemSlot *slot, IvshmemRegion *region,
+                           IvshmemArgs *args, int guard_count,
+                           int buffer_count, int is_owner) {
+  const int index = args->shmem_index;
+  LayoutSlotEntry expected;
+
+  if (index >= LAYOUT_MAX_SLOTS) {
+    fprintf(stderr, "The aligned layout has only %d slots!\n",
+            LAYOUT_MAX_SLOTS);
+    exit(EXIT_FAILURE);
+  }
+
+  expected.alignment = (args->layout == LAYOUT_ALIGNED_2M)
+                           ? (2UL << 20)
+                           : LAYOUT_CACHE_LINE_SIZE;
+  expected.buffer_size = align_up(buffer_bytes(args), expected.alignment);
+  expected.buffer_count = buffer_count;
+  expected.guard_count = guard_count;
+
+  LayoutDirectory *directory = ivshmem_region_map(
+      region, 0, sizeof(*directory), args->is_window, args->prefault_threads);
+  LayoutSlotEntry *entry = &directory->slots[index];
+
+  if (is_owner) {
+    format_directory(directory, region->size);
+    place_slot(directory, &expected, index, region->size);
+    /* A non-zero buffer count marks the entry valid; hide it until reset */
+    __atomic_store_n(&entry->buffer_count, 0, __ATOMIC_RELEASE);
+  } else {
+    validate_directory(directory, region->size);
+    if (!__atomic_load_n(&entry->buffer_count, __ATOMIC_ACQUIRE)) {
+      fprintf(stderr, "Slot %d is not set up; Start the server first!\n",
+              index);
+      exit(EXIT_FAILURE);
+    }
+    validate_slot(entry, &expected, index, region->size);
+    expected.payload_offset = entry->payload_offset;
+  }
+
+  void *payload =
+      ivshmem_region_map(region, expected.payload_offset,
+                         expected.buffer_size * buffer_count, args->is_window,
+                         args->prefault_threads);
+
+  for (int i = 0; i < guard_count; ++i) {
+    slot->guards[i] = &directory->guards[index][i].value;
+    if (is_owner)
+      *slot->guards[i] = 0;
+  }
+  for (int i = 0; i < 2; ++i) {
+    slot->pending[i] = &directory->pending[index][i].value;
+    if (is_owner)
+      *slot->pending[i] = 0;
+  }
+  for (int i = 0; i < buffer_count; ++i) {
+    slot->buffers[i] = payload + i * expected.buffer_size;
+    if (is_owner)
+      memset(slot->buffers[i], 0, slot->buffer_size);
+  }
+
+  if (is_owner) {
+    /* Publish the entry only once the slot is reset */
+    entry->payload_offset = expected.payload_offset;
+    entry->buffer_size = expected.buffer_size;
+    entry->alignment = expected.alignment;
+    entry->guard_count = expected.guard_count;
+    __atomic_store_n(&entry->buffer_count, expected.buffer_count,
+                     __ATOMIC_RELEASE);
+  }
+
+  benchmark_tag("Slot", "%" PRIu64 " B aligned at offset %" PRIu64,
+                expected.alignment, expected.payload_offset);
+}
+
+void ivshmem_slot_attach(IvshmemSlot *slot, IvshmemRegion *region,
+                         IvshmemArgs *args, int guard_count, int buffer_count,
+                         int is_owner) {
+  if ((guard_count > LAYOUT_MAX_GUARDS) || (buffer_count < 1) ||
+      (buffer_count > LAYOUT_MAX_BUFFERS)) {
+    fprintf(stderr, "%d guards and %d buffers are not supported!\n",
+            guard_count, buffer_count);
+    exit(EXIT_FAILURE);
+  }
+
+  memset(slot, 0, sizeof(*slot));
+  slot->guard_count = guard_count;
+  slot->buffer_count = buffer_count;
+  slot->buffer_size = buffer_bytes(args);
+
+  if (args->layout == LAYOUT_LEGACY) {
+    if ((guard_count > 1) || (buffer_count > 1)) {
+      fprintf(stderr, "The legacy layout holds a single buffer and guard; "
+                      "Use -L aligned\n");
+      exit(EXIT_FAILURE);
+    }
+    attach_legacy(slot, region, args, guard_count, is_owner);
+  } else
+    attach_aligned(slot, region, args, guard_count, buffer_count, is_owner);
+
+  benchmark_tag("Layout", "%s", layout_name(args->layout));
+}
+
+void ivshmem_group_attach(IvshmemSlot *slots, int count, IvshmemRegion *region,
+                          IvshmemArgs *args, int is_owner) {
+  const int first = args->shmem_index;
+
+  if (first + count > LAYOUT_MAX_SLOTS) {
+    fprintf(stderr, "Slots %d to %d exceed the %d slots of the layout!\n",
+            first, first + count - 1, LAYOUT_MAX_SLOTS);
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < count; ++i) {
+    args->shmem_index = first + i;
+    ivshmem_slot_attach(&slots[i], region, args, 1, 1, is_owner);
+    slots[i].pending[LAYOUT_TO_SERVER] = slots[0].pending[LAYOUT_TO_SERVER];
+    slots[i].pending[LAYOUT_TO_CLIENT] = slots[0].pending[LAYOUT_TO_CLIENT];
+  }
+  args->shmem_index = first;
+}
@@ -0,0 +1,88 @@
+#ifndef IPC_BENCH_LAYOUT_H
+#define IPC_BENCH_LAYOUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common/ivshmem.h"
+
+#define LAYOUT_MAGIC 0x42435049 /* "IPCB" */
+#define LAYOUT_VERSION 4
+
+#define LAYOUT_CACHE_LINE_SIZE 64
+#define LAYOUT_MAX_SLOTS 256
+#define LAYOUT_MAX_BUFFERS 4
+/* One guard per buffer plus the handshake guard */
+#define LAYOUT_MAX_GUARDS (LAYOUT_MAX_BUFFERS + 1)
+
+/* Directions of the pending-channel bitmaps (see common/pending.h) */
+#define LAYOUT_TO_SERVER 0
+#define LAYOUT_TO_CLIENT 1
+
+/* A guard word alone on its cache line, never shared with payload bytes */
+typedef struct LayoutGuard {
+  uint32_t value;
+} __attribute__((aligned(LAYOUT_CACHE_LINE_SIZE))) LayoutGuard;
+
+/* Where one slot's buffers live; written by the slot's server */
+typedef struct LayoutSlotEntry {
+  uint64_t payload_offset;
+  uint64_t buffer_size;
+  uint64_t alignment;
+  uint32_t buffer_count;
+  uint32_t guard_count;
+} LayoutSlotEntry;
+
+/**
+ * Region directory at offset 0 of an "aligned" region. The payloads follow
+ * on the next page; the guards of all slots sit in the directory itself, as
+ * do the pending-channel bitmaps of the channel groups starting at each slot.
+ */
+typedef struct LayoutDirectory {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t region_size;
+
+  LayoutSlotEntry slots[LAYOUT_MAX_SLOTS];
+
+  LayoutGuard guards[LAYOUT_MAX_SLOTS][LAYOUT_MAX_GUARDS];
+  LayoutGuard pending[LAYOUT_MAX_SLOTS][2];
+} LayoutDirectory;
+
+/* One peer's view of a slot, whatever the layout */
+typedef struct IvshmemSlot {
+  uint32_t *guards[LAYOUT_MAX_GUARDS];
+  int guard_count;
+
+  void *buffers[LAYOUT_MAX_BUFFERS];
+  int buffer_count;
+  /* One message or chunk, plus the stamps of a stamped layout */
+  size_t buffer_size;
+
+  /* Pending-channel bitmaps per direction; NULL with the legacy layout */
+  uint32_t *pending[2];
+} IvshmemSlot;
+
+const char *layout_name(IvshmemLayout layout);
+/* Returns -1 for an unknown name */
+int layout_parse(const char *name);
+
+/**
+ * Maps the slot `args->shmem_index` with `guard_count` guards and
+ * `buffer_count` buffers of one message or chunk each. The server (`is_owner`)
+ * lays the slot out and zeroes it; the client validates what it finds and
+ * fails if it does not match its own arguments. The legacy layout only knows
+ * a single buffer with at most one guard word right in front of it.
+ */
+void ivshmem_slot_attach(IvshmemSlot *slot, IvshmemRegion *region,
+                         IvshmemArgs *args, int guard_count, int buffer_count,
+                         int is_owner);
+/**
+ * Attaches the `count` slots from `args->shmem_index` on as one channel
+ * group, each with a single guard and buffer. They share the pending-channel
+ * bitmaps of the first slot; bit i stands for slot `args->shmem_index + i`.
+ */
+void ivshmem_group_attach(IvshmemSlot *slots, int count, IvshmemRegion *region,
+                          IvshmemArgs *args, int is_owner);
+
+#endif /* IPC_BENCH_LAYOUT_H */
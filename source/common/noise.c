@@ -0,0 +1,131 @@
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include "common/noise.h"
+
+static const char *tracked_irq = NULL;
+
+void noise_track_irq(const char *name) { tracked_irq = name; }
+
+/*
+ * Splits a "<label>: <cpu0> <cpu1> ... <description>" row of /proc/interrupts
+ * or /proc/softirqs. Returns the sum over all CPU columns, points `label` at
+ * the (space-trimmed) row label and `rest` at the trailing description.
+ */
+static uint64_t parse_row(char *line, char **label, char **rest) {
+  uint64_t sum = 0;
+  char *cursor = strchr(line, ':');
+  char *end;
+
+  if (!cursor) {
+    *label = *rest = line + strlen(line);
+    return 0;
+  }
+  *cursor++ = '\0';
+  for (*label = line; **label == ' '; ++*label)
+    ;
+
+  for (;;) {
+    unsigned long long value = strtoull(cursor, &end, 10);
+    if (end == cursor)
+      break;
+    sum += value;
+    cursor = end;
+  }
+  *rest = cursor;
+
+  return sum;
+}
+
+static void read_interrupts(NoiseSample *sample) {
+  char *line = NULL, *label, *rest;
+  size_t capacity = 0;
+  uint64_t sum;
+
+  FILE *file = fopen("/proc/interrupts", "r");
+  if (!file)
+    return; /* Not fatal; e.g., restricted procfs in containers */
+
+  /* Skip the "CPU0 CPU1 ..." header */
+  if (getline(&line, &capacity, file) > 0) {
+    while (getline(&line, &capacity, file) > 0) {
+      sum = parse_row(line, &label, &rest);
+      if (!strcmp(label, "LOC"))
+        sample->timer = sum;
+      else if (tracked_irq && strstr(rest, tracked_irq))
+        sample->irq += sum;
+    }
+  }
+
+  free(line);
+  fclose(file);
+}
+
+static void read_softirqs(NoiseSample *sample) {
+  char *line = NULL, *label, *rest;
+  size_t capacity = 0;
+  uint64_t sum;
+
+  FILE *file = fopen("/proc/softirqs", "r");
+  if (!file)
+    return;
+
+  if (getline(&line, &capacity, file) > 0) {
+    while (getline(&line, &capacity, file) > 0) {
+      sum = parse_row(line, &label, &rest);
+      if (!strcmp(label, "NET_RX"))
+        sample->net_rx = sum;
+      else if (!strcmp(label, "NET_TX"))
+        sample->net_tx = sum;
+    }
+  }
+
+  free(line);
+  fclose(file);
+}
+
+void noise_sample(NoiseSample *sample) {
+  memset(sample, 0, sizeof(*sample));
+
+  read_interrupts(sample);
+  read_softirqs(sample);
+
+  /* Only the measuring thread; helper threads must not pollute the numbers */
+  if (getrusage(RUSAGE_THREAD, &sample->usage)) {
+    perror("getrusage()");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static double timeval_delta_ms(const struct timeval *start,
+                               const struct timeval *end) {
+  return (end->tv_sec - start->tv_sec) * 1e3 +
+         (end->tv_usec - start->tv_usec) / 1e3;
+}
+
+void noise_report(const NoiseSample *start, const NoiseSample *end) {
+  printf("Voluntary switches: %ld\n",
+         end->usage.ru_nvcsw - start->usage.ru_nvcsw);
+  printf("Forced switches:    %ld\n",
+         end->usage.ru_nivcsw - start->usage.ru_nivcsw);
+  printf("Minor page faults:  %ld\n",
+         end->usage.ru_minflt - start->usage.ru_minflt);
+  printf("Major page faults:  %ld\n",
+         end->usage.ru_majflt - start->usage.ru_majflt);
+  printf("User CPU time:      %.3f\tms\n",
+         timeval_delta_ms(&start->usage.ru_utime, &end->usage.ru_utime));
+  printf("System CPU time:    %.3f\tms\n",
+         timeval_delta_ms(&start->usage.ru_stime, &end->usage.ru_stime));
+  if (tracked_irq)
+    printf("Tracked IRQs:       %" PRIu64 "\t(%s)\n", end->irq - start->irq,
+           tracked_irq);
+  printf("Timer interrupts:   %" PRIu64 "\n", end->timer - start->timer);
+  printf("NET_RX softirqs:    %" PRIu64 "\n", end->net_rx - start->net_rx);
+  printf("NET_TX softirqs:    %" PRIu64 "\n", end->net_tx - start->net_tx);
+}
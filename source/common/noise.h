@@ -0,0 +1,33 @@
+#ifndef IPC_BENCH_NOISE_H
+#define IPC_BENCH_NOISE_H
+
+#include <stdint.h>
+#include <sys/resource.h>
+
+/* Platform counters sampled right before and after a measured run */
+typedef struct NoiseSample {
+  /* Context switches, page faults and CPU time of the measuring thread */
+  struct rusage usage;
+
+  /* Sum of all /proc/interrupts rows matching the tracked IRQ name */
+  uint64_t irq;
+  /* Local timer interrupts ("LOC" row) */
+  uint64_t timer;
+
+  /* NET_RX/NET_TX rows of /proc/softirqs */
+  uint64_t net_rx;
+  uint64_t net_tx;
+} NoiseSample;
+
+/**
+ * Selects the /proc/interrupts rows (by substring of the row description)
+ * whose deltas are reported, e.g. "ivshmem" for the UIO/usernet vectors.
+ * Pass NULL to disable IRQ tracking (default).
+ */
+void noise_track_irq(const char *name);
+
+void noise_sample(NoiseSample *sample);
+
+void noise_report(const NoiseSample *start, const NoiseSample *end);
+
+#endif /* IPC_BENCH_NOISE_H */
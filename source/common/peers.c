@@ -0,0 +1,283 @@
+#define _GNU_SOURCE
+
+#include <endian.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "common/peers.h"
+#include "common/sockets.h"
+
+int ivshmem_send_message(int socket_fd, int64_t value, int fd) {
+  const int64_t message = htole64(value);
+  return socket_try_send_fd(socket_fd, &message, sizeof(message), fd);
+}
+
+int64_t ivshmem_recv_message(int socket_fd, int *fd) {
+  int64_t message;
+  *fd = socket_recv_fd(socket_fd, &message, sizeof(message));
+  return le64toh(message);
+}
+
+static void reset_peer(IvshmemPeer *peer) {
+  for (int vector = 0; vector < peer->vector_count; ++vector)
+    close(peer->eventfds[vector]);
+  peer->id = -1;
+  peer->vector_count = 0;
+}
+
+static IvshmemPeer *find_peer(IvshmemConnection *connection, int64_t id) {
+  for (int i = 0; i < IVSHMEM_MAX_PEERS; ++i)
+    if (connection->peers[i].id == id)
+      return &connection->peers[i];
+  return NULL;
+}
+
+static void add_vector(IvshmemPeer *peer, int fd) {
+  if (peer->vector_count == IVSHMEM_MAX_VECTORS) {
+    fprintf(stderr, "Peer %ld has more than %d vectors; Ignore the rest\n",
+            peer->id, IVSHMEM_MAX_VECTORS);
+    close(fd);
+    return;
+  }
+  peer->eventfds[peer->vector_count++] = fd;
+}
+
+static void handle_message(IvshmemConnection *connection) {
+  int fd;
+  const int64_t id = ivshmem_recv_message(connection->socket_fd, &fd);
+
+  if (id < 0) {
+    fprintf(stderr, "Unexpected ivshmem-server message %ld!\n", id);
+    exit(EXIT_FAILURE);
+  }
+
+  if (id == connection->self.id) {
+    if (fd >= 0)
+      add_vector(&connection->self, fd);
+    return;
+  }
+
+  IvshmemPeer *peer = find_peer(connection, id);
+  if (fd < 0) { /* Disconnected */
+    if (peer)
+      reset_peer(peer);
+    return;
+  }
+  if (!peer) {
+    if (!(peer = find_peer(connection, -1))) {
+      fprintf(stderr, "More than %d ivshmem peers!\n", IVSHMEM_MAX_PEERS);
+      exit(EXIT_FAILURE);
+    }
+    peer->id = id;
+  }
+  add_vector(peer, fd);
+}
+
+/* The server sends a peer's vectors back to back */
+#define VECTOR_TIMEOUT_MS 100
+
+static int poll_message(int socket_fd) {
+  struct pollfd poll_fd = {.fd = socket_fd, .events = POLLIN};
+  int ret;
+
+  while ((ret = poll(&poll_fd, 1, VECTOR_TIMEOUT_MS)) < 0)
+    if (errno != EINTR) {
+      perror("poll()");
+      exit(EXIT_FAILURE);
+    }
+  return ret;
+}
+
+void ivshmem_connect(IvshmemConnection *connection, const char *path,
+                     int vector_count) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  int fd;
+
+  connection->self.id = -1;
+  connection->self.vector_count = 0;
+  for (int i = 0; i < IVSHMEM_MAX_PEERS; ++i) {
+    connection->peers[i].id = -1;
+    connection->peers[i].vector_count = 0;
+  }
+
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path \"%s\" is too long!\n", path);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(address.sun_path, path);
+
+  if ((connection->socket_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    perror("socket()");
+    exit(EXIT_FAILURE);
+  }
+  if (connect(connection->socket_fd, (struct sockaddr *)&address,
+              sizeof(address))) {
+    perror("connect()");
+    fprintf(stderr, "Is an ivshmem-server listening on %s?\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  const int64_t version = ivshmem_recv_message(connection->socket_fd, &fd);
+  if ((version != IVSHMEM_PROTOCOL_VERSION) || (fd >= 0)) {
+    fprintf(stderr, "Unsupported ivshmem-server protocol version %ld!\n",
+            version);
+    exit(EXIT_FAILURE);
+  }
+  connection->self.id = ivshmem_recv_message(connection->socket_fd, &fd);
+  if ((connection->self.id < 0) || (fd >= 0)) {
+    fprintf(stderr, "Invalid ivshmem peer id %ld!\n", connection->self.id);
+    exit(EXIT_FAILURE);
+  }
+  if ((ivshmem_recv_message(connection->socket_fd, &connection->shm_fd) !=
+       -1) ||
+      (connection->shm_fd < 0)) {
+    fprintf(stderr, "No shared memory fd from the ivshmem-server!\n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* The own vectors come last, after those of the peers already there */
+  while (connection->self.vector_count < vector_count) {
+    if (connection->self.vector_count &&
+        !poll_message(connection->socket_fd)) {
+      fprintf(stderr,
+              "The ivshmem-server provides %d vectors, %d needed; Start it "
+              "with more (-n)\n",
+              connection->self.vector_count, vector_count);
+      exit(EXIT_FAILURE);
+    }
+    handle_message(connection);
+  }
+
+  fprintf(stderr, "Connected to %s as ivshmem peer %ld\n", path,
+          connection->self.id);
+}
+
+IvshmemPeer *ivshmem_await_peer(IvshmemConnection *connection, int64_t id,
+                                int vector_count) {
+  for (;;) {
+    for (int i = 0; i < IVSHMEM_MAX_PEERS; ++i) {
+      IvshmemPeer *peer = &connection->peers[i];
+      if ((peer->id >= 0) && ((id == -1) || (peer->id == id)) &&
+          (peer->vector_count >= vector_count))
+        return peer;
+    }
+    handle_message(connection);
+  }
+}
+
+#define PAIR_SERVER 0x80000000U
+#define PAIR_CLIENT 0x40000000U
+#define PAIR_ID_MASK 0xffffU
+
+/**
+ * Keeps taking the ivshmem-server's messages meanwhile: it announces every
+ * vector of a new peer in a message of its own, and with many vectors it
+ * would block on our full socket before the peer even got its own.
+ */
+static uint32_t wait_for_change(IvshmemConnection *connection, int wait_fd,
+                                uint32_t *guard, uint32_t old) {
+  struct pollfd poll_fds[2] = {{.fd = wait_fd, .events = POLLIN},
+                               {.fd = connection->socket_fd, .events = POLLIN}};
+  uint32_t value;
+  uint64_t count;
+
+  while ((value = __atomic_load_n(guard, __ATOMIC_ACQUIRE)) == old) {
+    if (poll(poll_fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("poll()");
+      exit(EXIT_FAILURE);
+    }
+    if (poll_fds[1].revents)
+      handle_message(connection);
+    if ((poll_fds[0].revents & POLLIN) &&
+        (read(wait_fd, &count, sizeof(count)) < 0) && (errno != EAGAIN) &&
+        (errno != EINTR)) {
+      perror("read()");
+      exit(EXIT_FAILURE);
+    }
+  }
+  return value;
+}
+
+IvshmemPeer *ivshmem_pair(IvshmemConnection *connection, uint32_t *guard,
+                          int vector, int is_owner) {
+  const int wait_fd = connection->self.eventfds[vector];
+  const uint32_t self = (is_owner ? PAIR_SERVER : PAIR_CLIENT) |
+                        connection->self.id;
+  EventfdDoorbell doorbell = {.wait_fd = wait_fd};
+  IvshmemPeer *peer;
+  uint32_t value;
+
+  if (is_owner) {
+    __atomic_store_n(guard, self, __ATOMIC_RELEASE);
+    value = wait_for_change(connection, wait_fd, guard, self);
+    if (!(value & PAIR_CLIENT)) {
+      fprintf(stderr, "Unexpected guard %#x while pairing!\n", value);
+      exit(EXIT_FAILURE);
+    }
+    peer = ivshmem_await_peer(connection, value & PAIR_ID_MASK, vector + 1);
+
+    /* Hand the guard over; the client must not write it before that */
+    __atomic_store_n(guard, 0, __ATOMIC_RELEASE);
+    doorbell.notify_fd = peer->eventfds[vector];
+    eventfd_doorbell_notify(&doorbell);
+    return peer;
+  }
+
+  value = __atomic_load_n(guard, __ATOMIC_ACQUIRE);
+  if (!(value & PAIR_SERVER)) {
+    fprintf(stderr, "No server on this channel; Start the server first!\n");
+    exit(EXIT_FAILURE);
+  }
+  peer = ivshmem_await_peer(connection, value & PAIR_ID_MASK, vector + 1);
+
+  __atomic_store_n(guard, self, __ATOMIC_RELEASE);
+  doorbell.notify_fd = peer->eventfds[vector];
+  eventfd_doorbell_notify(&doorbell);
+  if ((value = wait_for_change(connection, wait_fd, guard, self))) {
+    fprintf(stderr, "Unexpected guard %#x while pairing!\n", value);
+    exit(EXIT_FAILURE);
+  }
+  return peer;
+}
+
+void ivshmem_disconnect(IvshmemConnection *connection) {
+  for (int i = 0; i < IVSHMEM_MAX_PEERS; ++i)
+    reset_peer(&connection->peers[i]);
+  reset_peer(&connection->self);
+  if (close(connection->socket_fd)) {
+    perror("close()");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void eventfd_doorbell_wait(uint32_t *guard, uint32_t expect, void *doorbell) {
+  EventfdDoorbell *eventfd = doorbell;
+  uint64_t count;
+
+  /* The counter sums up notifications; only the guard tells what happened */
+  while (__atomic_load_n(guard, __ATOMIC_ACQUIRE) != expect)
+    if ((read(eventfd->wait_fd, &count, sizeof(count)) < 0) &&
+        (errno != EAGAIN) && (errno != EINTR)) {
+      perror("read()");
+      exit(EXIT_FAILURE);
+    }
+}
+void eventfd_doorbell_notify(void *doorbell) {
+  EventfdDoorbell *eventfd = doorbell;
+  const uint64_t count = 1;
+
+  while (write(eventfd->notify_fd, &count, sizeof(count)) < 0)
+    if ((errno != EAGAIN) && (errno != EINTR)) {
+      perror("write()");
+      exit(EXIT_FAILURE);
+    }
+}
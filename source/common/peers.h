@@ -0,0 +1,77 @@
+#ifndef IPC_BENCH_PEERS_H
+#define IPC_BENCH_PEERS_H
+
+#include <stdint.h>
+
+/**
+ * QEMU's ivshmem-server protocol (docs/specs/ivshmem-spec.rst). Every
+ * message is a little-endian int64, optionally carrying one fd:
+ *
+ *   version 0, then the own peer id, then -1 with the shared memory fd,
+ *   then <id> with an eventfd per vector of every other peer,
+ *   then <id> with an eventfd per vector of the own peer.
+ *
+ * Later on, a new peer is announced by its id with its eventfds, and a
+ * disconnected one by its id without fd.
+ */
+#define IVSHMEM_PROTOCOL_VERSION 0
+#define IVSHMEM_DEFAULT_SOCKET_PATH "/tmp/ivshmem_socket"
+
+#define IVSHMEM_MAX_PEERS 16
+#define IVSHMEM_MAX_VECTORS 256
+
+typedef struct IvshmemPeer {
+  /* -1 for an unused entry */
+  int64_t id;
+  int vector_count;
+  /* Written to ring the peer's vector, read by the peer to wait on it */
+  int eventfds[IVSHMEM_MAX_VECTORS];
+} IvshmemPeer;
+
+typedef struct IvshmemConnection {
+  int socket_fd;
+  int shm_fd;
+
+  IvshmemPeer self;
+  IvshmemPeer peers[IVSHMEM_MAX_PEERS];
+} IvshmemConnection;
+
+/* Returns -1 if the peer has hung up */
+int ivshmem_send_message(int socket_fd, int64_t value, int fd);
+/* Returns the value; `fd` is -1 if none was attached */
+int64_t ivshmem_recv_message(int socket_fd, int *fd);
+
+/**
+ * Connects to the server at `path` and processes its messages until the
+ * shared memory and `vector_count` of the own vectors have arrived, and fails
+ * if the server hands out fewer. The peers known at that point are the ones
+ * connected before us.
+ */
+void ivshmem_connect(IvshmemConnection *connection, const char *path,
+                     int vector_count);
+/**
+ * Processes the server's messages until the peer `id` (or any peer for -1)
+ * is known with at least `vector_count` vectors.
+ */
+IvshmemPeer *ivshmem_await_peer(IvshmemConnection *connection, int64_t id,
+                                int vector_count);
+/**
+ * Pairs up the two ends of a channel through one of its guard words, before
+ * it is used for anything else: the server (`is_owner`) publishes its peer id
+ * there and waits on `vector` for the client to answer with its own, then
+ * resets the guard to 0 and lets the client go on. Returns the other end.
+ */
+IvshmemPeer *ivshmem_pair(IvshmemConnection *connection, uint32_t *guard,
+                          int vector, int is_owner);
+/* Closes all received fds except the shared memory's */
+void ivshmem_disconnect(IvshmemConnection *connection);
+
+/* ShmStream doorbell over eventfds (see shm_stream_set_doorbell()) */
+typedef struct EventfdDoorbell {
+  int wait_fd;
+  int notify_fd;
+} EventfdDoorbell;
+void eventfd_doorbell_wait(uint32_t *guard, uint32_t expect, void *doorbell);
+void eventfd_doorbell_notify(void *doorbell);
+
+#endif /* IPC_BENCH_PEERS_H */
@@ -0,0 +1,34 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "common/pending.h"
+
+void pending_post(uint32_t *pending, int channel) {
+  /* Releases the channel's guard and payload along with its bit */
+  __atomic_fetch_or(pending, 1U << channel, __ATOMIC_RELEASE);
+}
+
+int pending_dispatch(uint32_t *pending, int fd, size_t event_size,
+                     EventLoop *waiter, PendingHandler handler,
+                     void *context) {
+  uint64_t event;
+  uint32_t channels;
+  int served = 0;
+
+  while (!(channels = __atomic_exchange_n(pending, 0, __ATOMIC_ACQUIRE)))
+    if (read(fd, &event, event_size) < 0) {
+      if (waiter && (errno == EAGAIN))
+        event_loop_run_once(waiter, -1);
+      else if ((errno != EAGAIN) && (errno != EINTR)) {
+        perror("read()");
+        exit(EXIT_FAILURE);
+      }
+    }
+
+  for (; channels; channels &= channels - 1, ++served)
+    handler(__builtin_ctz(channels), context);
+
+  return served;
+}
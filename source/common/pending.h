@@ -0,0 +1,33 @@
+#ifndef IPC_BENCH_PENDING_H
+#define IPC_BENCH_PENDING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common/eventloop.h"
+
+/**
+ * Pending-channel bitmap of a group of channels sharing one doorbell. A
+ * sender sets its channel's bit before ringing; the receiver takes the whole
+ * word on every wake-up and serves each channel in it. One interrupt thus
+ * carries any number of notifications, and a wake-up without bits is just a
+ * stale one, never a reason to ring again.
+ */
+#define PENDING_MAX_CHANNELS 32
+
+void pending_post(uint32_t *pending, int channel);
+
+typedef void (*PendingHandler)(int channel, void *context);
+/**
+ * Runs `handler` for every pending channel. If there is none, first sleeps
+ * on `fd` (reading `event_size` bytes, 4 for UIO and 8 for an eventfd) until
+ * a sender has set a bit. A non-blocking `fd` sleeps in `waiter` (see
+ * ivshmem_waiter_init()) between its reads, or spins without one.
+ *
+ * \return The number of channels served.
+ */
+int pending_dispatch(uint32_t *pending, int fd, size_t event_size,
+                     EventLoop *waiter, PendingHandler handler,
+                     void *context);
+
+#endif /* IPC_BENCH_PENDING_H */
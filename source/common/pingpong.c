@@ -0,0 +1,109 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common/common.h"
+#include "common/ivshmem.h"
+#include "common/pingpong.h"
+#include "common/utility.h"
+
+static size_t payload_size(size_t size) {
+  const size_t page_size = getpagesize();
+  return (size + page_size - 1) & ~(page_size - 1);
+}
+
+size_t ping_pong_memory_size(size_t size) {
+  return getpagesize() + 2 * payload_size(size);
+}
+
+void ping_pong_init(PingPong *pp, void *memory, size_t size, uint64_t count) {
+  pp->guard = memory;
+  pp->ping_payload = memory + getpagesize();
+  pp->pong_payload = pp->ping_payload + payload_size(size);
+  pp->buffer = malloc(size ? size : 1);
+  if (!pp->buffer) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+
+  pp->count = count;
+  pp->size = size;
+  pp->fence = FENCE_NONE;
+  pp->hint = HINT_NONE;
+}
+
+void ping_pong_destroy(PingPong *pp) {
+  free(pp->buffer);
+}
+
+typedef struct Pong {
+  PingPong *pp;
+  int cpu;
+} Pong;
+
+static void *pong_main(void *argument) {
+  Pong *pong = argument;
+  PingPong *pp = pong->pp;
+  uint32_t sequence = 0;
+
+  pin_thread(pong->cpu);
+
+  for (uint64_t message = 0; message < PING_PONG_WARMUP_COUNT + pp->count;
+       ++message) {
+    userspace_shm_wait(pp->guard, ++sequence);
+    if (pp->size) {
+      memcpy(pp->buffer, pp->ping_payload, pp->size);
+      memset(pp->pong_payload, CTS_BITS_01010101, pp->size);
+      publish_hint_lines(pp->pong_payload, pp->size, pp->hint);
+    }
+    shm_publish(pp->guard, ++sequence, pp->fence);
+  }
+
+  return NULL;
+}
+
+bench_t ping_pong_run(PingPong *pp, int ping_cpu, int pong_cpu) {
+  Pong pong = {.pp = pp, .cpu = pong_cpu};
+  pthread_t pong_thread;
+  uint32_t sequence = 0;
+  bench_t start = 0;
+
+  pin_thread(ping_cpu);
+  shm_publish(pp->guard, 0, FENCE_MFENCE);
+
+  const int res = pthread_create(&pong_thread, NULL, pong_main, &pong);
+  if (res) {
+    fprintf(stderr, "pthread_create(): %s\n", strerror(res));
+    exit(EXIT_FAILURE);
+  }
+
+  for (uint64_t message = 0; message < PING_PONG_WARMUP_COUNT + pp->count;
+       ++message) {
+    if (message == PING_PONG_WARMUP_COUNT)
+      start = now();
+
+    if (pp->size) {
+      memset(pp->ping_payload, STC_BITS_10101010, pp->size);
+      publish_hint_lines(pp->ping_payload, pp->size, pp->hint);
+    }
+    shm_publish(pp->guard, ++sequence, pp->fence);
+
+    userspace_shm_wait(pp->guard, ++sequence);
+    if (pp->size)
+      memcpy(pp->buffer, pp->pong_payload, pp->size);
+  }
+  bench_t total = now() - start;
+
+  pthread_join(pong_thread, NULL);
+  return total;
+}
+
+double ping_pong_latency(const PingPong *pp, bench_t total) {
+  return (double)total / pp->count / 2;
+}
+
+double ping_pong_bandwidth(const PingPong *pp, bench_t total) {
+  return (2.0 * pp->size * pp->count) / (total / 1e9) / 1e6;
+}
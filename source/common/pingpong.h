@@ -0,0 +1,47 @@
+#ifndef IPC_BENCH_PINGPONG_H
+#define IPC_BENCH_PINGPONG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common/benchmarks.h"
+#include "common/publish.h"
+
+#define PING_PONG_WARMUP_COUNT 100
+
+/**
+ * Round trips of a payload between two pinned threads within one process:
+ * one guard on its own page, then one payload per direction. core-to-core
+ * runs it for every pair of CPUs; handoff varies how each side publishes.
+ */
+typedef struct PingPong {
+  uint32_t *guard;
+  void *ping_payload;
+  void *pong_payload;
+  void *buffer;
+
+  uint64_t count;
+  /* Bytes moved each way, up to those laid out; 0 passes the guard alone */
+  size_t size;
+  PublishFence fence;
+  PublishHint hint;
+} PingPong;
+
+/* Bytes of shared memory that ping_pong_init() lays out for `size` */
+size_t ping_pong_memory_size(size_t size);
+/**
+ * Lays payloads of up to `size` bytes out in `memory` and allocates the
+ * receive buffer. Publishes without fence or hint until they are set.
+ */
+void ping_pong_init(PingPong *pp, void *memory, size_t size, uint64_t count);
+void ping_pong_destroy(PingPong *pp);
+
+/* Returns the total time of `count` round trips, after a warm-up */
+bench_t ping_pong_run(PingPong *pp, int ping_cpu, int pong_cpu);
+
+/* One-way latency in ns */
+double ping_pong_latency(const PingPong *pp, bench_t total);
+/* MB/s, with one payload moved in each direction per round trip */
+double ping_pong_bandwidth(const PingPong *pp, bench_t total);
+
+#endif /* IPC_BENCH_PINGPONG_H */
@@ -0,0 +1,122 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#include "common/publish.h"
+
+static const char *const FENCE_NAMES[] = {
+    [FENCE_NONE] = "none",
+    [FENCE_SFENCE] = "sfence",
+    [FENCE_MFENCE] = "mfence",
+    [FENCE_LOCKED] = "locked",
+};
+
+const char *publish_fence_name(PublishFence fence) {
+  return (fence == FENCE_AUTO) ? "auto" : FENCE_NAMES[fence];
+}
+
+int publish_fence_parse(const char *name) {
+  if (!strcmp(name, "auto"))
+    return FENCE_AUTO;
+  for (int fence = 0; fence < FENCE_COUNT; ++fence)
+    if (!strcmp(name, FENCE_NAMES[fence]))
+      return fence;
+  return -2;
+}
+
+PublishFence publish_fence_for(const char *path) {
+  const size_t length = strlen(path);
+
+  /* sysfs names the write-combining variant of a PCI BAR "resource<N>_wc" */
+  if ((length >= 3) && !strcmp(path + length - 3, "_wc"))
+    return FENCE_SFENCE;
+  return FENCE_NONE;
+}
+
+static const char *const HINT_NAMES[] = {
+    [HINT_NONE] = "none",
+    [HINT_CLDEMOTE] = "cldemote",
+    [HINT_CLWB] = "clwb",
+    [HINT_CLFLUSHOPT] = "clflushopt",
+};
+
+const char *publish_hint_name(PublishHint hint) {
+  return (hint == HINT_AUTO) ? "auto" : HINT_NAMES[hint];
+}
+
+int publish_hint_parse(const char *name) {
+  if (!strcmp(name, "auto"))
+    return HINT_AUTO;
+  for (int hint = 0; hint < HINT_COUNT; ++hint)
+    if (!strcmp(name, HINT_NAMES[hint]))
+      return hint;
+  return -2;
+}
+
+static int is_hint_supported(PublishHint hint) {
+  unsigned int eax, ebx, ecx, edx;
+
+  if (hint == HINT_NONE)
+    return 1;
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+    return 0;
+  switch (hint) {
+  case HINT_CLDEMOTE:
+    return !!(ecx & bit_CLDEMOTE);
+  case HINT_CLWB:
+    return !!(ebx & bit_CLWB);
+  case HINT_CLFLUSHOPT:
+    return !!(ebx & bit_CLFLUSHOPT);
+  default:
+    return 0;
+  }
+}
+
+PublishHint publish_hint_resolve(PublishHint hint) {
+  if (hint == HINT_AUTO)
+    hint = HINT_CLDEMOTE;
+  while (!is_hint_supported(hint))
+    hint = (hint == HINT_CLFLUSHOPT) ? HINT_NONE : hint + 1;
+  return hint;
+}
+
+#define LINE_SIZE 64
+
+/* Built for their extensions only; publish_hint_resolve() guards the calls */
+__attribute__((target("cldemote"))) static void
+demote_lines(char *line, const char *end) {
+  for (; line < end; line += LINE_SIZE)
+    _cldemote(line);
+}
+__attribute__((target("clwb"))) static void
+write_back_lines(char *line, const char *end) {
+  for (; line < end; line += LINE_SIZE)
+    _mm_clwb(line);
+}
+__attribute__((target("clflushopt"))) static void
+flush_lines(char *line, const char *end) {
+  for (; line < end; line += LINE_SIZE)
+    _mm_clflushopt(line);
+}
+
+void publish_hint_lines(void *data, size_t size, PublishHint hint) {
+  /* Every line the range touches, including a partial first one */
+  char *line = (char *)((uintptr_t)data & ~(uintptr_t)(LINE_SIZE - 1));
+  const char *end = (char *)data + size;
+
+  switch (hint) {
+  case HINT_CLDEMOTE:
+    demote_lines(line, end);
+    break;
+  case HINT_CLWB:
+    write_back_lines(line, end);
+    break;
+  case HINT_CLFLUSHOPT:
+    flush_lines(line, end);
+    break;
+  default:
+    break;
+  }
+}
@@ -0,0 +1,84 @@
+#ifndef IPC_BENCH_PUBLISH_H
+#define IPC_BENCH_PUBLISH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <immintrin.h>
+
+/**
+ * How a producer orders its payload stores before the guard store that
+ * publishes them. A release store suffices for write-back memory, but
+ * stores to a write-combining mapping (e.g. an ivshmem BAR's resource2_wc)
+ * may linger in the WC buffers until a fence or locked instruction drains
+ * them, and then the consumer could see the guard before the payload.
+ */
+typedef enum PublishFence {
+  /* Resolved per mapping by publish_fence_for() */
+  FENCE_AUTO = -1,
+  FENCE_NONE,
+  FENCE_SFENCE,
+  FENCE_MFENCE,
+  /* A locked exchange as the guard store itself */
+  FENCE_LOCKED,
+} PublishFence;
+#define FENCE_COUNT (FENCE_LOCKED + 1)
+
+const char *publish_fence_name(PublishFence fence);
+/* Returns -2 for an unknown name, since FENCE_AUTO is -1 */
+int publish_fence_parse(const char *name);
+/* The fence a mapping of `path` needs: sfence for write-combining ones */
+PublishFence publish_fence_for(const char *path);
+
+/**
+ * What the producer does with its freshly written payload lines before the
+ * guard store. Left alone, they stay modified in its private caches and
+ * every line the consumer reads is a cross-core snoop; the hints push them
+ * out to the shared LLC instead. Each falls back to the next one.
+ */
+typedef enum PublishHint {
+  /* The first one the CPU supports */
+  HINT_AUTO = -1,
+  HINT_NONE,
+  /* Demote to the LLC; the producer's copy may stay valid */
+  HINT_CLDEMOTE,
+  /* Write back to memory; the line may stay cached */
+  HINT_CLWB,
+  /* Write back and evict */
+  HINT_CLFLUSHOPT,
+} PublishHint;
+#define HINT_COUNT (HINT_CLFLUSHOPT + 1)
+
+const char *publish_hint_name(PublishHint hint);
+/* Returns -2 for an unknown name, since HINT_AUTO is -1 */
+int publish_hint_parse(const char *name);
+/* `hint` if CPUID reports it, else the first supported fallback */
+PublishHint publish_hint_resolve(PublishHint hint);
+/* Applies a resolved hint to every cache line of `data` */
+void publish_hint_lines(void *data, size_t size, PublishHint hint);
+
+/* Producer: makes the stores before it visible along with `value` */
+static inline void shm_publish(uint32_t *guard, uint32_t value,
+                               PublishFence fence) {
+  switch (fence) {
+  case FENCE_SFENCE:
+    _mm_sfence();
+    break;
+  case FENCE_MFENCE:
+    _mm_mfence();
+    break;
+  case FENCE_LOCKED:
+    __atomic_exchange_n(guard, value, __ATOMIC_SEQ_CST);
+    return;
+  default:
+    break;
+  }
+  __atomic_store_n(guard, value, __ATOMIC_RELEASE);
+}
+
+/* Consumer: the payload may be read once this returns the published value */
+static inline uint32_t shm_consume(uint32_t *guard) {
+  return __atomic_load_n(guard, __ATOMIC_ACQUIRE);
+}
+
+#endif /* IPC_BENCH_PUBLISH_H */
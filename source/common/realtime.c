@@ -0,0 +1,116 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+#include "common/benchmarks.h"
+#include "common/realtime.h"
+
+void realtime_setup(int priority, int is_thp_disabled) {
+  if (is_thp_disabled) {
+    if (prctl(PR_SET_THP_DISABLE, 1, 0, 0, 0)) {
+      perror("prctl(PR_SET_THP_DISABLE)");
+      exit(EXIT_FAILURE);
+    }
+    benchmark_tag("Hugepages", "THP disabled");
+  }
+
+  if (!priority) {
+    benchmark_tag("Scheduling", "SCHED_OTHER");
+    return;
+  }
+
+  if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+    perror("mlockall()");
+    exit(EXIT_FAILURE);
+  }
+
+  struct sched_param param = {.sched_priority = priority};
+  if (sched_setscheduler(0, SCHED_FIFO, &param)) {
+    perror("sched_setscheduler(SCHED_FIFO)");
+    exit(EXIT_FAILURE);
+  }
+
+  benchmark_tag("Scheduling", "SCHED_FIFO/%d, mlockall", priority);
+}
+
+void prefault_memory(void *memory, size_t size, int is_write) {
+  const size_t page_size = getpagesize();
+  volatile uint8_t *cursor = memory;
+  volatile uint8_t *end = cursor + size;
+  uint8_t sink = 0;
+
+  /* The first page may start mid-page; align to hit every page once */
+  for (; cursor < end;
+       cursor = (volatile uint8_t *)(((uintptr_t)cursor + page_size) &
+                                     ~(uintptr_t)(page_size - 1))) {
+    if (is_write)
+      *cursor = *cursor;
+    else
+      sink += *cursor;
+  }
+  (void)sink;
+}
+
+typedef struct PrefaultJob {
+  void *memory;
+  size_t size;
+  int is_write;
+} PrefaultJob;
+
+static void *prefault_main(void *argument) {
+  PrefaultJob *job = argument;
+  prefault_memory(job->memory, job->size, job->is_write);
+  return NULL;
+}
+
+void prefault_memory_parallel(void *memory, size_t size, int is_write,
+                              int thread_count) {
+  const size_t page_size = getpagesize();
+  const size_t pages = (size + page_size - 1) / page_size;
+
+  if (thread_count <= 1 || pages < (size_t)thread_count) {
+    prefault_memory(memory, size, is_write);
+    return;
+  }
+
+  pthread_t *threads = malloc(thread_count * sizeof(*threads));
+  PrefaultJob *jobs = malloc(thread_count * sizeof(*jobs));
+  if (!threads || !jobs) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+
+  size_t offset = 0;
+  for (int i = 0; i < thread_count; ++i) {
+    /* Spread the remainder pages over the first threads */
+    size_t part = (pages / thread_count + ((size_t)i < pages % thread_count)) *
+                  page_size;
+    if (offset + part > size)
+      part = size - offset;
+
+    jobs[i].memory = (uint8_t *)memory + offset;
+    jobs[i].size = part;
+    jobs[i].is_write = is_write;
+    offset += part;
+
+    const int res = pthread_create(&threads[i], NULL, prefault_main, &jobs[i]);
+    if (res) {
+      fprintf(stderr, "pthread_create(): %s\n", strerror(res));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for (int i = 0; i < thread_count; ++i)
+    pthread_join(threads[i], NULL);
+
+  free(jobs);
+  free(threads);
+}
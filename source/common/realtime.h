@@ -0,0 +1,30 @@
+#ifndef IPC_BENCH_REALTIME_H
+#define IPC_BENCH_REALTIME_H
+
+#include <stddef.h>
+
+/**
+ * Switches the calling process to SCHED_FIFO with the given priority and
+ * locks all current and future memory (mlockall). A priority of 0 keeps the
+ * default CFS policy. Optionally, transparent hugepages are disabled for the
+ * process so that khugepaged never collapses pages under the hot loop.
+ * The results are tagged with the resulting scheduling setup.
+ */
+void realtime_setup(int priority, int is_thp_disabled);
+
+/**
+ * Touches every page of `memory` so that the hot loop takes no first-touch
+ * faults. Shared mappings should be read-touched (`is_write` == 0) to leave
+ * the peer's data intact.
+ */
+void prefault_memory(void *memory, size_t size, int is_write);
+
+/**
+ * Same as prefault_memory(), but splits the range into `thread_count`
+ * page-aligned parts touched concurrently. Populating the page tables of
+ * multi-GiB regions is otherwise bound by a single core's fault rate.
+ */
+void prefault_memory_parallel(void *memory, size_t size, int is_write,
+                              int thread_count);
+
+#endif /* IPC_BENCH_REALTIME_H */
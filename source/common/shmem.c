@@ -0,0 +1,339 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/mempolicy.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+
+#include "common/benchmarks.h"
+#include "common/realtime.h"
+#include "common/shmem.h"
+#include "common/sockets.h"
+#include "common/utility.h"
+
+/* glibc does not provide the page size encodings of memfd_create() */
+#ifndef MFD_HUGE_2MB
+#define MFD_HUGE_SHIFT 26
+#define MFD_HUGE_2MB (21U << MFD_HUGE_SHIFT)
+#define MFD_HUGE_1GB (30U << MFD_HUGE_SHIFT)
+#endif
+
+#define SHMEM_ATTACH_RETRY_US 10000
+#define SHMEM_ATTACH_RETRIES 1000 /* 10 s */
+#define SHMEM_MAX_NODES 1024
+
+static ShmemKind parse_kind(const char *spec, const char **directory) {
+  *directory = NULL;
+
+  if (!strcmp(spec, "sysv"))
+    return SHMEM_SYSV;
+  if (!strcmp(spec, "memfd"))
+    return SHMEM_MEMFD;
+  if (!strcmp(spec, "memfd-2m"))
+    return SHMEM_MEMFD_2M;
+  if (!strcmp(spec, "memfd-1g"))
+    return SHMEM_MEMFD_1G;
+  if (!strcmp(spec, "posix"))
+    return SHMEM_POSIX;
+  if (!strncmp(spec, "hugetlbfs:", strlen("hugetlbfs:"))) {
+    *directory = spec + strlen("hugetlbfs:");
+    return SHMEM_HUGETLBFS;
+  }
+
+  fprintf(stderr, "Unknown local shared memory \"%s\"!\n", spec);
+  exit(EXIT_FAILURE);
+}
+
+static size_t backend_page_size(ShmemKind kind, const char *directory) {
+  struct statfs fs;
+
+  switch (kind) {
+  case SHMEM_MEMFD_2M:
+    return 2UL << 20;
+  case SHMEM_MEMFD_1G:
+    return 1UL << 30;
+  case SHMEM_HUGETLBFS:
+    if (statfs(directory, &fs)) {
+      perror("statfs()");
+      exit(EXIT_FAILURE);
+    }
+    return fs.f_bsize;
+  default:
+    return getpagesize();
+  }
+}
+
+static void bind_node(void *memory, size_t size, int node) {
+  unsigned long nodemask[SHMEM_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+
+  if (node >= SHMEM_MAX_NODES) {
+    fprintf(stderr, "NUMA node %d is out of range!\n", node);
+    exit(EXIT_FAILURE);
+  }
+  nodemask[node / (8 * sizeof(unsigned long))] |=
+      1UL << (node % (8 * sizeof(unsigned long)));
+
+  if (syscall(SYS_mbind, memory, size, MPOL_BIND, nodemask,
+              SHMEM_MAX_NODES + 1, MPOL_MF_STRICT | MPOL_MF_MOVE)) {
+    perror("mbind()");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* Binds (if requested) and then prefaults the freshly attached memory */
+static void place_memory(LocalShmem *shmem, int node, int is_populated) {
+  if (node >= 0)
+    bind_node(shmem->memory, shmem->size, node);
+  /* Only the creator may write; the peer must not clobber its data */
+  if (!is_populated)
+    prefault_memory(shmem->memory, shmem->size, shmem->is_owner);
+}
+
+static void map_fd(LocalShmem *shmem, int fd, int node) {
+  /* MAP_POPULATE would allocate the pages before mbind() could bind them */
+  const int flags = MAP_SHARED | ((node < 0) ? MAP_POPULATE : 0);
+
+  shmem->memory =
+      mmap(NULL, shmem->size, PROT_READ | PROT_WRITE, flags, fd, 0);
+  if (shmem->memory == MAP_FAILED) {
+    perror("mmap()");
+    exit(EXIT_FAILURE);
+  }
+  place_memory(shmem, node, node < 0);
+}
+
+static socklen_t abstract_address(struct sockaddr_un *address, int index) {
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  /* Leading '\0': abstract namespace, vanishes with the last socket */
+  int length = snprintf(address->sun_path + 1, sizeof(address->sun_path) - 1,
+                        "ipc-bench-shmem-%d", index);
+  return offsetof(struct sockaddr_un, sun_path) + 1 + length;
+}
+
+static void serve_fd(LocalShmem *shmem, int fd, int index) {
+  struct sockaddr_un address;
+  socklen_t length = abstract_address(&address, index);
+  int peer_fd;
+
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0) {
+    perror("socket(AF_UNIX)");
+    exit(EXIT_FAILURE);
+  }
+  if (bind(listen_fd, (struct sockaddr *)&address, length) ||
+      listen(listen_fd, 1)) {
+    perror("bind()/listen() of the shared memory socket");
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(stderr, "Waiting for the peer to attach the shared memory\n");
+  while ((peer_fd = accept(listen_fd, NULL, NULL)) < 0)
+    if (errno != EINTR) {
+      perror("accept()");
+      exit(EXIT_FAILURE);
+    }
+
+  socket_send_fd(peer_fd, &shmem->size, sizeof(shmem->size), fd);
+
+  close(peer_fd);
+  close(listen_fd);
+}
+
+static int fetch_fd(LocalShmem *shmem, int index) {
+  struct sockaddr_un address;
+  socklen_t length = abstract_address(&address, index);
+  size_t size;
+
+  for (int retry = 0;; ++retry) {
+    int sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock_fd < 0) {
+      perror("socket(AF_UNIX)");
+      exit(EXIT_FAILURE);
+    }
+    if (!connect(sock_fd, (struct sockaddr *)&address, length)) {
+      int fd = socket_recv_fd(sock_fd, &size, sizeof(size));
+      close(sock_fd);
+      if (fd < 0 || size != shmem->size) {
+        fprintf(stderr, "The peer shared an unexpected memory!\n");
+        exit(EXIT_FAILURE);
+      }
+      return fd;
+    }
+    close(sock_fd);
+
+    if ((errno != ECONNREFUSED) || (retry == SHMEM_ATTACH_RETRIES)) {
+      perror("connect() to the shared memory socket");
+      exit(EXIT_FAILURE);
+    }
+    usleep(SHMEM_ATTACH_RETRY_US);
+  }
+}
+
+static int open_named(LocalShmem *shmem) {
+  int fd;
+
+  if (shmem->is_owner) {
+    /* Start from a fresh object, never one left over by a crashed run */
+    if (shmem->kind == SHMEM_POSIX) {
+      shm_unlink(shmem->path);
+      fd = shm_open(shmem->path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    } else {
+      unlink(shmem->path);
+      fd = open(shmem->path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    }
+    if (fd < 0 || ftruncate(fd, shmem->size)) {
+      perror(shmem->path);
+      exit(EXIT_FAILURE);
+    }
+    return fd;
+  }
+
+  /* Wait until the creator has opened and sized the object */
+  for (int retry = 0;; ++retry) {
+    struct stat st;
+
+    if (shmem->kind == SHMEM_POSIX)
+      fd = shm_open(shmem->path, O_RDWR, 0);
+    else
+      fd = open(shmem->path, O_RDWR | O_CLOEXEC);
+    if (fd >= 0) {
+      if (!fstat(fd, &st) && ((size_t)st.st_size >= shmem->size))
+        return fd;
+      close(fd);
+    } else if (errno != ENOENT) {
+      perror(shmem->path);
+      exit(EXIT_FAILURE);
+    }
+
+    if (retry == SHMEM_ATTACH_RETRIES) {
+      fprintf(stderr, "%s did not appear in time!\n", shmem->path);
+      exit(EXIT_FAILURE);
+    }
+    usleep(SHMEM_ATTACH_RETRY_US);
+  }
+}
+
+static void setup_sysv(LocalShmem *shmem, int index, int node) {
+  key_t segment_key = ftok("shmem", index);
+
+  shmem->segment_id = shmget(segment_key, shmem->size, IPC_CREAT | 0666);
+  if (shmem->segment_id < 0) {
+    throw("Could not get segment");
+  }
+
+  shmem->memory = shmat(shmem->segment_id, NULL, 0);
+  if (shmem->memory == (void *)-1) {
+    throw("Could not attach segment");
+  }
+  place_memory(shmem, node, 0);
+}
+
+static void local_shmem_setup(LocalShmem *shmem, const char *spec, int index,
+                              size_t size, int node, int is_owner) {
+  const char *directory;
+  int fd;
+
+  shmem->kind = parse_kind(spec, &directory);
+  shmem->is_owner = is_owner;
+  shmem->segment_id = -1;
+  shmem->path[0] = '\0';
+
+  const size_t page_size = backend_page_size(shmem->kind, directory);
+  shmem->size = (size + page_size - 1) & ~(page_size - 1);
+
+  switch (shmem->kind) {
+  case SHMEM_SYSV:
+    setup_sysv(shmem, index, node);
+    break;
+
+  case SHMEM_MEMFD:
+  case SHMEM_MEMFD_2M:
+  case SHMEM_MEMFD_1G:
+    if (is_owner) {
+      unsigned int flags = MFD_CLOEXEC;
+      if (shmem->kind == SHMEM_MEMFD_2M)
+        flags |= MFD_HUGETLB | MFD_HUGE_2MB;
+      else if (shmem->kind == SHMEM_MEMFD_1G)
+        flags |= MFD_HUGETLB | MFD_HUGE_1GB;
+
+      fd = memfd_create("ipc-bench-shmem", flags);
+      if (fd < 0 || ftruncate(fd, shmem->size)) {
+        perror("memfd_create()");
+        exit(EXIT_FAILURE);
+      }
+      map_fd(shmem, fd, node);
+      serve_fd(shmem, fd, index);
+    } else {
+      fd = fetch_fd(shmem, index);
+      map_fd(shmem, fd, node);
+    }
+    close(fd);
+    break;
+
+  case SHMEM_POSIX:
+  case SHMEM_HUGETLBFS:
+    if (shmem->kind == SHMEM_POSIX)
+      snprintf(shmem->path, sizeof(shmem->path), "/ipc-bench-%d", index);
+    else if (snprintf(shmem->path, sizeof(shmem->path), "%s/ipc-bench-%d",
+                      directory, index) >= (int)sizeof(shmem->path)) {
+      fprintf(stderr, "hugetlbfs path is too long!\n");
+      exit(EXIT_FAILURE);
+    }
+    fd = open_named(shmem);
+    map_fd(shmem, fd, node);
+    close(fd);
+    break;
+  }
+
+  if (node >= 0)
+    benchmark_tag("Shared memory", "%s (%zu bytes, node %d)", spec,
+                  shmem->size, node);
+  else
+    benchmark_tag("Shared memory", "%s (%zu bytes)", spec, shmem->size);
+}
+
+void local_shmem_create(LocalShmem *shmem, const char *spec, int index,
+                        size_t size, int node) {
+  local_shmem_setup(shmem, spec, index, size, node, 1);
+}
+
+void local_shmem_attach(LocalShmem *shmem, const char *spec, int index,
+                        size_t size, int node) {
+  local_shmem_setup(shmem, spec, index, size, node, 0);
+}
+
+void local_shmem_release(LocalShmem *shmem) {
+  if (shmem->kind == SHMEM_SYSV) {
+    shmdt(shmem->memory);
+    if (shmem->is_owner)
+      shmctl(shmem->segment_id, IPC_RMID, NULL);
+    return;
+  }
+
+  if (munmap(shmem->memory, shmem->size)) {
+    perror("munmap()");
+    exit(EXIT_FAILURE);
+  }
+  if (!shmem->is_owner)
+    return;
+
+  if (shmem->kind == SHMEM_POSIX)
+    shm_unlink(shmem->path);
+  else if (shmem->kind == SHMEM_HUGETLBFS)
+    unlink(shmem->path);
+}
@@ -0,0 +1,46 @@
+#ifndef IPC_BENCH_SHMEM_H
+#define IPC_BENCH_SHMEM_H
+
+#include <limits.h>
+#include <stddef.h>
+
+/* Backends for shared memory between two local processes */
+typedef enum ShmemKind {
+  SHMEM_SYSV,      /* shmget() keyed by ftok("shmem", index) */
+  SHMEM_MEMFD,     /* memfd_create(), fd passed over a Unix socket */
+  SHMEM_MEMFD_2M,  /* memfd_create(MFD_HUGETLB | MFD_HUGE_2MB) */
+  SHMEM_MEMFD_1G,  /* memfd_create(MFD_HUGETLB | MFD_HUGE_1GB) */
+  SHMEM_POSIX,     /* shm_open("/ipc-bench-<index>") */
+  SHMEM_HUGETLBFS, /* <dir>/ipc-bench-<index> on a hugetlbfs mount */
+} ShmemKind;
+
+typedef struct LocalShmem {
+  ShmemKind kind;
+  void *memory;
+  /* Mapped size (rounded up to the page size of the backend) */
+  size_t size;
+
+  int is_owner;
+  int segment_id;
+  char path[PATH_MAX];
+} LocalShmem;
+
+/**
+ * Creates, maps and prefaults (MAP_POPULATE) the shared memory described by
+ * `spec` (memfd, memfd-2m, memfd-1g, posix, hugetlbfs:<dir> or sysv). With a
+ * non-negative `node`, the pages are bound to that NUMA node via mbind()
+ * before they are first touched.
+ *
+ * For memfd backends this blocks until the peer attaches.
+ */
+void local_shmem_create(LocalShmem *shmem, const char *spec, int index,
+                        size_t size, int node);
+
+/* Attaches to the shared memory created by the peer; retries until it exists */
+void local_shmem_attach(LocalShmem *shmem, const char *spec, int index,
+                        size_t size, int node);
+
+/* Unmaps the memory; the creator also removes the backing object */
+void local_shmem_release(LocalShmem *shmem);
+
+#endif /* IPC_BENCH_SHMEM_H */
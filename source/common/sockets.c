@@ -1,11 +1,26 @@
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+
+#include "common/benchmarks.h"
 #include "common/common.h"
+#include "common/realtime.h"
 #include "common/sockets.h"
 
 typedef struct timeval timeval;
@@ -157,6 +172,75 @@ int receive(int connection, void *buffer, int size, int busy_waiting) {
   return 0;
 }
 
+int socket_try_send_fd(int socket_fd, const void *data, size_t size,
+                       int fd) {
+  union {
+    char buffer[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = {.iov_base = (void *)data, .iov_len = size};
+  struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1};
+
+  if (fd >= 0) {
+    memset(&control, 0, sizeof(control));
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+
+  while (sendmsg(socket_fd, &message, MSG_NOSIGNAL) != (ssize_t)size)
+    if ((errno == EPIPE) || (errno == ECONNRESET))
+      return -1;
+    else if (errno != EINTR) {
+      perror("sendmsg()");
+      exit(EXIT_FAILURE);
+    }
+  return 0;
+}
+void socket_send_fd(int socket_fd, const void *data, size_t size, int fd) {
+  if (socket_try_send_fd(socket_fd, data, size, fd)) {
+    perror("sendmsg()");
+    exit(EXIT_FAILURE);
+  }
+}
+
+int socket_recv_fd(int socket_fd, void *data, size_t size) {
+  union {
+    char buffer[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct iovec iov = {.iov_base = data, .iov_len = size};
+  struct msghdr message = {.msg_iov = &iov,
+                           .msg_iovlen = 1,
+                           .msg_control = control.buffer,
+                           .msg_controllen = sizeof(control.buffer)};
+  ssize_t ret;
+  int fd = -1;
+
+  while ((ret = recvmsg(socket_fd, &message, MSG_WAITALL | MSG_CMSG_CLOEXEC)) <
+         0)
+    if (errno != EINTR) {
+      perror("recvmsg()");
+      exit(EXIT_FAILURE);
+    }
+  if (ret != (ssize_t)size) {
+    fprintf(stderr, "Unexpected end of Unix socket stream!\n");
+    exit(EXIT_FAILURE);
+  }
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+  if (cmsg && (cmsg->cmsg_level == SOL_SOCKET) &&
+      (cmsg->cmsg_type == SCM_RIGHTS))
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+  return fd;
+}
+
 int get_socket_flags(int socket_fd) {
   int flags;
   if ((flags = fcntl(socket_fd, F_GETFL)) == -1) {
@@ -200,74 +284,1169 @@ bool socket_is_non_blocking(int socket_fd) {
 
 void socket_tcp_read_data(int fd, void *buffer, size_t size,
                           struct SocketArgs *args) {
-  int ret;
+  ssize_t ret;
   size_t left_size = size;
 
-  do
+  do {
     if ((ret = recv(fd, buffer + (size - left_size), left_size,
-                    args->wait_all ? MSG_WAITALL : 0)) < 0)
+                    args->wait_all ? MSG_WAITALL : 0)) < 0) {
       if (unlikely(!args->is_nonblock || (errno != EAGAIN)) &&
           (errno != EINTR)) {
         perror("recv()");
         exit(EXIT_FAILURE);
       }
-  while ((left_size = left_size - ret));
+      ret = 0; /* Retry; nothing was transferred */
+    }
+  } while ((left_size -= ret));
 }
 void socket_tcp_write_data(int fd, void *buffer, size_t size,
                            struct SocketArgs *args) {
-  int ret;
+  ssize_t ret;
   size_t left_size = size;
 
-  do
-    if ((ret = send(fd, buffer + (size - left_size), left_size, 0)) < 0)
+  do {
+    if ((ret = send(fd, buffer + (size - left_size), left_size, 0)) < 0) {
       if (unlikely(!args->is_nonblock || (errno != EAGAIN)) &&
           (errno != EINTR)) {
         perror("send()");
         exit(EXIT_FAILURE);
       }
-  while ((left_size = left_size - ret));
+      ret = 0; /* Retry; nothing was transferred */
+    }
+  } while ((left_size -= ret));
 }
 
 /* TCP DATA END */
 
+/* TCP ZEROCOPY */
+
+void tcp_zerocopy_init(TcpZerocopy *zc, int fd, size_t size,
+                       struct SocketArgs *args) {
+  memset(zc, 0, sizeof(*zc));
+  zc->fd = fd;
+  zc->is_send = args->is_zerocopy_send;
+
+  if (zc->is_send) {
+    int optval = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &optval, sizeof(optval))) {
+      perror("setsockopt(SO_ZEROCOPY)");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (args->is_zerocopy_receive) {
+    const size_t page_size = getpagesize();
+    zc->window_size = (size + page_size - 1) & ~(page_size - 1);
+    zc->window = mmap(NULL, zc->window_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (zc->window == MAP_FAILED) {
+      perror("mmap(TCP socket)");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  /* Mapped and copied pieces alternate, and the former span whole pages */
+  const size_t page_count = (size + getpagesize() - 1) / getpagesize();
+  if (!(zc->parts = malloc((2 * page_count + 1) * sizeof(*zc->parts)))) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void tcp_zerocopy_close(TcpZerocopy *zc) {
+  tcp_zerocopy_flush(zc);
+  if (zc->window && munmap(zc->window, zc->window_size)) {
+    perror("munmap()");
+    exit(EXIT_FAILURE);
+  }
+  free(zc->parts);
+}
+
+static void wait_for(int fd, short events) {
+  struct pollfd pollfd = {.fd = fd, .events = events};
+
+  while (poll(&pollfd, 1, -1) < 0)
+    if (errno != EINTR) {
+      perror("poll()");
+      exit(EXIT_FAILURE);
+    }
+}
+
+/* Counts the completions on the error queue until it is empty */
+static void drain_completions(TcpZerocopy *zc) {
+  char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+  struct msghdr message;
+
+  for (;;) {
+    memset(&message, 0, sizeof(message));
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    if (recvmsg(zc->fd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      if ((errno == EAGAIN) || (errno == EINTR))
+        return;
+      perror("recvmsg(MSG_ERRQUEUE)");
+      exit(EXIT_FAILURE);
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg;
+         cmsg = CMSG_NXTHDR(&message, cmsg)) {
+      const struct sock_extended_err *error = (void *)CMSG_DATA(cmsg);
+      if (!(((cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == IP_RECVERR)) ||
+            ((cmsg->cmsg_level == SOL_IPV6) &&
+             (cmsg->cmsg_type == IPV6_RECVERR))) ||
+          (error->ee_origin != SO_EE_ORIGIN_ZEROCOPY))
+        continue;
+      /* Sends ee_info to ee_data (inclusive) are done with */
+      const uint32_t count = error->ee_data - error->ee_info + 1;
+      zc->completed_count += count;
+      if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+        zc->copied_count += count;
+    }
+  }
+}
+
+void tcp_zerocopy_write(TcpZerocopy *zc, void *buffer, size_t size,
+                        struct SocketArgs *args) {
+  ssize_t ret;
+  size_t left_size = size;
+
+  if (!zc->is_send) {
+    socket_tcp_write_data(zc->fd, buffer, size, args);
+    return;
+  }
+
+  do {
+    if ((ret = send(zc->fd, buffer + (size - left_size), left_size,
+                    MSG_ZEROCOPY)) < 0) {
+      /* Out of optmem for pinned pages until some sends complete */
+      if (errno == ENOBUFS) {
+        drain_completions(zc);
+        /* Nothing left in flight would ever raise POLLERR; just retry */
+        if (zc->completed_count < zc->send_count) {
+          /* POLLERR is reported whether asked for or not */
+          wait_for(zc->fd, 0);
+          drain_completions(zc);
+        }
+      } else if (unlikely(!args->is_nonblock || (errno != EAGAIN)) &&
+                 (errno != EINTR)) {
+        perror("send(MSG_ZEROCOPY)");
+        exit(EXIT_FAILURE);
+      }
+      ret = 0; /* Retry; nothing was transferred */
+    } else if (ret)
+      ++zc->send_count;
+  } while ((left_size -= ret));
+}
+
+void tcp_zerocopy_flush(TcpZerocopy *zc) {
+  while (zc->completed_count < zc->send_count) {
+    wait_for(zc->fd, 0);
+    drain_completions(zc);
+  }
+}
+
+/* Appends to the pieces of the message, extending the last one if adjacent */
+static void add_part(TcpZerocopy *zc, void *base, size_t length) {
+  if (zc->part_count) {
+    struct iovec *last = &zc->parts[zc->part_count - 1];
+    if (last->iov_base + last->iov_len == base) {
+      last->iov_len += length;
+      return;
+    }
+  }
+  zc->parts[zc->part_count++] = (struct iovec){base, length};
+}
+
+const struct iovec *tcp_zerocopy_read(TcpZerocopy *zc, void *buffer,
+                                      size_t size, int *count,
+                                      struct SocketArgs *args) {
+  const size_t page_size = getpagesize();
+  /* Bytes of the message so far, and of them those mapped into the window */
+  size_t done = 0, mapped = 0;
+
+  zc->part_count = 0;
+  if (!zc->window) {
+    socket_tcp_read_data(zc->fd, buffer, size, args);
+    add_part(zc, buffer, size);
+    *count = zc->part_count;
+    return zc->parts;
+  }
+
+  while (done < size) {
+    const size_t left_size = size - done;
+    struct tcp_zerocopy_receive receive = {
+        .address = (uintptr_t)zc->window + mapped,
+        .length = left_size & ~(page_size - 1)};
+    socklen_t length = sizeof(receive);
+
+    /* Less than a page left; it cannot be mapped */
+    if (!receive.length) {
+      socket_tcp_read_data(zc->fd, buffer + done, left_size, args);
+      add_part(zc, buffer + done, left_size);
+      done = size;
+      break;
+    }
+
+    /* Replaces whatever this part of the window held before */
+    if (getsockopt(zc->fd, IPPROTO_TCP, TCP_ZEROCOPY_RECEIVE, &receive,
+                   &length)) {
+      perror("getsockopt(TCP_ZEROCOPY_RECEIVE)");
+      exit(EXIT_FAILURE);
+    }
+    if (receive.length) {
+      add_part(zc, zc->window + mapped, receive.length);
+      done += receive.length;
+      mapped += receive.length;
+      zc->mapped_bytes += receive.length;
+    }
+    if (receive.recv_skip_hint) {
+      /* Not page-aligned in the skb; read it the usual way */
+      const size_t skip = (receive.recv_skip_hint < size - done)
+                              ? receive.recv_skip_hint
+                              : size - done;
+      socket_tcp_read_data(zc->fd, buffer + done, skip, args);
+      add_part(zc, buffer + done, skip);
+      done += skip;
+    } else if (!receive.length) {
+      wait_for(zc->fd, POLLIN);
+      /* Pending completions would keep POLLERR up and poll() spinning */
+      if (zc->is_send)
+        drain_completions(zc);
+    }
+  }
+  zc->received_bytes += size;
+
+  *count = zc->part_count;
+  return zc->parts;
+}
+
+void tcp_zerocopy_report(TcpZerocopy *zc) {
+  if (zc->is_send)
+    benchmark_tag("MSG_ZEROCOPY sends copied", "%" PRIu64 " of %" PRIu64,
+                  zc->copied_count, zc->send_count);
+  if (zc->window)
+    benchmark_tag("Received through mapped pages", "%.1f%%",
+                  zc->received_bytes
+                      ? 100.0 * zc->mapped_bytes / zc->received_bytes
+                      : 0.0);
+}
+
+/* TCP ZEROCOPY END */
+
 /* UDP DATA */
 
 void socket_udp_read_data(int fd, void *buffer, size_t size,
                           struct sockaddr_in *peer_addr, socklen_t *sock_len,
                           struct SocketArgs *args) {
-  int ret;
+  ssize_t ret;
   size_t left_size = size;
 
-  do
+  do {
     if ((ret = recvfrom(fd, buffer + (size - left_size), left_size,
                         args->wait_all ? MSG_WAITALL : 0,
-                        (struct sockaddr *)peer_addr, sock_len)) < 0)
+                        (struct sockaddr *)peer_addr, sock_len)) < 0) {
       if (unlikely(!args->is_nonblock || (errno != EAGAIN)) &&
           (errno != EINTR)) {
         perror("recvfrom()");
         exit(EXIT_FAILURE);
       }
-  while ((left_size = left_size - ret));
+      ret = 0; /* Retry; nothing was transferred */
+    }
+  } while ((left_size -= ret));
 }
 void socket_udp_write_data(int fd, void *buffer, size_t size,
                            const struct sockaddr_in *peer_addr,
                            socklen_t sock_len, struct SocketArgs *args) {
-  int ret;
+  ssize_t ret;
   size_t left_size = size;
 
-  do
+  do {
     if ((ret = sendto(fd, buffer + (size - left_size), left_size, 0,
-                      (const struct sockaddr *)peer_addr, sock_len)) < 0)
+                      (const struct sockaddr *)peer_addr, sock_len)) < 0) {
       if (unlikely(!args->is_nonblock || (errno != EAGAIN)) &&
           (errno != EINTR)) {
         perror("sendto()");
         exit(EXIT_FAILURE);
       }
-  while ((left_size = left_size - ret));
+      ret = 0; /* Retry; nothing was transferred */
+    }
+  } while ((left_size -= ret));
 }
 
 /* UDP DATA END */
 
+/* UDP BATCH */
+
+void udp_batch_init(UdpBatch *batch, int fd, size_t size,
+                    struct SocketArgs *args) {
+  memset(batch, 0, sizeof(*batch));
+  batch->fd = fd;
+  batch->capacity = args->batch_size;
+  batch->timeout_us = args->batch_timeout_us;
+  batch->size = size;
+
+  batch->messages = calloc(batch->capacity, sizeof(*batch->messages));
+  batch->iovecs = calloc(batch->capacity, sizeof(*batch->iovecs));
+  batch->buffers = malloc(batch->capacity * size);
+  if (!batch->messages || !batch->iovecs || !batch->buffers) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(batch->buffers, batch->capacity * size, 1);
+
+  /* The socket is connected, so the headers never carry an address */
+  for (int i = 0; i < batch->capacity; ++i) {
+    batch->iovecs[i].iov_base = batch->buffers + i * size;
+    batch->iovecs[i].iov_len = size;
+    batch->messages[i].msg_hdr.msg_iov = &batch->iovecs[i];
+    batch->messages[i].msg_hdr.msg_iovlen = 1;
+  }
+}
+
+void udp_batch_close(UdpBatch *batch) {
+  free(batch->messages);
+  free(batch->iovecs);
+  free(batch->buffers);
+}
+
+void *udp_batch_acquire(UdpBatch *batch) {
+  return batch->iovecs[batch->queued].iov_base;
+}
+
+void udp_batch_send(UdpBatch *batch, size_t size) {
+  batch->iovecs[batch->queued].iov_len = size;
+  if (!batch->queued++ && batch->timeout_us)
+    batch->first_queued = now();
+
+  if ((batch->queued == batch->capacity) ||
+      (batch->timeout_us &&
+       (now() - batch->first_queued >= batch->timeout_us * 1000ULL)))
+    udp_batch_flush(batch);
+}
+
+void udp_batch_flush(UdpBatch *batch) {
+  int ret, sent = 0;
+
+  while (sent < batch->queued) {
+    ++batch->call_count;
+    if ((ret = sendmmsg(batch->fd, batch->messages + sent,
+                        batch->queued - sent, 0)) < 0) {
+      if ((errno != EAGAIN) && (errno != EINTR)) {
+        perror("sendmmsg()");
+        exit(EXIT_FAILURE);
+      }
+      continue; /* Retry; nothing was transferred */
+    }
+    sent += ret;
+  }
+  batch->message_count += sent;
+  batch->queued = 0;
+}
+
+/* One recvmmsg() into the free part of the batch; 0 if nothing was there */
+static int receive_batch(UdpBatch *batch, int first, int flags) {
+  int ret;
+
+  for (;;) {
+    ++batch->call_count;
+    if ((ret = recvmmsg(batch->fd, batch->messages + first,
+                        batch->capacity - first, flags, NULL)) >= 0)
+      return ret;
+    if ((errno == EAGAIN) && (flags & MSG_DONTWAIT))
+      return 0;
+    if ((errno != EAGAIN) && (errno != EINTR)) {
+      perror("recvmmsg()");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+int udp_batch_receive(UdpBatch *batch) {
+  /* Block for the first datagram only, then take what else has arrived */
+  int count = receive_batch(batch, 0, MSG_WAITFORONE);
+
+  if (batch->timeout_us) {
+    const bench_t deadline = now() + batch->timeout_us * 1000ULL;
+    struct pollfd pollfd = {.fd = batch->fd, .events = POLLIN};
+    bench_t current;
+
+    /* recvmmsg()'s own timeout is only checked after each datagram */
+    while ((count < batch->capacity) && ((current = now()) < deadline)) {
+      const struct timespec timeout = {
+          .tv_sec = (deadline - current) / 1000000000ULL,
+          .tv_nsec = (deadline - current) % 1000000000ULL};
+      if (ppoll(&pollfd, 1, &timeout, NULL) < 0) {
+        if (errno == EINTR)
+          continue;
+        perror("ppoll()");
+        exit(EXIT_FAILURE);
+      }
+      if (pollfd.revents & POLLIN)
+        count += receive_batch(batch, count, MSG_DONTWAIT);
+    }
+  }
+
+  batch->message_count += count;
+  return count;
+}
+
+void *udp_batch_message(UdpBatch *batch, int index, size_t *size) {
+  *size = batch->messages[index].msg_len;
+  return batch->iovecs[index].iov_base;
+}
+
+/* UDP BATCH END */
+
+/* UDP SEGMENTS */
+
+void udp_segments_init(UdpSegments *segments, int fd,
+                       struct SocketArgs *args) {
+  int optval;
+
+  memset(segments, 0, sizeof(*segments));
+  segments->fd = fd;
+  segments->is_offload = args->is_segment_offload;
+  segments->segment_size = args->segment_size;
+  segments->send_size = args->segment_size;
+  if (!segments->is_offload)
+    return;
+
+  optval = args->segment_size;
+  if (setsockopt(fd, SOL_UDP, UDP_SEGMENT, &optval, sizeof(optval))) {
+    perror("setsockopt(UDP_SEGMENT)");
+    exit(EXIT_FAILURE);
+  }
+  optval = 1;
+  if (setsockopt(fd, SOL_UDP, UDP_GRO, &optval, sizeof(optval))) {
+    perror("setsockopt(UDP_GRO)");
+    exit(EXIT_FAILURE);
+  }
+
+  /* The GSO packet still has to fit into a single IP datagram */
+  const size_t count = UDP_MAX_PAYLOAD / args->segment_size;
+  segments->send_size =
+      args->segment_size *
+      ((count < UDP_SEGMENT_MAX_COUNT) ? count : UDP_SEGMENT_MAX_COUNT);
+}
+
+void udp_segments_write(UdpSegments *segments, void *buffer, size_t size,
+                        struct SocketArgs *args) {
+  for (size_t offset = 0; offset < size; offset += segments->send_size) {
+    const size_t length = (size - offset < segments->send_size)
+                              ? size - offset
+                              : segments->send_size;
+
+    /* Datagrams go out whole or not at all */
+    while (send(segments->fd, buffer + offset, length, 0) < 0)
+      if (unlikely(!args->is_nonblock || (errno != EAGAIN)) &&
+          (errno != EINTR)) {
+        perror("send()");
+        exit(EXIT_FAILURE);
+      }
+    ++segments->send_count;
+    segments->sent_segments +=
+        (length + segments->segment_size - 1) / segments->segment_size;
+  }
+}
+
+void udp_segments_read(UdpSegments *segments, void *buffer, size_t size,
+                       struct SocketArgs *args) {
+  char control[CMSG_SPACE(sizeof(int))];
+  struct msghdr message;
+  struct iovec iovec;
+  ssize_t ret;
+  size_t done = 0;
+
+  while (done < size) {
+    iovec.iov_base = buffer + done;
+    iovec.iov_len = size - done;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iovec;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    if ((ret = recvmsg(segments->fd, &message, 0)) < 0) {
+      if (unlikely(!args->is_nonblock || (errno != EAGAIN)) &&
+          (errno != EINTR)) {
+        perror("recvmsg()");
+        exit(EXIT_FAILURE);
+      }
+      continue; /* Retry; nothing was transferred */
+    }
+    if (message.msg_flags & MSG_TRUNC) {
+      fprintf(stderr, "A datagram ran past the %zu bytes left of the "
+                      "message!\n",
+              size - done);
+      exit(EXIT_FAILURE);
+    }
+
+    /* Coalesced segments come with their size; the last may be short */
+    size_t segment_size = ret;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    if (cmsg && (cmsg->cmsg_level == SOL_UDP) &&
+        (cmsg->cmsg_type == UDP_GRO))
+      segment_size = *(int *)CMSG_DATA(cmsg);
+    ++segments->receive_count;
+    segments->received_segments += (ret + segment_size - 1) / segment_size;
+    done += ret;
+  }
+}
+
+void udp_segments_report(UdpSegments *segments) {
+  benchmark_tag("UDP segments", "%zu B%s", segments->segment_size,
+                segments->is_offload ? " through GSO/GRO" : "");
+  benchmark_tag("Datagrams per send", "%.2f",
+                (double)segments->sent_segments / segments->send_count);
+  benchmark_tag("Datagrams per recv", "%.2f",
+                (double)segments->received_segments /
+                    segments->receive_count);
+}
+
+/* UDP SEGMENTS END */
+
+/* UDP RELIABLE */
+
+enum { UDP_RELIABLE_DATA, UDP_RELIABLE_SACK };
+/* Asks for a SACK; marks a fragment sent before */
+#define UDP_RELIABLE_REQUEST 0x1
+#define UDP_RELIABLE_RESENT 0x2
+
+/* Where the retransmission timeout starts and its bounds, in ns */
+#define UDP_RELIABLE_INITIAL_RTO (10 * 1000 * 1000ULL)
+#define UDP_RELIABLE_MIN_RTO (1000 * 1000ULL)
+#define UDP_RELIABLE_MAX_RTO (1000 * 1000 * 1000ULL)
+
+typedef struct UdpReliableHeader {
+  uint16_t type;
+  uint16_t flags;
+  uint32_t message;
+  /* DATA: the fragment; SACK: the first one still missing */
+  uint32_t index;
+  /* DATA: fragments in the message; SACK: bits in the bitmap that follows */
+  uint32_t count;
+  /* DATA: the window it went out with; SACK: the window it answers */
+  uint32_t burst;
+} UdpReliableHeader;
+
+void udp_reliable_init(UdpReliable *reliable, int fd,
+                       struct SocketArgs *args) {
+  int rcvbuf;
+  socklen_t optlen = sizeof(rcvbuf);
+
+  memset(reliable, 0, sizeof(*reliable));
+  reliable->fd = fd;
+  reliable->fragment_size = args->reliable_size - sizeof(UdpReliableHeader);
+  reliable->max_size = args->size;
+  reliable->rto = UDP_RELIABLE_INITIAL_RTO;
+
+  /* What the peer's receive buffer surely holds, as it is set up alike */
+  if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen)) {
+    perror("getsockopt(SO_RCVBUF)");
+    exit(EXIT_FAILURE);
+  }
+  reliable->window = rcvbuf / (2 * args->reliable_size + 1024);
+  if (!reliable->window)
+    reliable->window = 1;
+  /* A SACK covers a window */
+  if (reliable->window > 8 * reliable->fragment_size)
+    reliable->window = 8 * reliable->fragment_size;
+
+  const size_t count =
+      (args->size + reliable->fragment_size - 1) / reliable->fragment_size;
+  reliable->sack = malloc(args->reliable_size);
+  reliable->scratch = malloc(reliable->fragment_size);
+  reliable->rx = malloc(count * reliable->fragment_size);
+  reliable->tx_acked = calloc(count, 1);
+  reliable->tx_sent = calloc(count, 1);
+  reliable->rx_have = calloc(count, 1);
+  if (!reliable->sack || !reliable->scratch || !reliable->rx ||
+      !reliable->tx_acked || !reliable->tx_sent || !reliable->rx_have) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(reliable->rx, count * reliable->fragment_size, 1);
+}
+
+static void send_datagram(int fd, const UdpReliableHeader *header,
+                          const void *payload, size_t size) {
+  struct iovec iovecs[2] = {{(void *)header, sizeof(*header)},
+                            {(void *)payload, size}};
+  struct msghdr message = {.msg_iov = iovecs, .msg_iovlen = 2};
+
+  while (sendmsg(fd, &message, 0) < 0)
+    if ((errno != EAGAIN) && (errno != EINTR)) {
+      perror("sendmsg()");
+      exit(EXIT_FAILURE);
+    }
+}
+
+static void send_fragment(UdpReliable *reliable, uint32_t index,
+                          uint16_t flags) {
+  const size_t offset = (size_t)index * reliable->fragment_size;
+  const size_t length = (reliable->tx_size - offset < reliable->fragment_size)
+                            ? reliable->tx_size - offset
+                            : reliable->fragment_size;
+
+  if (reliable->tx_sent[index]) {
+    flags |= UDP_RELIABLE_RESENT;
+    ++reliable->retransmit_count;
+  }
+  reliable->tx_sent[index] = 1;
+  ++reliable->sent_count;
+
+  const UdpReliableHeader header = {UDP_RELIABLE_DATA, flags,
+                                    reliable->tx_message, index,
+                                    reliable->tx_count, reliable->tx_burst};
+  send_datagram(reliable->fd, &header, reliable->tx + offset, length);
+}
+
+/* Reports what has arrived of the message of `fragment`; all of it unless
+ * that is the one still being received */
+static void send_sack(UdpReliable *reliable,
+                      const UdpReliableHeader *fragment) {
+  UdpReliableHeader *header = reliable->sack;
+  uint8_t *bitmap = (uint8_t *)(header + 1);
+
+  header->type = UDP_RELIABLE_SACK;
+  header->flags = 0;
+  header->message = fragment->message;
+  header->index = fragment->count;
+  header->count = 0;
+  header->burst = fragment->burst;
+
+  if ((fragment->message == reliable->rx_message) &&
+      (reliable->rx_received < reliable->rx_count)) {
+    const uint32_t left = reliable->rx_count - reliable->rx_base;
+    header->index = reliable->rx_base;
+    header->count = (left < 8 * reliable->fragment_size)
+                        ? left
+                        : 8 * reliable->fragment_size;
+    memset(bitmap, 0, (header->count + 7) / 8);
+    for (uint32_t bit = 0; bit < header->count; ++bit)
+      if (reliable->rx_have[reliable->rx_base + bit])
+        bitmap[bit / 8] |= 1 << (bit % 8);
+  }
+
+  send_datagram(reliable->fd, header, bitmap, (header->count + 7) / 8);
+}
+
+static void receive_fragment(UdpReliable *reliable,
+                             const UdpReliableHeader *header,
+                             const void *payload, size_t length) {
+  const int32_t age = reliable->rx_message - header->message;
+  const int is_complete = reliable->rx_count &&
+                          (reliable->rx_received == reliable->rx_count);
+
+  /* Done with already; the peer has just not seen our SACK */
+  if ((age > 0) || (!age && is_complete)) {
+    ++reliable->duplicate_count;
+    if (header->flags & UDP_RELIABLE_REQUEST)
+      send_sack(reliable, header);
+    return;
+  }
+  /* The peer's next message; resent once this one is read */
+  if (age < 0)
+    return;
+
+  const size_t capacity =
+      (reliable->max_size + reliable->fragment_size - 1) /
+      reliable->fragment_size;
+  if (!reliable->rx_count) {
+    if (header->count > capacity) {
+      fprintf(stderr, "Message of %u fragments exceeds the -b of %zu!\n",
+              header->count, capacity);
+      exit(EXIT_FAILURE);
+    }
+    reliable->rx_count = header->count;
+  }
+  if ((header->count != reliable->rx_count) ||
+      (header->index >= reliable->rx_count) ||
+      (length > reliable->fragment_size) ||
+      ((header->index < reliable->rx_count - 1) &&
+       (length != reliable->fragment_size))) {
+    fprintf(stderr, "Malformed fragment %u of %u!\n", header->index,
+            header->count);
+    exit(EXIT_FAILURE);
+  }
+
+  if (reliable->rx_have[header->index]) {
+    ++reliable->duplicate_count;
+  } else {
+    void *place = reliable->rx + header->index * reliable->fragment_size;
+    if (payload != place)
+      memcpy(place, payload, length);
+    reliable->rx_have[header->index] = 1;
+    ++reliable->rx_received;
+    reliable->rx_bytes += length;
+
+    /* Resent ones come late by design */
+    if ((header->index < reliable->rx_next) &&
+        !(header->flags & UDP_RELIABLE_RESENT))
+      ++reliable->reorder_count;
+    if (header->index >= reliable->rx_next)
+      reliable->rx_next = header->index + 1;
+    while ((reliable->rx_base < reliable->rx_count) &&
+           reliable->rx_have[reliable->rx_base])
+      ++reliable->rx_base;
+
+    /* Spare the peer its timeout once all is there */
+    if (reliable->rx_received == reliable->rx_count) {
+      send_sack(reliable, header);
+      return;
+    }
+  }
+
+  if (header->flags & UDP_RELIABLE_REQUEST)
+    send_sack(reliable, header);
+}
+
+static void acknowledge(UdpReliable *reliable, uint32_t index) {
+  if (!reliable->tx_acked[index]) {
+    reliable->tx_acked[index] = 1;
+    ++reliable->tx_acked_count;
+  }
+}
+
+/* Returns whether the SACK answers the last window sent */
+static int receive_sack(UdpReliable *reliable, const UdpReliableHeader *header,
+                        const uint8_t *bitmap, size_t length) {
+  if (!reliable->tx || (header->message != reliable->tx_message))
+    return 0;
+  if ((header->index > reliable->tx_count) ||
+      (header->count > reliable->tx_count - header->index) ||
+      ((header->count + 7) / 8 > length)) {
+    fprintf(stderr, "Malformed SACK from %u over %u fragments!\n",
+            header->index, header->count);
+    exit(EXIT_FAILURE);
+  }
+
+  for (uint32_t index = reliable->tx_base; index < header->index; ++index)
+    acknowledge(reliable, index);
+  for (uint32_t bit = 0; bit < header->count; ++bit)
+    if (bitmap[bit / 8] & (1 << (bit % 8)))
+      acknowledge(reliable, header->index + bit);
+  while ((reliable->tx_base < reliable->tx_count) &&
+         reliable->tx_acked[reliable->tx_base])
+    ++reliable->tx_base;
+  /* Older ones would have the window in flight sent once more */
+  return header->burst == reliable->tx_burst;
+}
+
+/**
+ * Takes in one datagram, waiting at most `timeout` ns for it (or forever if
+ * 0). Returns whether it was the SACK that answers the last window sent.
+ */
+static int receive_datagram(UdpReliable *reliable, bench_t timeout) {
+  UdpReliableHeader header;
+  struct iovec iovecs[2] = {{&header, sizeof(header)},
+                            {reliable->scratch, reliable->fragment_size}};
+  struct msghdr message = {.msg_iov = iovecs, .msg_iovlen = 2};
+  ssize_t ret;
+
+  if (timeout) {
+    struct pollfd pollfd = {.fd = reliable->fd, .events = POLLIN};
+    const struct timespec timespec = {.tv_sec = timeout / 1000000000ULL,
+                                      .tv_nsec = timeout % 1000000000ULL};
+    if ((ret = ppoll(&pollfd, 1, &timespec, NULL)) < 0) {
+      if (errno != EINTR) {
+        perror("ppoll()");
+        exit(EXIT_FAILURE);
+      }
+      return 0;
+    }
+    if (!ret)
+      return 0;
+  }
+
+  /* The fragment after the last one most likely comes next */
+  if ((reliable->rx_next < reliable->rx_count) &&
+      !reliable->rx_have[reliable->rx_next])
+    iovecs[1].iov_base =
+        reliable->rx + reliable->rx_next * reliable->fragment_size;
+
+  while ((ret = recvmsg(reliable->fd, &message, 0)) < 0)
+    if ((errno != EAGAIN) && (errno != EINTR)) {
+      perror("recvmsg()");
+      exit(EXIT_FAILURE);
+    }
+  if ((ret < (ssize_t)sizeof(header)) || (message.msg_flags & MSG_TRUNC)) {
+    fprintf(stderr, "Datagram of %zd bytes received; Use the same -R on "
+                    "both peers\n",
+            ret);
+    exit(EXIT_FAILURE);
+  }
+
+  if (header.type == UDP_RELIABLE_SACK)
+    return receive_sack(reliable, &header, iovecs[1].iov_base,
+                        ret - sizeof(header));
+  receive_fragment(reliable, &header, iovecs[1].iov_base,
+                   ret - sizeof(header));
+  return 0;
+}
+
+/* RFC 6298, over the round trip of a whole window; the burst number in
+ * the SACK tells which window it answers, so resent ones count as well */
+static void update_rto(UdpReliable *reliable, bench_t sample) {
+  if (!reliable->srtt) {
+    reliable->srtt = sample;
+    reliable->rttvar = sample / 2;
+  } else {
+    const bench_t delta = (reliable->srtt > sample)
+                              ? reliable->srtt - sample
+                              : sample - reliable->srtt;
+    reliable->rttvar = (3 * reliable->rttvar + delta) / 4;
+    reliable->srtt = (7 * reliable->srtt + sample) / 8;
+  }
+
+  reliable->rto = reliable->srtt + 4 * reliable->rttvar;
+  if (reliable->rto < UDP_RELIABLE_MIN_RTO)
+    reliable->rto = UDP_RELIABLE_MIN_RTO;
+  else if (reliable->rto > UDP_RELIABLE_MAX_RTO)
+    reliable->rto = UDP_RELIABLE_MAX_RTO;
+}
+
+void udp_reliable_close(UdpReliable *reliable) {
+  struct pollfd pollfd = {.fd = reliable->fd, .events = POLLIN};
+  int ret;
+
+  /* Quiet for two timeouts means the last SACK got through */
+  while ((ret = poll(&pollfd, 1, 2 * reliable->rto / 1000000 + 1)) > 0)
+    receive_datagram(reliable, 0);
+  if ((ret < 0) && (errno != EINTR)) {
+    perror("poll()");
+    exit(EXIT_FAILURE);
+  }
+
+  free(reliable->sack);
+  free(reliable->scratch);
+  free(reliable->rx);
+  free(reliable->tx_acked);
+  free(reliable->tx_sent);
+  free(reliable->rx_have);
+}
+
+void udp_reliable_write(UdpReliable *reliable, const void *buffer,
+                        size_t size) {
+  reliable->tx = buffer;
+  reliable->tx_size = size;
+  reliable->tx_count =
+      (size + reliable->fragment_size - 1) / reliable->fragment_size;
+  reliable->tx_base = 0;
+  reliable->tx_acked_count = 0;
+  memset(reliable->tx_acked, 0, reliable->tx_count);
+  memset(reliable->tx_sent, 0, reliable->tx_count);
+  int is_probe = 0;
+
+  while (reliable->tx_acked_count < reliable->tx_count) {
+    /* Everything unacknowledged in the window, the last asking for a SACK */
+    const uint32_t first = reliable->tx_base;
+    const uint32_t end = (reliable->tx_count - first < reliable->window)
+                             ? reliable->tx_count
+                             : first + reliable->window;
+    uint32_t last = first;
+    for (uint32_t index = first; index < end; ++index)
+      if (!reliable->tx_acked[index])
+        last = index;
+    ++reliable->tx_burst;
+    /* After a timeout, only ask again what made it */
+    const uint32_t start = is_probe ? last : first;
+    for (uint32_t index = start; index < end; ++index)
+      if (!reliable->tx_acked[index])
+        send_fragment(reliable, index,
+                      (index == last) ? UDP_RELIABLE_REQUEST : 0);
+    const bench_t sent_at = now();
+    is_probe = 0;
+
+    for (;;) {
+      const bench_t elapsed = now() - sent_at;
+      if (elapsed >= reliable->rto) {
+        ++reliable->timeout_count;
+        is_probe = 1;
+        reliable->rto = (2 * reliable->rto < UDP_RELIABLE_MAX_RTO)
+                            ? 2 * reliable->rto
+                            : UDP_RELIABLE_MAX_RTO;
+        break;
+      }
+      if (receive_datagram(reliable, reliable->rto - elapsed)) {
+        update_rto(reliable, now() - sent_at);
+        break;
+      }
+      /* Complete on a SACK that answers an older window */
+      if (reliable->tx_acked_count == reliable->tx_count)
+        break;
+    }
+
+    /* Missing before a fragment that made it means lost, not in flight */
+    uint32_t highest = end;
+    while ((highest > start) && !reliable->tx_acked[highest - 1])
+      --highest;
+    for (uint32_t index = start; index < highest; ++index)
+      if (!reliable->tx_acked[index])
+        ++reliable->loss_count;
+  }
+
+  reliable->tx = NULL;
+  ++reliable->tx_message;
+}
+
+void *udp_reliable_read(UdpReliable *reliable, size_t size) {
+  while (!reliable->rx_count ||
+         (reliable->rx_received < reliable->rx_count))
+    receive_datagram(reliable, 0);
+  if (reliable->rx_bytes != size) {
+    fprintf(stderr, "Message of %zu bytes received, expected %zu!\n",
+            reliable->rx_bytes, size);
+    exit(EXIT_FAILURE);
+  }
+
+  /* Fragments of the next message may come in from here on */
+  memset(reliable->rx_have, 0, reliable->rx_count);
+  reliable->rx_count = 0;
+  reliable->rx_base = 0;
+  reliable->rx_next = 0;
+  reliable->rx_received = 0;
+  reliable->rx_bytes = 0;
+  ++reliable->rx_message;
+  return reliable->rx;
+}
+
+void udp_reliable_report(UdpReliable *reliable) {
+  benchmark_tag("Reliable datagrams", "%zu B, window of %u",
+                reliable->fragment_size + sizeof(UdpReliableHeader),
+                reliable->window);
+  benchmark_tag("Retransmitted", "%" PRIu64 " of %" PRIu64 " fragments",
+                reliable->retransmit_count, reliable->sent_count);
+  benchmark_tag("Lost", "%" PRIu64 " fragments, %" PRIu64 " timeouts",
+                reliable->loss_count, reliable->timeout_count);
+  benchmark_tag("Reordered", "%" PRIu64 " fragments",
+                reliable->reorder_count);
+  benchmark_tag("Duplicates", "%" PRIu64 " fragments",
+                reliable->duplicate_count);
+}
+
+/* UDP RELIABLE END */
+
+/* IO_URING DATA */
+
+static const char *const SOCKET_IO_NAMES[] = {
+    [SOCKET_IO_SYSCALL] = "syscall",
+    [SOCKET_IO_URING] = "uring",
+    [SOCKET_IO_SQPOLL] = "sqpoll",
+};
+#define SOCKET_IO_COUNT (sizeof(SOCKET_IO_NAMES) / sizeof(SOCKET_IO_NAMES[0]))
+
+const char *socket_io_name(SocketIo io) { return SOCKET_IO_NAMES[io]; }
+
+static int socket_io_parse(const char *name) {
+  for (size_t io = 0; io < SOCKET_IO_COUNT; ++io)
+    if (!strcmp(name, SOCKET_IO_NAMES[io]))
+      return io;
+  return -1;
+}
+
+/* What a completion was for, in its user_data */
+enum { URING_TX, URING_RX, URING_MULTISHOT };
+
+static void *uring_buffer(size_t size) {
+  void *buffer = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (buffer == MAP_FAILED) {
+    perror("mmap()");
+    exit(EXIT_FAILURE);
+  }
+  return buffer;
+}
+
+static void uring_free(void *buffer, size_t size) {
+  if (munmap(buffer, size)) {
+    perror("munmap()");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void prep_fixed(SocketUring *uring, int op, int index, void *address,
+                       size_t size, uint64_t user_data) {
+  struct io_uring_sqe *sqe = uring_get_sqe(&uring->ring);
+  sqe->opcode = op;
+  sqe->flags = IOSQE_FIXED_FILE;
+  sqe->fd = 0;
+  sqe->addr = (uintptr_t)address;
+  sqe->len = size;
+  /* Sockets refuse any other offset */
+  sqe->off = 0;
+  sqe->buf_index = index;
+  sqe->user_data = user_data;
+}
+
+static void prep_multishot(SocketUring *uring) {
+  struct io_uring_sqe *sqe = uring_get_sqe(&uring->ring);
+  sqe->opcode = IORING_OP_RECV;
+  sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+  sqe->fd = 0;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->buf_group = 0;
+  sqe->user_data = URING_MULTISHOT;
+  uring->is_armed = 1;
+  ++uring->arm_count;
+}
+
+static void recycle_buffer(SocketUring *uring, uint16_t id) {
+  struct io_uring_buf_ring *ring = uring->recv_ring;
+  const uint16_t tail = ring->tail;
+  struct io_uring_buf *buf =
+      &ring->bufs[tail & (SOCKET_URING_RECV_BUFFERS - 1)];
+
+  buf->addr = (uintptr_t)(uring->recv_buffers +
+                          (size_t)id * SOCKET_URING_RECV_BUFFER_SIZE);
+  buf->len = SOCKET_URING_RECV_BUFFER_SIZE;
+  buf->bid = id;
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static void setup_multishot(SocketUring *uring) {
+  uring->recv_ring =
+      uring_buffer(SOCKET_URING_RECV_BUFFERS * sizeof(struct io_uring_buf));
+  uring->recv_buffers = uring_buffer((size_t)SOCKET_URING_RECV_BUFFERS *
+                                     SOCKET_URING_RECV_BUFFER_SIZE);
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uintptr_t)uring->recv_ring;
+  reg.ring_entries = SOCKET_URING_RECV_BUFFERS;
+  reg.bgid = 0;
+  uring_register(&uring->ring, IORING_REGISTER_PBUF_RING, &reg, 1);
+
+  for (uint16_t id = 0; id < SOCKET_URING_RECV_BUFFERS; ++id)
+    recycle_buffer(uring, id);
+  prep_multishot(uring);
+}
+
+void socket_uring_init(SocketUring *uring, int fd, struct SocketArgs *args) {
+  memset(uring, 0, sizeof(*uring));
+  uring_init(&uring->ring, 8, args->io == SOCKET_IO_SQPOLL);
+  uring->is_multishot = args->is_multishot;
+
+  uring_register(&uring->ring, IORING_REGISTER_FILES, &fd, 1);
+
+  uring->buffer_size = args->size;
+  uring->tx = uring_buffer(args->size);
+  uring->rx = uring_buffer(args->size);
+  struct iovec buffers[2] = {{.iov_base = uring->tx, .iov_len = args->size},
+                             {.iov_base = uring->rx, .iov_len = args->size}};
+  uring_register(&uring->ring, IORING_REGISTER_BUFFERS, buffers, 2);
+
+  if (uring->is_multishot)
+    setup_multishot(uring);
+}
+
+void socket_uring_close(SocketUring *uring) {
+  uring_close(&uring->ring);
+  uring_free(uring->tx, uring->buffer_size);
+  uring_free(uring->rx, uring->buffer_size);
+  if (uring->is_multishot) {
+    uring_free(uring->recv_ring,
+               SOCKET_URING_RECV_BUFFERS * sizeof(struct io_uring_buf));
+    uring_free(uring->recv_buffers, (size_t)SOCKET_URING_RECV_BUFFERS *
+                                        SOCKET_URING_RECV_BUFFER_SIZE);
+  }
+}
+
+void socket_uring_write(SocketUring *uring, size_t size) {
+  uring->tx_size = size;
+  uring->tx_done = 0;
+  prep_fixed(uring, IORING_OP_WRITE_FIXED, 0, uring->tx, size, URING_TX);
+}
+
+void socket_uring_read(SocketUring *uring, size_t size) {
+  uring->rx_size = size;
+  uring->rx_done = 0;
+  if (!uring->is_multishot)
+    prep_fixed(uring, IORING_OP_READ_FIXED, 1, uring->rx, size, URING_RX);
+}
+
+/* Bytes moved, or 0 if the transfer is to be retried as it was */
+static size_t transferred(int res, const char *operation) {
+  if (res > 0)
+    return res;
+  if ((res == -EAGAIN) || (res == -EINTR) || (res == -ENOBUFS))
+    return 0;
+  if (!res)
+    fprintf(stderr, "The peer hung up during %s!\n", operation);
+  else
+    fprintf(stderr, "%s: %s\n", operation, strerror(-res));
+  exit(EXIT_FAILURE);
+}
+
+static void receive_multishot(SocketUring *uring, struct io_uring_cqe *cqe) {
+  const size_t size = transferred(cqe->res, "recv()");
+
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    const uint16_t id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    if (uring->rx_done + size > uring->rx_size) {
+      fprintf(stderr, "Received %zu bytes more than expected!\n",
+              uring->rx_done + size - uring->rx_size);
+      exit(EXIT_FAILURE);
+    }
+    memcpy(uring->rx + uring->rx_done,
+           uring->recv_buffers + (size_t)id * SOCKET_URING_RECV_BUFFER_SIZE,
+           size);
+    uring->rx_done += size;
+    recycle_buffer(uring, id);
+  }
+  /* Ran out of buffers or was cancelled; post it again */
+  if (!(cqe->flags & IORING_CQE_F_MORE))
+    uring->is_armed = 0;
+}
+
+void socket_uring_complete(SocketUring *uring) {
+  while ((uring->tx_done < uring->tx_size) ||
+         (uring->rx_done < uring->rx_size)) {
+    if (uring->is_multishot && !uring->is_armed)
+      prep_multishot(uring);
+
+    /* All transfers in flight complete in the same wait */
+    const unsigned in_flight = (uring->tx_done < uring->tx_size) +
+                               (uring->rx_done < uring->rx_size);
+    struct io_uring_cqe *cqe = uring_submit_and_wait(&uring->ring, in_flight);
+    switch (cqe->user_data) {
+    case URING_TX:
+      uring->tx_done += transferred(cqe->res, "send()");
+      if (uring->tx_done < uring->tx_size)
+        prep_fixed(uring, IORING_OP_WRITE_FIXED, 0,
+                   uring->tx + uring->tx_done,
+                   uring->tx_size - uring->tx_done, URING_TX);
+      break;
+    case URING_RX:
+      uring->rx_done += transferred(cqe->res, "recv()");
+      if (uring->rx_done < uring->rx_size)
+        prep_fixed(uring, IORING_OP_READ_FIXED, 1,
+                   uring->rx + uring->rx_done,
+                   uring->rx_size - uring->rx_done, URING_RX);
+      break;
+    case URING_MULTISHOT:
+      receive_multishot(uring, cqe);
+      break;
+    }
+    uring_cqe_seen(&uring->ring);
+  }
+  uring->tx_size = uring->tx_done = 0;
+  uring->rx_size = uring->rx_done = 0;
+}
+
+void socket_uring_report(SocketUring *uring, uint64_t count) {
+  benchmark_tag("Socket I/O", "%s%s",
+                uring->ring.is_sqpoll ? "io_uring (SQPOLL)" : "io_uring",
+                uring->is_multishot ? ", multishot recv" : "");
+  benchmark_tag("io_uring enters per message", "%.3f",
+                (double)uring->ring.enter_count / count);
+  if (uring->is_multishot)
+    benchmark_tag("Multishot recv posts", "%" PRIu64, uring->arm_count);
+}
+
+/* IO_URING DATA END */
+
 static void socket_usage(const char *progname) {
   printf("Usage: %s [OPTION]...\n"
          "  -b <block_size> (default is %d)\n"
@@ -279,16 +1458,43 @@ static void socket_usage(const char *progname) {
          "  -M <shmem_backend>\n"
          "  -i <shmem_index> (default is 0)\n"
          "  -f <shmem_size_force>\n"
+         "  -m <local_shmem> without -M: memfd, memfd-2m, memfd-1g, posix, "
+         "hugetlbfs:<dir> or sysv (default is memfd)\n"
+         "  -n <numa_node> to bind local shared memory to\n"
+         "  -W: Map only the pages of the used -M slot (default is `false`)\n"
+         "  -j <threads>: Prefault the whole -M mapping with this many "
+         "threads\n"
          "  -d: Disable TCP_NODELAY (default is `enable`)\n"
          "  -C: Enable TCP_CORK (default is `disable`)\n"
          "  -w: Enable MSG_WAITALL (default is `disable`)\n"
          "  -N: Non-block mode (default is `false`)\n"
-         "  -D: Debug mode (default is `false`)\n",
+         "  -D: Debug mode (default is `false`)\n"
+         "  -X <interference_profile> (e.g., `stream:2@2-3,chase@4`)\n"
+         "  -P <server_cpu>,<client_cpu>: Pin both peers\n"
+         "  -F <priority>: SCHED_FIFO with mlockall (default is CFS)\n"
+         "  -H: Disable transparent hugepages (default is `false`)\n"
+         "  -u <io>: syscall, uring or sqpoll for the data (default is "
+         "syscall)\n"
+         "  -k: Keep a multishot recv posted on provided buffers (io_uring)"
+         "\n"
+         "  -z: Send with MSG_ZEROCOPY (socket-tcp)\n"
+         "  -Z: Receive with TCP_ZEROCOPY_RECEIVE (socket-tcp)\n"
+         "  -B <batch>: Stream in sendmmsg/recvmmsg batches of this many "
+         "(socket-udp)\n"
+         "  -t <timeout_us>: Longest wait for a batch to fill up (default is "
+         "0)\n"
+         "  -g <segment_size>: Cut messages into datagrams of this size "
+         "(socket-udp)\n"
+         "  -G: Disable UDP_SEGMENT and UDP_GRO for -g (default is "
+         "`enable`)\n"
+         "  -R <datagram_size>: Fragment messages reliably into datagrams of "
+         "this size (socket-udp)\n",
          progname, DEFAULT_MESSAGE_COUNT, DEFAULT_MESSAGE_SIZE,
          SOCKET_DEFAULT_SERVER_ADDR, SOCKET_DEFAULT_SERVER_PORT);
 }
-void socket_parse_args(SocketArgs *args, int argc, char *argv[]) {
-  int c;
+void socket_parse_args(SocketArgs *args, int argc, char *argv[],
+                       int caps) {
+  int c, io;
 
   args->count = DEFAULT_MESSAGE_COUNT;
   args->size = DEFAULT_MESSAGE_SIZE;
@@ -302,6 +1508,10 @@ void socket_parse_args(SocketArgs *args, int argc, char *argv[]) {
   args->shmem_backend = NULL;
   args->shmem_index = 0;
   args->shmem_size_force = 0;
+  args->shmem_local = "memfd";
+  args->shmem_node = -1;
+  args->is_window = 0;
+  args->prefault_threads = 0;
 
   args->is_nodelay = -1; // Enable by default
   args->is_cork = 0;
@@ -312,13 +1522,37 @@ void socket_parse_args(SocketArgs *args, int argc, char *argv[]) {
 
   args->is_debug = 0;
 
-  while ((c = getopt(argc, argv, "hdCwNDb:c:r:s:A:S:M:i:")) != -1) {
+  args->interference = NULL;
+
+  args->server_cpu = -1;
+  args->client_cpu = -1;
+
+  args->rt_priority = 0;
+  args->is_thp_disabled = 0;
+
+  args->io = SOCKET_IO_SYSCALL;
+  args->is_multishot = 0;
+
+  args->is_zerocopy_send = 0;
+  args->is_zerocopy_receive = 0;
+
+  args->batch_size = 0;
+  args->batch_timeout_us = 0;
+
+  args->segment_size = 0;
+  args->is_segment_offload = 1;
+
+  args->reliable_size = 0;
+
+  while ((c = getopt(argc, argv,
+                      "hdCwNDHWkzZGb:c:r:s:A:S:M:i:f:m:n:j:X:P:F:u:B:t:g:"
+                      "R:")) != -1) {
     switch (c) {
     case 'b': /* Block size */
-      args->size = atoi(optarg);
+      args->size = parse_size(optarg);
       break;
     case 'c': /* Count */
-      args->count = atoi(optarg);
+      args->count = parse_count(optarg);
       break;
 
     case 'r': /* SO_RCVBUF */
@@ -341,9 +1575,25 @@ void socket_parse_args(SocketArgs *args, int argc, char *argv[]) {
     case 'i': /* Memory index */
       args->shmem_index = atoi(optarg);
       break;
-    case 'f': /* Memory index */
+    case 'f': /* Forced size of shared memory backend */
       args->shmem_size_force = strtoul(optarg, NULL, 10);
       break;
+    case 'm': /* Kind of local shared memory */
+      args->shmem_local = optarg;
+      break;
+    case 'n': /* NUMA node of local shared memory */
+      args->shmem_node = atoi(optarg);
+      break;
+    case 'W': /* Window mapping of the backend */
+      args->is_window = 1;
+      break;
+    case 'j': /* Prefault threads */
+      args->prefault_threads = atoi(optarg);
+      if (args->prefault_threads < 0) {
+        fprintf(stderr, "Invalid prefault thread count %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
 
     case 'd': /* Disable TCP_NODELAY */
       args->is_nodelay = 0;
@@ -364,6 +1614,86 @@ void socket_parse_args(SocketArgs *args, int argc, char *argv[]) {
       args->is_debug = 1;
       break;
 
+    case 'X': /* Interference profile */
+      args->interference = optarg;
+      break;
+
+    case 'P': /* CPU pinning */
+      if ((sscanf(optarg, "%d,%d", &args->server_cpu, &args->client_cpu) !=
+           2) ||
+          (args->server_cpu < 0) || (args->client_cpu < 0)) {
+        fprintf(stderr, "-P expects <server_cpu>,<client_cpu>\n");
+        exit(EXIT_FAILURE);
+      }
+      break;
+
+    case 'F': /* SCHED_FIFO priority */
+      args->rt_priority = atoi(optarg);
+      if ((args->rt_priority < sched_get_priority_min(SCHED_FIFO)) ||
+          (args->rt_priority > sched_get_priority_max(SCHED_FIFO))) {
+        fprintf(stderr, "Invalid SCHED_FIFO priority %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'H': /* Disable THP */
+      args->is_thp_disabled = 1;
+      break;
+
+    case 'u': /* Socket I/O */
+      if ((io = socket_io_parse(optarg)) < 0) {
+        fprintf(stderr, "Unknown socket I/O \"%s\"\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      args->io = io;
+      break;
+    case 'k': /* Multishot recv */
+      args->is_multishot = 1;
+      break;
+
+    case 'z': /* MSG_ZEROCOPY */
+      args->is_zerocopy_send = 1;
+      break;
+    case 'Z': /* TCP_ZEROCOPY_RECEIVE */
+      args->is_zerocopy_receive = 1;
+      break;
+
+    case 'B': /* sendmmsg/recvmmsg batch */
+      args->batch_size = atoi(optarg);
+      if ((args->batch_size < 1) || (args->batch_size > UDP_BATCH_MAX_SIZE)) {
+        fprintf(stderr, "Batches hold 1 to %d datagrams\n",
+                UDP_BATCH_MAX_SIZE);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 't': /* Batch timeout */
+      args->batch_timeout_us = atoi(optarg);
+      if (args->batch_timeout_us < 0) {
+        fprintf(stderr, "Invalid batch timeout %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+
+    case 'g': /* UDP segment size */
+      args->segment_size = parse_size(optarg);
+      if (args->segment_size > UDP_MAX_PAYLOAD) {
+        fprintf(stderr, "Segments hold at most %d bytes\n", UDP_MAX_PAYLOAD);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'G': /* Disable GSO/GRO */
+      args->is_segment_offload = 0;
+      break;
+
+    case 'R': /* Reliable datagram size */
+      args->reliable_size = parse_size(optarg);
+      if ((args->reliable_size <= sizeof(UdpReliableHeader)) ||
+          (args->reliable_size > UDP_MAX_PAYLOAD)) {
+        fprintf(stderr, "Reliable datagrams hold %zu to %d bytes\n",
+                sizeof(UdpReliableHeader) + 1, UDP_MAX_PAYLOAD);
+        exit(EXIT_FAILURE);
+      }
+      break;
+
     case 'h': /* help */
     default:
       socket_usage(argv[0]);
@@ -371,4 +1701,73 @@ void socket_parse_args(SocketArgs *args, int argc, char *argv[]) {
       break;
     }
   }
+
+  if (args->rt_priority && (args->server_cpu >= 0) &&
+      (args->server_cpu == args->client_cpu))
+    warn("SCHED_FIFO peers sharing a CPU starve each other; Pin them "
+         "apart with -P");
+  if (((args->io != SOCKET_IO_SYSCALL) || args->is_multishot) &&
+      !(caps & SOCKET_CAP_URING)) {
+    fprintf(stderr, "Only socket-tcp and socket-udp move data through "
+                    "io_uring; Drop -u and -k\n");
+    exit(EXIT_FAILURE);
+  }
+  if ((args->is_zerocopy_send || args->is_zerocopy_receive) &&
+      !(caps & SOCKET_CAP_ZEROCOPY)) {
+    fprintf(stderr, "Only socket-tcp sends and receives zero-copy; Drop -z "
+                    "and -Z\n");
+    exit(EXIT_FAILURE);
+  }
+  if ((args->batch_size || args->batch_timeout_us) &&
+      !(caps & SOCKET_CAP_UDP_BATCH)) {
+    fprintf(stderr, "Only socket-udp sends and receives in batches; Drop -B "
+                    "and -t\n");
+    exit(EXIT_FAILURE);
+  }
+  if ((args->segment_size || !args->is_segment_offload) &&
+      !(caps & SOCKET_CAP_UDP_SEGMENT)) {
+    fprintf(stderr, "Only socket-udp cuts messages into segments; Drop -g "
+                    "and -G\n");
+    exit(EXIT_FAILURE);
+  }
+  if (args->reliable_size && !(caps & SOCKET_CAP_UDP_RELIABLE)) {
+    fprintf(stderr, "Only socket-udp fragments messages reliably; Drop "
+                    "-R\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (args->is_multishot && (args->io == SOCKET_IO_SYSCALL)) {
+    fprintf(stderr, "Multishot recv needs io_uring; Use -u uring\n");
+    args->io = SOCKET_IO_URING;
+  }
+  if ((args->is_zerocopy_send || args->is_zerocopy_receive) &&
+      (args->io != SOCKET_IO_SYSCALL)) {
+    fprintf(stderr, "Zero-copy modes run on the syscall path; Drop -u and "
+                    "-k\n");
+    exit(EXIT_FAILURE);
+  }
+  if (args->batch_timeout_us && !args->batch_size) {
+    fprintf(stderr, "A batch timeout needs batches; Ignore -t\n");
+    args->batch_timeout_us = 0;
+  }
+  if (args->batch_size && (args->io != SOCKET_IO_SYSCALL)) {
+    fprintf(stderr, "Batches run on the syscall path; Drop -u and -k\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!args->is_segment_offload && !args->segment_size) {
+    fprintf(stderr, "Only segments are offloaded; Ignore -G\n");
+    args->is_segment_offload = 1;
+  }
+  if (args->segment_size &&
+      (args->batch_size || (args->io != SOCKET_IO_SYSCALL))) {
+    fprintf(stderr, "Segments are sent one message at a time on the syscall "
+                    "path; Drop -B, -u and -k\n");
+    exit(EXIT_FAILURE);
+  }
+  if (args->reliable_size && (args->segment_size || args->batch_size ||
+                              (args->io != SOCKET_IO_SYSCALL))) {
+    fprintf(stderr, "Reliable fragments go one at a time on the syscall "
+                    "path; Drop -g, -B, -u and -k\n");
+    exit(EXIT_FAILURE);
+  }
 }
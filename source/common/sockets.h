@@ -5,6 +5,10 @@
 #include <stdbool.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+
+#include "common/benchmarks.h"
+#include "common/uring.h"
 
 /******************** DEFINITIONS ********************/
 
@@ -40,9 +44,35 @@ int set_io_flag(int socket_fd, int flag);
 
 int receive(int connection, void *buffer, int size, int busy_waiting);
 
+/**
+ * Sends `size` bytes of `data` over a Unix-domain socket, with `fd` attached
+ * as SCM_RIGHTS ancillary data unless it is negative.
+ */
+void socket_send_fd(int socket_fd, const void *data, size_t size, int fd);
+/* Same, but returns -1 instead of failing if the peer has hung up */
+int socket_try_send_fd(int socket_fd, const void *data, size_t size, int fd);
+
+/**
+ * Receives exactly `size` bytes of `data` from a Unix-domain socket.
+ *
+ * \return The attached file descriptor, -1 if there was none.
+ */
+int socket_recv_fd(int socket_fd, void *data, size_t size);
+
+/* How socket-tcp and socket-udp move their data */
+typedef enum SocketIo {
+  /* One recv()/send() per transfer */
+  SOCKET_IO_SYSCALL,
+  /* Registered buffers and fd, one io_uring_enter() per round trip */
+  SOCKET_IO_URING,
+  /* Same, with a kernel thread submitting and the CQ ring polled */
+  SOCKET_IO_SQPOLL,
+} SocketIo;
+const char *socket_io_name(SocketIo io);
+
 typedef struct SocketArgs {
-  int count;
-  int size;
+  uint64_t count;
+  size_t size;
 
   int rcvbuf_size;
   int sndbuf_size;
@@ -53,6 +83,10 @@ typedef struct SocketArgs {
   const char *shmem_backend;
   int shmem_index;
   size_t shmem_size_force;
+  const char *shmem_local;
+  int shmem_node;
+  int is_window;
+  int prefault_threads;
 
   int is_nodelay;
   int is_cork;
@@ -62,8 +96,45 @@ typedef struct SocketArgs {
   int is_nonblock;
 
   int is_debug;
+
+  const char *interference;
+
+  int server_cpu;
+  int client_cpu;
+
+  int rt_priority;
+  int is_thp_disabled;
+
+  SocketIo io;
+  /* io_uring: keep a multishot recv posted on provided buffers */
+  int is_multishot;
+
+  /* socket-tcp: MSG_ZEROCOPY sends and TCP_ZEROCOPY_RECEIVE receives */
+  int is_zerocopy_send;
+  int is_zerocopy_receive;
+
+  /* socket-udp: stream in sendmmsg()/recvmmsg() batches of this many */
+  int batch_size;
+  /* How long a batch may wait to fill up */
+  int batch_timeout_us;
+
+  /* socket-udp: cut messages into datagrams of this size */
+  size_t segment_size;
+  /* Hand the datagrams to UDP_SEGMENT and UDP_GRO */
+  int is_segment_offload;
+
+  /* socket-udp: reliable fragments in datagrams of this size */
+  size_t reliable_size;
 } SocketArgs;
-void socket_parse_args(SocketArgs *args, int argc, char *argv[]);
+/* Options that only some of the socket binaries implement */
+#define SOCKET_CAP_URING (1 << 0) /* -u, -k */
+#define SOCKET_CAP_ZEROCOPY (1 << 1) /* -z, -Z */
+#define SOCKET_CAP_UDP_BATCH (1 << 2) /* -B, -t */
+#define SOCKET_CAP_UDP_SEGMENT (1 << 3) /* -g, -G */
+#define SOCKET_CAP_UDP_RELIABLE (1 << 4) /* -R */
+
+/* Options outside `caps` are usage errors */
+void socket_parse_args(SocketArgs *args, int argc, char *argv[], int caps);
 
 void socket_tcp_read_data(int fd, void *buffer, size_t size,
                           struct SocketArgs *args);
@@ -77,6 +148,239 @@ void socket_udp_write_data(int fd, void *buffer, size_t size,
                            const struct sockaddr_in *peer_addr,
                            socklen_t sock_len, struct SocketArgs *args);
 
+#define UDP_BATCH_MAX_SIZE 1024
+
+/* The payload of a single IPv4 datagram */
+#define UDP_MAX_PAYLOAD 65507
+/* What UDP_SEGMENT has taken per send() since it came with Linux 4.18 */
+#define UDP_SEGMENT_MAX_COUNT 64
+
+/**
+ * Batched UDP on a connected socket. Queued datagrams go out in a single
+ * sendmmsg() once the batch is full or its oldest datagram has waited for
+ * the timeout; the timeout is only checked when queueing, so flush before
+ * blocking on anything else. recvmmsg() takes whatever has arrived, up to a
+ * batch, and keeps collecting until the batch is full or the timeout is up.
+ */
+typedef struct UdpBatch {
+  int fd;
+  int capacity;
+  int timeout_us;
+
+  struct mmsghdr *messages;
+  struct iovec *iovecs;
+  void *buffers;
+  size_t size;
+
+  int queued;
+  bench_t first_queued;
+
+  /* sendmmsg() or recvmmsg() calls and the datagrams they moved */
+  uint64_t call_count;
+  uint64_t message_count;
+} UdpBatch;
+
+/* Sets up batches of `args->batch_size` datagrams of up to `size` bytes */
+void udp_batch_init(UdpBatch *batch, int fd, size_t size,
+                    struct SocketArgs *args);
+void udp_batch_close(UdpBatch *batch);
+
+/* The buffer of the next datagram to queue */
+void *udp_batch_acquire(UdpBatch *batch);
+/* Queues `size` bytes of the acquired buffer, sending the batch if due */
+void udp_batch_send(UdpBatch *batch, size_t size);
+/* Sends whatever is queued */
+void udp_batch_flush(UdpBatch *batch);
+
+/* Receives a batch; returns how many datagrams it holds */
+int udp_batch_receive(UdpBatch *batch);
+/* Datagram `index` of the last batch received and its length */
+void *udp_batch_message(UdpBatch *batch, int index, size_t *size);
+
+/**
+ * Messages cut into UDP datagrams of a fixed segment size on a connected
+ * socket. With offload, each send() hands up to UDP_SEGMENT_MAX_COUNT
+ * segments to UDP_SEGMENT, so they travel the stack as one GSO packet, and
+ * UDP_GRO lets a recvmsg() return segments that arrive as one packet
+ * together. Without, every datagram takes its own syscall.
+ */
+typedef struct UdpSegments {
+  int fd;
+  int is_offload;
+  size_t segment_size;
+  /* The most a single send() takes */
+  size_t send_size;
+
+  uint64_t send_count;
+  uint64_t sent_segments;
+  uint64_t receive_count;
+  uint64_t received_segments;
+} UdpSegments;
+
+void udp_segments_init(UdpSegments *segments, int fd,
+                       struct SocketArgs *args);
+
+void udp_segments_write(UdpSegments *segments, void *buffer, size_t size,
+                        struct SocketArgs *args);
+void udp_segments_read(UdpSegments *segments, void *buffer, size_t size,
+                       struct SocketArgs *args);
+/* Tags how many datagrams went through each syscall */
+void udp_segments_report(UdpSegments *segments);
+
+/**
+ * Messages of any size over UDP, cut into numbered fragments on a connected
+ * socket. The sender sends a window of unacknowledged fragments at a time,
+ * the last one asking for a selective acknowledgment, and resends whatever
+ * that shows missing. If none comes within the retransmission timeout, it
+ * resends just the last fragment to ask again. The receiver puts fragments
+ * at their offsets in whatever order they come, and either side answers
+ * while it sends, so both directions can be in flight at once.
+ */
+typedef struct UdpReliable {
+  int fd;
+  /* Payload bytes per fragment and fragments per window */
+  size_t fragment_size;
+  uint32_t window;
+  size_t max_size;
+
+  /* The SACK being built and what arrives when its place is unknown */
+  void *sack;
+  void *scratch;
+
+  const void *tx;
+  size_t tx_size;
+  uint32_t tx_message;
+  uint32_t tx_count;
+  uint32_t tx_burst;
+  uint32_t tx_base;
+  uint32_t tx_acked_count;
+  uint8_t *tx_acked;
+  uint8_t *tx_sent;
+
+  void *rx;
+  uint32_t rx_message;
+  uint32_t rx_count;
+  uint32_t rx_base;
+  uint32_t rx_next;
+  uint32_t rx_received;
+  size_t rx_bytes;
+  uint8_t *rx_have;
+
+  /* Retransmission timeout from the smoothed round trip, in ns */
+  bench_t srtt;
+  bench_t rttvar;
+  bench_t rto;
+
+  uint64_t sent_count;
+  uint64_t retransmit_count;
+  uint64_t loss_count;
+  uint64_t timeout_count;
+  uint64_t reorder_count;
+  uint64_t duplicate_count;
+} UdpReliable;
+
+/* Sets up messages of up to `args->size` in `args->reliable_size` datagrams */
+void udp_reliable_init(UdpReliable *reliable, int fd, struct SocketArgs *args);
+/* Keeps answering until the peer goes quiet, in case it missed a SACK */
+void udp_reliable_close(UdpReliable *reliable);
+
+/* Returns once the peer has acknowledged all `size` bytes of `buffer` */
+void udp_reliable_write(UdpReliable *reliable, const void *buffer,
+                        size_t size);
+/* The next message, valid until the next write or read */
+void *udp_reliable_read(UdpReliable *reliable, size_t size);
+/* Tags the loss, retransmit and reorder counters */
+void udp_reliable_report(UdpReliable *reliable);
+
+/**
+ * Zero-copy TCP. MSG_ZEROCOPY sends pin the user pages, and the kernel
+ * reports on the error queue once it has let go of them; the buffer must
+ * not be written before. TCP_ZEROCOPY_RECEIVE maps whole received pages
+ * into a window on the socket instead of copying them; what does not fill
+ * a page is read the usual way.
+ */
+typedef struct TcpZerocopy {
+  int fd;
+  int is_send;
+
+  /* MSG_ZEROCOPY sends, those the kernel has completed and copied anyway */
+  uint64_t send_count;
+  uint64_t completed_count;
+  uint64_t copied_count;
+
+  void *window;
+  size_t window_size;
+  /* The pieces of the last message read: mapped pages and copied bytes */
+  struct iovec *parts;
+  int part_count;
+  uint64_t mapped_bytes;
+  uint64_t received_bytes;
+} TcpZerocopy;
+
+/* Enables the -z and -Z modes of `args` on `fd` for messages of `size` */
+void tcp_zerocopy_init(TcpZerocopy *zc, int fd, size_t size,
+                       struct SocketArgs *args);
+void tcp_zerocopy_close(TcpZerocopy *zc);
+
+/* Like socket_tcp_write_data(); the buffer stays in use until flushed */
+void tcp_zerocopy_write(TcpZerocopy *zc, void *buffer, size_t size,
+                        struct SocketArgs *args);
+/* Waits until the kernel has let go of every buffer sent so far */
+void tcp_zerocopy_flush(TcpZerocopy *zc);
+/**
+ * Like socket_tcp_read_data(), but leaves whatever it can map in the window
+ * and only copies the rest into `buffer`, at its offset in the message.
+ *
+ * \return The pieces of the message in order, `*count` of them, valid until
+ *         the next read.
+ */
+const struct iovec *tcp_zerocopy_read(TcpZerocopy *zc, void *buffer,
+                                      size_t size, int *count,
+                                      struct SocketArgs *args);
+/* Tags how much of the traffic actually went without a copy */
+void tcp_zerocopy_report(TcpZerocopy *zc);
+
+#define SOCKET_URING_RECV_BUFFERS 64
+#define SOCKET_URING_RECV_BUFFER_SIZE (64 << 10)
+
+/**
+ * A connected socket behind an io_uring. The fd and both buffers are
+ * registered, so that fixed reads and writes skip the per-call lookups.
+ * Queued transfers go to the kernel together, and short ones are resumed
+ * until complete. With multishot, one recv stays posted and the kernel picks
+ * a provided buffer per completion, which is then copied to `rx`.
+ */
+typedef struct SocketUring {
+  Uring ring;
+  int is_multishot;
+
+  void *tx;
+  void *rx;
+  size_t buffer_size;
+
+  size_t tx_size;
+  size_t tx_done;
+  size_t rx_size;
+  size_t rx_done;
+
+  struct io_uring_buf_ring *recv_ring;
+  void *recv_buffers;
+  int is_armed;
+  uint64_t arm_count;
+} SocketUring;
+
+/* Sets `fd` up as fixed file 0 and `tx`/`rx` of `args->size` as buffers */
+void socket_uring_init(SocketUring *uring, int fd, struct SocketArgs *args);
+void socket_uring_close(SocketUring *uring);
+
+/* Queue sending `size` bytes of `tx` or receiving as many into `rx` */
+void socket_uring_write(SocketUring *uring, size_t size);
+void socket_uring_read(SocketUring *uring, size_t size);
+/* Submits everything queued and waits until all of it has been moved */
+void socket_uring_complete(SocketUring *uring);
+/* Tags the I/O mode and what the ring cost in syscalls */
+void socket_uring_report(SocketUring *uring, uint64_t count);
+
 #define SOCKET_DEFAULT_SERVER_ADDR "127.0.0.1"
 #define SOCKET_DEFAULT_SERVER_PORT 12345
 
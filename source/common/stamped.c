@@ -0,0 +1,40 @@
+#include <string.h>
+
+#include <x86gprintrin.h>
+
+#include "common/stamped.h"
+
+size_t stamped_size(size_t size) {
+  return (size + STAMPED_LINE_DATA - 1) / STAMPED_LINE_DATA *
+         sizeof(StampedLine);
+}
+
+__attribute__((hot)) void stamped_fill(void *lines, int byte, size_t size,
+                                       uint32_t stamp, PublishFence fence) {
+  StampedLine *line = lines;
+
+  for (size_t offset = 0; offset < size;
+       offset += STAMPED_LINE_DATA, ++line) {
+    const size_t length = (size - offset < STAMPED_LINE_DATA)
+                              ? size - offset
+                              : STAMPED_LINE_DATA;
+    memset(line->data, byte, length);
+    shm_publish(&line->stamp, stamp, fence);
+  }
+}
+
+__attribute__((hot)) void stamped_read(void *data, void *lines, size_t size,
+                                       uint32_t stamp) {
+  StampedLine *line = lines;
+
+  for (size_t offset = 0; offset < size;
+       offset += STAMPED_LINE_DATA, ++line) {
+    const size_t length = (size - offset < STAMPED_LINE_DATA)
+                              ? size - offset
+                              : STAMPED_LINE_DATA;
+    /* The writer is at most a few lines ahead; no doorbell to wait for */
+    while (shm_consume(&line->stamp) != stamp)
+      __pause();
+    memcpy(data + offset, line->data, length);
+  }
+}
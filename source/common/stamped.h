@@ -0,0 +1,34 @@
+#ifndef IPC_BENCH_STAMPED_H
+#define IPC_BENCH_STAMPED_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common/layout.h"
+#include "common/publish.h"
+
+/**
+ * FaRM-style stamped lines: every cache line of a stamped buffer carries
+ * STAMPED_LINE_DATA payload bytes and, in its last word, the stamp of the
+ * message they belong to. A line's bytes are published by its stamp, so the
+ * reader copies each line as soon as its stamp shows up, while the writer is
+ * still busy with the lines behind it; no guard waits for the whole message.
+ * Stamps must differ from message to message, and 0 is a cleared buffer's.
+ */
+#define STAMPED_LINE_DATA (LAYOUT_CACHE_LINE_SIZE - sizeof(uint32_t))
+
+typedef struct StampedLine {
+  uint8_t data[STAMPED_LINE_DATA];
+  uint32_t stamp;
+} __attribute__((aligned(LAYOUT_CACHE_LINE_SIZE))) StampedLine;
+
+/* Bytes of the stamped lines that hold `size` payload bytes */
+size_t stamped_size(size_t size);
+
+/* Sets `size` payload bytes to `byte`, line by line, under `stamp` */
+void stamped_fill(void *lines, int byte, size_t size, uint32_t stamp,
+                  PublishFence fence);
+/* Copies `size` payload bytes out, each line once it carries `stamp` */
+void stamped_read(void *data, void *lines, size_t size, uint32_t stamp);
+
+#endif /* IPC_BENCH_STAMPED_H */
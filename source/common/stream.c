@@ -0,0 +1,78 @@
+#include <x86gprintrin.h>
+
+#include "common/stream.h"
+
+void shm_stream_init(ShmStream *stream, uint32_t **guards, void **buffers,
+                     int buffer_count) {
+  for (int i = 0; i < buffer_count; ++i) {
+    stream->guards[i] = guards[i];
+    stream->buffers[i] = buffers[i];
+  }
+  stream->buffer_count = buffer_count;
+  stream->sequence = 0;
+
+  stream->wait = NULL;
+  stream->notify = NULL;
+  stream->context = NULL;
+
+  stream->fence = FENCE_NONE;
+}
+
+void shm_stream_set_doorbell(ShmStream *stream, ShmStreamWait wait,
+                             ShmStreamNotify notify, void *context) {
+  stream->wait = wait;
+  stream->notify = notify;
+  stream->context = context;
+}
+
+void shm_stream_set_fence(ShmStream *stream, PublishFence fence) {
+  stream->fence = fence;
+}
+
+static inline uint32_t round_of(ShmStream *stream) {
+  return (uint32_t)(stream->sequence / stream->buffer_count);
+}
+
+static inline int index_of(ShmStream *stream) {
+  return stream->sequence % stream->buffer_count;
+}
+
+static inline void wait_for(ShmStream *stream, uint32_t *guard,
+                            uint32_t expect) {
+  if (stream->wait) {
+    stream->wait(guard, expect, stream->context);
+    return;
+  }
+  while (shm_consume(guard) != expect)
+    __pause();
+}
+
+static inline void hand_over(ShmStream *stream, uint32_t *guard,
+                             uint32_t value) {
+  shm_publish(guard, value, stream->fence);
+  if (stream->notify)
+    stream->notify(stream->context);
+  ++stream->sequence;
+}
+
+void *shm_stream_acquire(ShmStream *stream) {
+  const int index = index_of(stream);
+  wait_for(stream, stream->guards[index], 2 * round_of(stream));
+  return stream->buffers[index];
+}
+
+void shm_stream_publish(ShmStream *stream) {
+  const int index = index_of(stream);
+  hand_over(stream, stream->guards[index], 2 * round_of(stream) + 1);
+}
+
+void *shm_stream_receive(ShmStream *stream) {
+  const int index = index_of(stream);
+  wait_for(stream, stream->guards[index], 2 * round_of(stream) + 1);
+  return stream->buffers[index];
+}
+
+void shm_stream_release(ShmStream *stream) {
+  const int index = index_of(stream);
+  hand_over(stream, stream->guards[index], 2 * round_of(stream) + 2);
+}
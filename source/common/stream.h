@@ -0,0 +1,63 @@
+#ifndef IPC_BENCH_STREAM_H
+#define IPC_BENCH_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common/layout.h"
+#include "common/publish.h"
+
+/**
+ * One direction of a streaming transfer through shared buffers, used round
+ * robin. Each buffer's guard counts handoffs: 2r means the buffer is free
+ * for round r, 2r + 1 that round r's message is in it. Unlike the
+ * ping-pong guards, the producer can run ahead of the consumer by as many
+ * messages as there are buffers.
+ */
+/* Blocks until `*guard` == `expect`; see shm_stream_set_doorbell() */
+typedef void (*ShmStreamWait)(uint32_t *guard, uint32_t expect,
+                              void *context);
+/* Tells the peer that a guard changed */
+typedef void (*ShmStreamNotify)(void *context);
+
+typedef struct ShmStream {
+  uint32_t *guards[LAYOUT_MAX_BUFFERS];
+  void *buffers[LAYOUT_MAX_BUFFERS];
+  int buffer_count;
+
+  /* Messages produced or consumed so far by this side */
+  uint64_t sequence;
+
+  /* NULL: spin on the guards, without notifications */
+  ShmStreamWait wait;
+  ShmStreamNotify notify;
+  void *context;
+
+  /* FENCE_NONE unless set with shm_stream_set_fence() */
+  PublishFence fence;
+} ShmStream;
+
+void shm_stream_init(ShmStream *stream, uint32_t **guards, void **buffers,
+                     int buffer_count);
+/**
+ * Replaces spinning by an interrupt-driven wait. `wait` must re-check the
+ * guard after each wake-up, since a single interrupt may stand for several
+ * guard changes.
+ */
+void shm_stream_set_doorbell(ShmStream *stream, ShmStreamWait wait,
+                             ShmStreamNotify notify, void *context);
+
+/* Orders the payload before each guard store with `fence` */
+void shm_stream_set_fence(ShmStream *stream, PublishFence fence);
+
+/* Producer: waits until the next buffer is free and returns it */
+void *shm_stream_acquire(ShmStream *stream);
+/* Producer: hands the acquired buffer to the consumer */
+void shm_stream_publish(ShmStream *stream);
+
+/* Consumer: waits until the next message arrives and returns its buffer */
+void *shm_stream_receive(ShmStream *stream);
+/* Consumer: gives the received buffer back to the producer */
+void shm_stream_release(ShmStream *stream);
+
+#endif /* IPC_BENCH_STREAM_H */
@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common/benchmarks.h"
+#include "common/topology.h"
+#include "common/utility.h"
+
+#define SYSFS_CPU_PATH "/sys/devices/system/cpu"
+
+static const char *placement_names[PLACEMENT_COUNT] = {
+    "same-cpu", "smt", "same-llc", "cross-llc", "cross-node"};
+
+const char *placement_name(Placement placement) {
+  return placement_names[placement];
+}
+
+/* Returns the first CPU of a "0-3,8-11" style list, or -1 */
+static int read_first_cpu(const char *path) {
+  int cpu = -1;
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return -1;
+  if (fscanf(file, "%d", &cpu) != 1)
+    cpu = -1;
+  fclose(file);
+  return cpu;
+}
+
+static int read_llc(int cpu) {
+  char path[256];
+  int llc = -1;
+
+  /* The highest cache index is the last level */
+  for (int index = 0;; ++index) {
+    snprintf(path, sizeof(path),
+             SYSFS_CPU_PATH "/cpu%d/cache/index%d/shared_cpu_list", cpu,
+             index);
+    int first = read_first_cpu(path);
+    if (first < 0)
+      break;
+    llc = first;
+  }
+
+  return llc;
+}
+
+static int read_node(int cpu) {
+  char path[256];
+  struct dirent *entry;
+  int node = 0;
+
+  snprintf(path, sizeof(path), SYSFS_CPU_PATH "/cpu%d", cpu);
+  DIR *directory = opendir(path);
+  if (!directory)
+    return 0;
+  while ((entry = readdir(directory)))
+    if (sscanf(entry->d_name, "node%d", &node) == 1)
+      break;
+  closedir(directory);
+
+  return node;
+}
+
+int topology_read(CpuTopology *cpus, int max) {
+  char path[256];
+  int count = 0;
+
+  for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS && count < max; ++cpu) {
+    snprintf(path, sizeof(path),
+             SYSFS_CPU_PATH "/cpu%d/topology/thread_siblings_list", cpu);
+    int core = read_first_cpu(path);
+    if (core < 0)
+      continue; /* Offline or absent */
+
+    cpus[count].cpu = cpu;
+    cpus[count].core = core;
+    cpus[count].llc = read_llc(cpu);
+    cpus[count].node = read_node(cpu);
+    ++count;
+  }
+
+  return count;
+}
+
+static const CpuTopology *find_cpu(const CpuTopology *cpus, int count,
+                                   int cpu) {
+  for (int i = 0; i < count; ++i)
+    if (cpus[i].cpu == cpu)
+      return &cpus[i];
+  return NULL;
+}
+
+Placement topology_classify(const CpuTopology *cpus, int count, int a, int b) {
+  const CpuTopology *left = find_cpu(cpus, count, a);
+  const CpuTopology *right = find_cpu(cpus, count, b);
+
+  if (a == b)
+    return PLACEMENT_SAME_CPU;
+  if (!left || !right) {
+    fprintf(stderr, "CPU %d or %d is not online!\n", a, b);
+    exit(EXIT_FAILURE);
+  }
+
+  if (left->core == right->core)
+    return PLACEMENT_SMT;
+  if (left->llc == right->llc)
+    return PLACEMENT_SAME_LLC;
+  if (left->node == right->node)
+    return PLACEMENT_CROSS_LLC;
+  return PLACEMENT_CROSS_NODE;
+}
+
+int topology_find_pair(const CpuTopology *cpus, int count,
+                       Placement placement, int *a, int *b) {
+  for (int i = 0; i < count; ++i)
+    for (int j = (placement == PLACEMENT_SAME_CPU) ? i : i + 1; j < count;
+         ++j)
+      if (topology_classify(cpus, count, cpus[i].cpu, cpus[j].cpu) ==
+          placement) {
+        *a = cpus[i].cpu;
+        *b = cpus[j].cpu;
+        return 0;
+      }
+
+  return -1;
+}
+
+void pin_placement(int own_cpu, int server_cpu, int client_cpu) {
+  CpuTopology cpus[TOPOLOGY_MAX_CPUS];
+
+  if (own_cpu < 0)
+    return;
+  pin_thread(own_cpu);
+
+  if (server_cpu < 0 || client_cpu < 0)
+    return;
+  int count = topology_read(cpus, TOPOLOGY_MAX_CPUS);
+  benchmark_tag("Placement", "%s (cpu %d <-> cpu %d)",
+                placement_name(
+                    topology_classify(cpus, count, server_cpu, client_cpu)),
+                server_cpu, client_cpu);
+}
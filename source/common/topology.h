@@ -0,0 +1,50 @@
+#ifndef IPC_BENCH_TOPOLOGY_H
+#define IPC_BENCH_TOPOLOGY_H
+
+/* Relation between the CPUs the server and the client are pinned to */
+typedef enum Placement {
+  PLACEMENT_SAME_CPU,
+  PLACEMENT_SMT,        /* Hyper-thread siblings of one core */
+  PLACEMENT_SAME_LLC,   /* Different cores sharing the last-level cache */
+  PLACEMENT_CROSS_LLC,  /* Different LLCs on the same NUMA node */
+  PLACEMENT_CROSS_NODE, /* Different NUMA nodes */
+  PLACEMENT_COUNT
+} Placement;
+
+typedef struct CpuTopology {
+  int cpu;
+  /* Lowest CPU number among the siblings sharing the resource */
+  int core;
+  int llc;
+  int node;
+} CpuTopology;
+
+#define TOPOLOGY_MAX_CPUS 1024
+
+/**
+ * Reads /sys/devices/system/cpu for all online CPUs.
+ *
+ * \return The number of entries written to `cpus`.
+ */
+int topology_read(CpuTopology *cpus, int max);
+
+Placement topology_classify(const CpuTopology *cpus, int count, int a, int b);
+
+/**
+ * Finds a CPU pair of the given placement, preferring the lowest CPU numbers.
+ *
+ * \return 0 on success, -1 if the machine has no such pair.
+ */
+int topology_find_pair(const CpuTopology *cpus, int count,
+                       Placement placement, int *a, int *b);
+
+const char *placement_name(Placement placement);
+
+/**
+ * Pins the calling thread to `own_cpu` (unless negative) and tags the results
+ * with the placement of the server/client CPU pair. Call it before allocating
+ * anything, so that first touch places the memory on the local node.
+ */
+void pin_placement(int own_cpu, int server_cpu, int client_cpu);
+
+#endif /* IPC_BENCH_TOPOLOGY_H */
@@ -0,0 +1,182 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <x86gprintrin.h>
+
+#include "common/uring.h"
+
+/* How long an SQPOLL thread spins for new submissions before it sleeps */
+#define URING_SQPOLL_IDLE_MS 1000
+
+static void *map_ring(int fd, size_t size, off_t offset) {
+  void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, offset);
+  if (memory == MAP_FAILED) {
+    perror("mmap(io_uring)");
+    exit(EXIT_FAILURE);
+  }
+  return memory;
+}
+
+void uring_init(Uring *ring, unsigned entries, int is_sqpoll) {
+  struct io_uring_params params;
+
+  memset(&params, 0, sizeof(params));
+  if (is_sqpoll) {
+    params.flags |= IORING_SETUP_SQPOLL;
+    params.sq_thread_idle = URING_SQPOLL_IDLE_MS;
+  }
+  if ((ring->fd = syscall(__NR_io_uring_setup, entries, &params)) < 0) {
+    perror("io_uring_setup()");
+    exit(EXIT_FAILURE);
+  }
+  ring->is_sqpoll = is_sqpoll;
+
+  ring->sq_ring_size =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->sq_ring = map_ring(ring->fd, ring->sq_ring_size, IORING_OFF_SQ_RING);
+  ring->sq_head = ring->sq_ring + params.sq_off.head;
+  ring->sq_tail = ring->sq_ring + params.sq_off.tail;
+  ring->sq_mask = ring->sq_ring + params.sq_off.ring_mask;
+  ring->sq_flags = ring->sq_ring + params.sq_off.flags;
+  ring->sq_array = ring->sq_ring + params.sq_off.array;
+  ring->sq_entries = params.sq_entries;
+  ring->sq_local_tail = *ring->sq_tail;
+  ring->sq_pending = 0;
+
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = map_ring(ring->fd, ring->sqes_size, IORING_OFF_SQES);
+
+  ring->cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->cq_ring = map_ring(ring->fd, ring->cq_ring_size, IORING_OFF_CQ_RING);
+  ring->cq_head = ring->cq_ring + params.cq_off.head;
+  ring->cq_tail = ring->cq_ring + params.cq_off.tail;
+  ring->cq_mask = ring->cq_ring + params.cq_off.ring_mask;
+  ring->cqes = ring->cq_ring + params.cq_off.cqes;
+
+  ring->enter_count = 0;
+}
+
+void uring_close(Uring *ring) {
+  if (munmap(ring->sqes, ring->sqes_size) ||
+      munmap(ring->sq_ring, ring->sq_ring_size) ||
+      munmap(ring->cq_ring, ring->cq_ring_size)) {
+    perror("munmap(io_uring)");
+    exit(EXIT_FAILURE);
+  }
+  if (close(ring->fd)) {
+    perror("close()");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void enter(Uring *ring, unsigned to_submit, unsigned min_complete,
+                  unsigned flags) {
+  ++ring->enter_count;
+  while (syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete,
+                 flags, NULL, 0) < 0)
+    if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY)) {
+      perror("io_uring_enter()");
+      exit(EXIT_FAILURE);
+    }
+}
+
+struct io_uring_sqe *uring_get_sqe(Uring *ring) {
+  const unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+  if (ring->sq_local_tail - head >= ring->sq_entries) {
+    fprintf(stderr, "The io_uring submission queue is full!\n");
+    exit(EXIT_FAILURE);
+  }
+
+  const unsigned index = ring->sq_local_tail++ & *ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sq_array[index] = index;
+  ++ring->sq_pending;
+  return sqe;
+}
+
+/* Makes the prepared SQEs visible to the kernel; returns how many */
+static unsigned publish_tail(Uring *ring) {
+  const unsigned pending = ring->sq_pending;
+
+  ring->sq_pending = 0;
+  if (pending)
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+  return pending;
+}
+
+static void wake_sq_thread(Uring *ring) {
+  /* The new tail must be visible before the thread's state is read */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(ring->sq_flags, __ATOMIC_RELAXED) &
+      IORING_SQ_NEED_WAKEUP)
+    enter(ring, 0, 0, IORING_ENTER_SQ_WAKEUP);
+}
+
+void uring_submit(Uring *ring) {
+  const unsigned pending = publish_tail(ring);
+
+  if (!pending)
+    return;
+  if (!ring->is_sqpoll)
+    enter(ring, pending, 0, 0);
+  else
+    wake_sq_thread(ring);
+}
+
+struct io_uring_cqe *uring_peek_cqe(Uring *ring) {
+  const unsigned head = *ring->cq_head;
+
+  if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    return NULL;
+  return &ring->cqes[head & *ring->cq_mask];
+}
+
+struct io_uring_cqe *uring_wait_cqe(Uring *ring) {
+  struct io_uring_cqe *cqe;
+
+  while (!(cqe = uring_peek_cqe(ring)))
+    enter(ring, 0, 1, IORING_ENTER_GETEVENTS);
+  return cqe;
+}
+
+struct io_uring_cqe *uring_submit_and_wait(Uring *ring, unsigned wait_nr) {
+  struct io_uring_cqe *cqe;
+
+  if (ring->is_sqpoll) {
+    if (publish_tail(ring))
+      wake_sq_thread(ring);
+    while (!(cqe = uring_peek_cqe(ring)))
+      __pause();
+    return cqe;
+  }
+
+  /* Submit and wait in one go, or only submit if a completion is there */
+  for (unsigned pending = publish_tail(ring);
+       !(cqe = uring_peek_cqe(ring)) || pending; pending = 0)
+    enter(ring, pending, cqe ? 0 : wait_nr, IORING_ENTER_GETEVENTS);
+  return cqe;
+}
+
+void uring_cqe_seen(Uring *ring) {
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+void uring_register(Uring *ring, unsigned opcode, const void *arg,
+                    unsigned count) {
+  if (syscall(__NR_io_uring_register, ring->fd, opcode, arg, count) < 0) {
+    perror("io_uring_register()");
+    exit(EXIT_FAILURE);
+  }
+}
@@ -0,0 +1,69 @@
+#ifndef IPC_BENCH_URING_H
+#define IPC_BENCH_URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <linux/io_uring.h>
+
+/**
+ * A bare io_uring on the raw syscalls (no liburing): one submission and one
+ * completion ring, mapped into userspace. Completions are found by polling
+ * the CQ ring, so a waiter that spins on uring_peek_cqe() never enters the
+ * kernel; with SQPOLL, a kernel thread also picks up submissions by itself.
+ */
+typedef struct Uring {
+  int fd;
+  int is_sqpoll;
+
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_flags;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned sq_entries;
+  /* Prepared by uring_get_sqe(), not yet handed to the kernel */
+  unsigned sq_local_tail;
+  unsigned sq_pending;
+
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+
+  /* io_uring_enter() calls, i.e. what the ring cost in syscalls */
+  uint64_t enter_count;
+} Uring;
+
+void uring_init(Uring *ring, unsigned entries, int is_sqpoll);
+void uring_close(Uring *ring);
+
+/* A zeroed SQE to fill in; fails if the submission queue is full */
+struct io_uring_sqe *uring_get_sqe(Uring *ring);
+/* Hands the prepared SQEs over; with SQPOLL, only wakes an idle thread */
+void uring_submit(Uring *ring);
+
+/* The next completion, or NULL; never enters the kernel */
+struct io_uring_cqe *uring_peek_cqe(Uring *ring);
+/* The next completion, sleeping in io_uring_enter() if there is none */
+struct io_uring_cqe *uring_wait_cqe(Uring *ring);
+/**
+ * Submits the prepared SQEs and returns the next completion, in a single
+ * io_uring_enter() that only returns once `wait_nr` are there. With SQPOLL,
+ * it spins on the CQ ring instead.
+ */
+struct io_uring_cqe *uring_submit_and_wait(Uring *ring, unsigned wait_nr);
+void uring_cqe_seen(Uring *ring);
+
+/* IORING_REGISTER_* with `arg` and `count` as the kernel expects them */
+void uring_register(Uring *ring, unsigned opcode, const void *arg,
+                    unsigned count);
+
+#endif /* IPC_BENCH_URING_H */
@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/ipc.h>
@@ -64,17 +65,20 @@ int timeval_to_milliseconds(const struct timeval* time) {
 }
 
 void pin_thread(int where) {
-	// Doesn't work on OS X right now
-	// int j;
-	// cpu_set_t cpuset;
-	// pthread_t thread;
-	// thread = pthread_self();
-	// CPU_ZERO(&cpuset);
-	// CPU_SET(where, &cpuset);
-	// pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
-	// int s = pthread_getaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
-	// if (s != 0) {
-	// 	fprintf(stderr, "error: pthread_getaffinity_np");
-	// 	exit(-1);
-	// }
+#ifdef __MACH__
+	(void)where;
+	warn("Thread pinning is not supported on OS X");
+#else
+	cpu_set_t cpuset;
+	int return_code;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(where, &cpuset);
+
+	return_code = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+	if (return_code != 0) {
+		errno = return_code;
+		throw("Error pinning thread");
+	}
+#endif
 }
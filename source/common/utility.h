@@ -59,6 +59,11 @@ void nsleep(int nanoseconds);
 int current_milliseconds();
 int timeval_to_milliseconds(const struct timeval* time);
 
+/**
+ * Pins the calling thread to the given (logical) CPU.
+ *
+ * \param where The CPU number as in /sys/devices/system/cpu/cpu<where>.
+ */
 void pin_thread(int where);
 
 #endif /* IPC_BENCH_UTILITY_H */
@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "common/common.h"
+#include "common/pingpong.h"
+#include "common/topology.h"
+
+#define CORE_TO_CORE_BANDWIDTH_SIZE 4096
+#define CACHE_LINE_SIZE 64
+
+typedef struct CoreToCoreArgs {
+  int count;
+  int size;
+
+  int cpus[TOPOLOGY_MAX_CPUS];
+  int cpu_count;
+
+  int is_bandwidth;
+} CoreToCoreArgs;
+
+static void print_matrix(CoreToCoreArgs *args, double *matrix) {
+  printf("\n============ CORE-TO-CORE ===========\n");
+  if (args->is_bandwidth)
+    printf("Bandwidth (MB/s) of %d B ping-pong transfers\n", args->size);
+  else
+    printf("One-way latency (ns)\n");
+  printf("Rows: ping CPU, columns: pong CPU, %d round trips each\n\n",
+         args->count);
+
+  printf("%6s", "");
+  for (int j = 0; j < args->cpu_count; ++j)
+    printf("%10d", args->cpus[j]);
+  printf("\n");
+
+  for (int i = 0; i < args->cpu_count; ++i) {
+    printf("%6d", args->cpus[i]);
+    for (int j = 0; j < args->cpu_count; ++j)
+      if (i == j)
+        printf("%10s", "-");
+      else
+        printf("%10.1f", matrix[i * args->cpu_count + j]);
+    printf("\n");
+  }
+  printf("=====================================\n");
+}
+
+static void parse_cpu_list(CoreToCoreArgs *args, const char *list) {
+  const char *cursor = list;
+  char *end;
+
+  args->cpu_count = 0;
+  while (*cursor) {
+    int first = strtol(cursor, &end, 10), last = first;
+    if (end == cursor)
+      break;
+    if (*end == '-')
+      last = strtol(end + 1, &end, 10);
+    for (int cpu = first; cpu <= last; ++cpu) {
+      if (args->cpu_count == TOPOLOGY_MAX_CPUS)
+        break;
+      args->cpus[args->cpu_count++] = cpu;
+    }
+    cursor = (*end == ',') ? end + 1 : end;
+  }
+
+  if (*cursor || args->cpu_count < 2) {
+    fprintf(stderr, "Malformed CPU list \"%s\" (need at least 2 CPUs)\n",
+            list);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void core_to_core_usage(const char *progname) {
+  printf("Usage: %s [OPTION]...\n"
+         "  -c <count> (default is %d)\n"
+         "  -C <cpu_list> (e.g., `0-3,8`; default is all online CPUs)\n"
+         "  -B: Bandwidth variant with payload transfers (default is "
+         "`false`)\n"
+         "  -b <block_size> of the bandwidth variant (default is %d)\n",
+         progname, DEFAULT_MESSAGE_COUNT, CORE_TO_CORE_BANDWIDTH_SIZE);
+}
+static void core_to_core_parse_args(CoreToCoreArgs *args, int argc,
+                                    char *argv[]) {
+  CpuTopology cpus[TOPOLOGY_MAX_CPUS];
+  const char *cpu_list = NULL;
+  int c;
+
+  args->count = DEFAULT_MESSAGE_COUNT;
+  args->size = CORE_TO_CORE_BANDWIDTH_SIZE;
+  args->is_bandwidth = 0;
+
+  while ((c = getopt(argc, argv, "hBc:b:C:")) != -1) {
+    switch (c) {
+    case 'c': /* Count */
+      args->count = atoi(optarg);
+      break;
+    case 'b': /* Block size */
+      args->size = atoi(optarg);
+      break;
+    case 'C': /* CPU subset */
+      cpu_list = optarg;
+      break;
+    case 'B': /* Bandwidth variant */
+      args->is_bandwidth = 1;
+      break;
+
+    case 'h': /* help */
+    default:
+      core_to_core_usage(argv[0]);
+      exit(EXIT_FAILURE);
+      break;
+    }
+  }
+
+  if (cpu_list)
+    parse_cpu_list(args, cpu_list);
+  else {
+    int count = topology_read(cpus, TOPOLOGY_MAX_CPUS);
+    for (int i = 0; i < count; ++i)
+      args->cpus[i] = cpus[i].cpu;
+    args->cpu_count = count;
+  }
+
+  if (args->cpu_count < 2) {
+    fprintf(stderr, "At least 2 CPUs are required!\n");
+    exit(EXIT_FAILURE);
+  }
+  if (args->count <= 0 || args->size <= 0) {
+    core_to_core_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  struct CoreToCoreArgs args;
+  core_to_core_parse_args(&args, argc, argv);
+
+  const size_t shared_size = ping_pong_memory_size(args.size);
+  void *shared_memory = mmap(NULL, shared_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (shared_memory == MAP_FAILED) {
+    perror("mmap()");
+    exit(EXIT_FAILURE);
+  }
+
+  PingPong pp;
+  ping_pong_init(&pp, shared_memory, args.size, args.count);
+  /* The latency variant passes the guard alone */
+  if (!args.is_bandwidth)
+    pp.size = 0;
+
+  double *matrix = calloc(args.cpu_count * args.cpu_count, sizeof(double));
+  if (!matrix) {
+    perror("calloc()");
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < args.cpu_count; ++i)
+    for (int j = 0; j < args.cpu_count; ++j) {
+      if (i == j)
+        continue;
+
+      bench_t total = ping_pong_run(&pp, args.cpus[i], args.cpus[j]);
+      matrix[i * args.cpu_count + j] = args.is_bandwidth
+                                           ? ping_pong_bandwidth(&pp, total)
+                                           : ping_pong_latency(&pp, total);
+
+      fprintf(stderr, "cpu %d <-> cpu %d done\n", args.cpus[i], args.cpus[j]);
+    }
+
+  print_matrix(&args, matrix);
+
+  free(matrix);
+  ping_pong_destroy(&pp);
+  if (munmap(shared_memory, shared_size)) {
+    perror("munmap()");
+    exit(EXIT_FAILURE);
+  }
+
+  return EXIT_SUCCESS;
+}
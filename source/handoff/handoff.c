@@ -0,0 +1,228 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common/common.h"
+#include "common/pingpong.h"
+#include "common/publish.h"
+#include "common/topology.h"
+
+/**
+ * Round trips of a payload between two pinned threads, published with each
+ * fence strategy in turn. With -M pointing at a write-combining BAR (e.g.
+ * /sys/bus/pci/devices/<dev>/resource2_wc), it shows what the ordering the
+ * WC buffers need actually costs. With -E, every run is repeated with the
+ * cache-line hint, and -s sweeps the size to find where the hint pays off.
+ */
+
+#define HANDOFF_SWEEP_MIN_SIZE 64
+
+typedef struct HandoffArgs {
+  uint64_t count;
+  size_t size;
+
+  int ping_cpu;
+  int pong_cpu;
+
+  const char *mem_path;
+  /* FENCE_AUTO: compare all of them */
+  PublishFence fence;
+  /* HINT_NONE: no comparison */
+  PublishHint hint;
+  /* From HANDOFF_SWEEP_MIN_SIZE by powers of 4, ending on `size` itself */
+  int is_sweep;
+} HandoffArgs;
+
+static void handoff_usage(const char *progname) {
+  printf("Usage: %s [OPTION]...\n"
+         "  -b <block_size> (default is %d)\n"
+         "  -c <count> (default is %d)\n"
+         "  -P <ping_cpu>,<pong_cpu> (default is 0,1)\n"
+         "  -M <mem_path>: Map this file or BAR (default is anonymous "
+         "memory)\n"
+         "  -f <fence>: Only none, sfence, mfence or locked (default is "
+         "all)\n"
+         "  -E <hint>: Compare with auto, cldemote, clwb or clflushopt on "
+         "the payload\n"
+         "  -s: Sweep the size from %d B to the block size\n",
+         progname, DEFAULT_MESSAGE_SIZE, DEFAULT_MESSAGE_COUNT,
+         HANDOFF_SWEEP_MIN_SIZE);
+}
+static void handoff_parse_args(HandoffArgs *args, int argc, char *argv[]) {
+  int c, fence, hint;
+
+  args->count = DEFAULT_MESSAGE_COUNT;
+  args->size = DEFAULT_MESSAGE_SIZE;
+  args->ping_cpu = 0;
+  args->pong_cpu = 1;
+  args->mem_path = NULL;
+  args->fence = FENCE_AUTO;
+  args->hint = HINT_NONE;
+  args->is_sweep = 0;
+
+  while ((c = getopt(argc, argv, "hsb:c:P:M:f:E:")) != -1) {
+    switch (c) {
+    case 'b': /* Block size */
+      args->size = parse_size(optarg);
+      break;
+    case 'c': /* Count */
+      args->count = parse_count(optarg);
+      break;
+    case 'P': /* CPU pinning */
+      if ((sscanf(optarg, "%d,%d", &args->ping_cpu, &args->pong_cpu) != 2) ||
+          (args->ping_cpu < 0) || (args->pong_cpu < 0)) {
+        fprintf(stderr, "-P expects <ping_cpu>,<pong_cpu>\n");
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'M': /* Memory path */
+      args->mem_path = optarg;
+      break;
+    case 'f': /* Fence */
+      if ((fence = publish_fence_parse(optarg)) < FENCE_NONE) {
+        fprintf(stderr, "Unknown fence \"%s\"\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      args->fence = fence;
+      break;
+    case 'E': /* Cache-line hint */
+      if ((hint = publish_hint_parse(optarg)) < HINT_AUTO) {
+        fprintf(stderr, "Unknown hint \"%s\"\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      args->hint = hint;
+      break;
+    case 's': /* Size sweep */
+      args->is_sweep = 1;
+      break;
+
+    case 'h': /* help */
+    default:
+      handoff_usage(argv[0]);
+      exit(EXIT_FAILURE);
+      break;
+    }
+  }
+
+  if (args->hint != HINT_NONE) {
+    const PublishHint hint = publish_hint_resolve(args->hint);
+    if ((args->hint != HINT_AUTO) && (hint != args->hint))
+      fprintf(stderr, "This CPU has no %s; Use %s\n",
+              publish_hint_name(args->hint), publish_hint_name(hint));
+    args->hint = hint;
+  }
+  if (args->is_sweep && (args->size < HANDOFF_SWEEP_MIN_SIZE)) {
+    fprintf(stderr, "The sweep starts at %d B; Use -b %d\n",
+            HANDOFF_SWEEP_MIN_SIZE, HANDOFF_SWEEP_MIN_SIZE);
+    args->size = HANDOFF_SWEEP_MIN_SIZE;
+  }
+
+  if (sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+    fprintf(stderr, "Only one CPU online; Both threads share CPU 0\n");
+    args->ping_cpu = args->pong_cpu = 0;
+  }
+}
+
+static void *map_memory(HandoffArgs *args, size_t size) {
+  void *memory;
+
+  if (!args->mem_path) {
+    memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  } else {
+    struct stat st;
+    int fd = open(args->mem_path, O_RDWR);
+    if (fd < 0) {
+      perror("open()");
+      exit(EXIT_FAILURE);
+    }
+    if (fstat(fd, &st)) {
+      perror("fstat()");
+      exit(EXIT_FAILURE);
+    }
+    if ((size_t)st.st_size < size) {
+      fprintf(stderr, "%s holds %ld bytes, %zu needed!\n", args->mem_path,
+              st.st_size, size);
+      exit(EXIT_FAILURE);
+    }
+    memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+  }
+  if (memory == MAP_FAILED) {
+    perror("mmap()");
+    exit(EXIT_FAILURE);
+  }
+
+  return memory;
+}
+
+/* The size after `size`, or 0 once the block size `last` has been run */
+static size_t sweep_next(size_t size, size_t last) {
+  if (size == last)
+    return 0;
+  return (size * 4 < last) ? size * 4 : last;
+}
+
+int main(int argc, char *argv[]) {
+  struct HandoffArgs args;
+  handoff_parse_args(&args, argc, argv);
+
+  const size_t shared_size = ping_pong_memory_size(args.size);
+  void *shared_memory = map_memory(&args, shared_size);
+
+  PingPong pp;
+  ping_pong_init(&pp, shared_memory, args.size, args.count);
+
+  const PublishFence first = (args.fence == FENCE_AUTO) ? 0 : args.fence;
+  const PublishFence last =
+      (args.fence == FENCE_AUTO) ? FENCE_COUNT - 1 : args.fence;
+  const int is_compare = (args.hint != HINT_NONE);
+
+  printf("\n============== HANDOFF ==============\n");
+  printf("Payloads through %s, CPU %d <-> CPU %d\n",
+         args.mem_path ? args.mem_path : "anonymous memory", args.ping_cpu,
+         args.pong_cpu);
+  printf("%" PRIu64 " round trips per run\n\n", args.count);
+  printf("%-10s%-10s%16s%12s", "Size", "Fence", "One-way (ns)", "MB/s");
+  if (is_compare)
+    printf("%12s (ns)%10s", publish_hint_name(args.hint), "Speedup");
+  printf("\n");
+
+  size_t size = args.is_sweep ? HANDOFF_SWEEP_MIN_SIZE : args.size;
+  for (; size; size = sweep_next(size, args.size)) {
+    pp.size = size;
+    for (PublishFence fence = first; fence <= last; ++fence) {
+      pp.fence = fence;
+      pp.hint = HINT_NONE;
+      const bench_t total = ping_pong_run(&pp, args.ping_cpu, args.pong_cpu);
+
+      printf("%-10zu%-10s%16.1f%12.1f", size, publish_fence_name(fence),
+             ping_pong_latency(&pp, total), ping_pong_bandwidth(&pp, total));
+      if (is_compare) {
+        pp.hint = args.hint;
+        const bench_t hinted = ping_pong_run(&pp, args.ping_cpu, args.pong_cpu);
+        printf("%17.1f%10.2f", ping_pong_latency(&pp, hinted),
+               (double)total / hinted);
+      }
+      printf("\n");
+      fflush(stdout);
+    }
+  }
+  printf("=====================================\n");
+
+  ping_pong_destroy(&pp);
+  if (munmap(shared_memory, shared_size)) {
+    perror("munmap()");
+    exit(EXIT_FAILURE);
+  }
+
+  return EXIT_SUCCESS;
+}
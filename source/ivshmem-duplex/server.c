@@ -0,0 +1,154 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "common/common.h"
+#include "common/interference.h"
+#include "common/ivshmem.h"
+#include "common/layout.h"
+#include "common/realtime.h"
+#include "common/stream.h"
+#include "common/topology.h"
+
+/* Guard and buffer indexes within the slot */
+#define DUPLEX_STC 0
+#define DUPLEX_CTS 1
+#define DUPLEX_READY 2
+
+typedef struct Receiver {
+  ShmStream stream;
+  struct IvshmemArgs *args;
+} Receiver;
+
+/* Drains the CTS direction while the main thread keeps sending */
+static void *receive_main(void *argument) {
+  Receiver *rx = argument;
+  struct IvshmemArgs *args = rx->args;
+
+  void *buffer = malloc(args->size);
+  if (!buffer) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  for (uint64_t message = 0; message < args->count; ++message) {
+    memcpy(buffer, shm_stream_receive(&rx->stream), args->size);
+    shm_stream_release(&rx->stream);
+    if (unlikely(args->is_debug))
+      debug_validate(buffer, args->size, CTS_BITS_01010101);
+  }
+
+  free(buffer);
+  return NULL;
+}
+
+__attribute__((hot, flatten)) void communicate(IvshmemSlot *slot,
+                                               struct IvshmemArgs *args) {
+  ShmStream tx;
+  Receiver rx;
+  pthread_t rx_thread;
+
+  shm_stream_init(&tx, &slot->guards[DUPLEX_STC], &slot->buffers[DUPLEX_STC],
+                  1);
+  shm_stream_init(&rx.stream, &slot->guards[DUPLEX_CTS],
+                  &slot->buffers[DUPLEX_CTS], 1);
+  shm_stream_set_fence(&tx, args->fence);
+  shm_stream_set_fence(&rx.stream, args->fence);
+  rx.args = args;
+
+  /* The client has both directions running */
+  userspace_shm_wait(slot->guards[DUPLEX_READY], 's');
+
+  interference_start(args->interference);
+
+  struct Benchmarks bench;
+  setup_benchmarks(&bench, args->count);
+
+  const int res = pthread_create(&rx_thread, NULL, receive_main, &rx);
+  if (res) {
+    fprintf(stderr, "pthread_create(): %s\n", strerror(res));
+    exit(EXIT_FAILURE);
+  }
+
+  for (uint64_t message = 0; message < args->count; ++message) {
+    bench.single_start = now();
+
+    /* STC, while the CTS messages stream in concurrently */
+    void *payload = shm_stream_acquire(&tx);
+    memset(payload, STC_BITS_10101010, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(payload, args->size, STC_BITS_10101010);
+    shm_stream_publish(&tx);
+
+    benchmark(&bench);
+  }
+
+  pthread_join(rx_thread, NULL);
+  const bench_t duplex_time = now() - bench.total_start;
+
+  interference_stop();
+
+  benchmark_tag("Duplex throughput", "%.3f MB/s (both directions)",
+                (2.0 * args->count * args->size) / (duplex_time / 1e9) / 1e6);
+
+  struct Arguments tmp_arg;
+  tmp_arg.count = args->count;
+  tmp_arg.size = args->size;
+  evaluate(&bench, &tmp_arg);
+}
+
+static const char IVSHMEM_MEM_DEFAULT_PATH[] = "/dev/usernet_ivshmem0";
+int main(int argc, char *argv[]) {
+  struct IvshmemArgs args;
+  ivshmem_parse_args(&args, argc, argv, 0);
+
+  pin_placement(args.server_cpu, args.server_cpu, args.client_cpu);
+  realtime_setup(args.rt_priority, args.is_thp_disabled);
+
+  if (!args.mem_dev_path) {
+    fprintf(stderr, "No -M option set; Use %s as the memory device path\n",
+            IVSHMEM_MEM_DEFAULT_PATH);
+    args.mem_dev_path = IVSHMEM_MEM_DEFAULT_PATH;
+  }
+  ivshmem_resolve_fence(&args);
+
+  if (args.shmem_index == -1) {
+    fprintf(stderr, "No -i option set; Use 0 as the shared memory index\n");
+    args.shmem_index = 0;
+  }
+
+  if (args.layout == LAYOUT_LEGACY) {
+    fprintf(stderr, "Duplex needs a guard per direction; Use -L aligned\n");
+    args.layout = LAYOUT_ALIGNED;
+  }
+  if (args.chunk_size) {
+    fprintf(stderr, "Duplex sends whole messages; Ignore -k\n");
+    args.chunk_size = 0;
+  }
+
+  IvshmemRegion region;
+  if (args.is_nonblock) {
+    fprintf(stderr, "args.is_nonblock == 1\n");
+    ivshmem_region_open(&region, args.mem_dev_path,
+                        O_RDWR | O_ASYNC | O_NONBLOCK, args.mem_size_force);
+  } else
+    ivshmem_region_open(&region, args.mem_dev_path, O_RDWR | O_ASYNC,
+                        args.mem_size_force);
+
+  /* One buffer per direction, plus the start handshake */
+  IvshmemSlot slot;
+  ivshmem_slot_attach(&slot, &region, &args, 3, 2, 1);
+
+  communicate(&slot, &args);
+
+  ivshmem_region_close(&region);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,313 @@
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "common/common.h"
+#include "common/eventloop.h"
+#include "common/ivshmem.h"
+#include "common/layout.h"
+#include "common/peers.h"
+#include "common/pending.h"
+#include "common/realtime.h"
+#include "common/stream.h"
+#include "common/topology.h"
+
+__attribute__((hot, flatten)) void
+communicate(IvshmemSlot *slot, EventfdDoorbell *doorbell,
+            struct IvshmemArgs *args) {
+  void *buffer = malloc(args->size);
+  if (!buffer) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  uint32_t *guard = slot->guards[0];
+  void *payload = slot->buffers[0];
+
+  shm_publish(guard, 's', args->fence);
+  eventfd_doorbell_notify(doorbell);
+
+  for (; args->count > 0; --args->count) {
+    /* STC */
+    eventfd_doorbell_wait(guard, 'c', doorbell);
+    memcpy(buffer, payload, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(buffer, args->size, STC_BITS_10101010);
+
+    /* CTS */
+    memset(payload, CTS_BITS_01010101, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(payload, args->size, CTS_BITS_01010101);
+    shm_publish(guard, 's', args->fence);
+    eventfd_doorbell_notify(doorbell);
+  }
+
+  free(buffer);
+}
+
+/* Drains the STC stream; the guard after the buffers' is the handshake */
+__attribute__((hot, flatten)) void
+communicate_stream(IvshmemSlot *slot, EventfdDoorbell *doorbell,
+                   struct IvshmemArgs *args) {
+  void *buffer = malloc(args->size);
+  if (!buffer) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  uint32_t *handshake = slot->guards[args->buffer_count];
+  ShmStream rx;
+  shm_stream_init(&rx, slot->guards, slot->buffers, args->buffer_count);
+  shm_stream_set_fence(&rx, args->fence);
+  const size_t chunk = slot->buffer_size;
+
+  /* The eventfd counter coalesces, so the stream re-checks its guards */
+  shm_stream_set_doorbell(&rx, eventfd_doorbell_wait, eventfd_doorbell_notify,
+                          doorbell);
+
+  userspace_shm_notify(handshake, 's');
+  eventfd_doorbell_notify(doorbell);
+
+  for (; args->count > 0; --args->count) {
+    /* STC, reassembled from its chunks */
+    for (size_t offset = 0; offset < args->size; offset += chunk) {
+      const size_t length =
+          (args->size - offset < chunk) ? args->size - offset : chunk;
+      memcpy(buffer + offset, shm_stream_receive(&rx), length);
+      shm_stream_release(&rx);
+    }
+    if (unlikely(args->is_debug))
+      debug_validate(buffer, args->size, STC_BITS_10101010);
+  }
+
+  userspace_shm_notify(handshake, 'd');
+  eventfd_doorbell_notify(doorbell);
+
+  free(buffer);
+}
+
+typedef struct ChannelGroup {
+  IvshmemSlot *slots;
+  void *buffer;
+  struct IvshmemArgs *args;
+} ChannelGroup;
+
+static void serve_channel(int channel, void *context) {
+  ChannelGroup *group = context;
+  IvshmemSlot *slot = &group->slots[channel];
+  struct IvshmemArgs *args = group->args;
+
+  /* STC */
+  memcpy(group->buffer, slot->buffers[0], args->size);
+  if (unlikely(args->is_debug))
+    debug_validate(group->buffer, args->size, STC_BITS_10101010);
+
+  /* CTS */
+  memset(slot->buffers[0], CTS_BITS_01010101, args->size);
+  if (unlikely(args->is_debug))
+    debug_validate(slot->buffers[0], args->size, CTS_BITS_01010101);
+  pending_post(slot->pending[LAYOUT_TO_SERVER], channel);
+}
+
+/* Answers a whole group of channels behind a single doorbell */
+__attribute__((hot, flatten)) void
+communicate_channels(IvshmemSlot *slots, EventfdDoorbell *doorbell,
+                     struct IvshmemArgs *args) {
+  void *buffer = malloc(args->size);
+  if (!buffer) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  uint32_t *to_client = slots[0].pending[LAYOUT_TO_CLIENT];
+  ChannelGroup group = {.slots = slots, .buffer = buffer, .args = args};
+  EventLoop loop, *waiter = ivshmem_waiter_init(&loop, doorbell->wait_fd, args);
+
+  for (int channel = 0; channel < args->channel_count; ++channel)
+    pending_post(slots[0].pending[LAYOUT_TO_SERVER], channel);
+  eventfd_doorbell_notify(doorbell);
+
+  for (uint64_t served = 0; served < args->count * args->channel_count;) {
+    served += pending_dispatch(to_client, doorbell->wait_fd, sizeof(uint64_t),
+                               waiter, serve_channel, &group);
+    /* One doorbell for all the channels served on this wake-up */
+    eventfd_doorbell_notify(doorbell);
+  }
+
+  ivshmem_waiter_close(waiter);
+  free(buffer);
+}
+
+typedef struct LoopChannel {
+  EventSource source;
+  IvshmemSlot *slot;
+  EventfdDoorbell doorbell;
+  struct IvshmemArgs *args;
+
+  /* Shared by all channels of the loop */
+  void *buffer;
+  uint64_t *answered;
+} LoopChannel;
+
+static void answer_loop_channel(EventSource *source) {
+  LoopChannel *channel = source->context;
+  struct IvshmemArgs *args = channel->args;
+  void *payload = channel->slot->buffers[0];
+
+  /* A coalesced or stale wake-up; the server has not sent anything new */
+  if (shm_consume(channel->slot->guards[0]) != 'c')
+    return;
+
+  /* STC */
+  memcpy(channel->buffer, payload, args->size);
+  if (unlikely(args->is_debug))
+    debug_validate(channel->buffer, args->size, STC_BITS_10101010);
+
+  /* CTS */
+  memset(payload, CTS_BITS_01010101, args->size);
+  if (unlikely(args->is_debug))
+    debug_validate(payload, args->size, CTS_BITS_01010101);
+  shm_publish(channel->slot->guards[0], 's', args->fence);
+  eventfd_doorbell_notify(&channel->doorbell);
+  ++*channel->answered;
+}
+
+/* Answers every channel from this one thread, whichever rings */
+__attribute__((hot, flatten)) void
+communicate_loop(IvshmemSlot *slots, IvshmemConnection *connection,
+                 IvshmemPeer *server, struct IvshmemArgs *args) {
+  const int count = args->loop_channel_count;
+  void *buffer = malloc(args->size);
+  LoopChannel *channels = calloc(count, sizeof(LoopChannel));
+  if (!buffer || !channels) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  /* Pairing only waited for the first vector; channel i needs its slot's */
+  server =
+      ivshmem_await_peer(connection, server->id, args->shmem_index + count);
+
+  EventLoop loop;
+  uint64_t answered = 0;
+  event_loop_init(&loop);
+
+  /* Channel i rings and waits on the vector of its slot, -i plus i */
+  for (int i = 0; i < count; ++i) {
+    LoopChannel *channel = &channels[i];
+    channel->slot = &slots[i];
+    channel->doorbell.wait_fd =
+        connection->self.eventfds[args->shmem_index + i];
+    channel->doorbell.notify_fd = server->eventfds[args->shmem_index + i];
+    channel->args = args;
+    channel->buffer = buffer;
+    channel->answered = &answered;
+
+    channel->source.fd = channel->doorbell.wait_fd;
+    channel->source.event_size = sizeof(uint64_t);
+    channel->source.handler = answer_loop_channel;
+    channel->source.context = channel;
+    event_loop_add(&loop, &channel->source);
+  }
+
+  shm_publish(slots[0].guards[0], 's', args->fence);
+  eventfd_doorbell_notify(&channels[0].doorbell);
+
+  while (answered < args->count * count)
+    event_loop_run_once(&loop, -1);
+
+  event_loop_close(&loop);
+  free(channels);
+  free(buffer);
+}
+
+int main(int argc, char *argv[]) {
+  struct IvshmemArgs args;
+  ivshmem_parse_args(&args, argc, argv, IVSHMEM_CAP_EVENT_LOOP);
+
+  pin_placement(args.client_cpu, args.server_cpu, args.client_cpu);
+  realtime_setup(args.rt_priority, args.is_thp_disabled);
+
+  if (!args.intr_dev_path) {
+    fprintf(stderr, "No -I option set; Use %s as the ivshmem-server socket\n",
+            IVSHMEM_DEFAULT_SOCKET_PATH);
+    args.intr_dev_path = IVSHMEM_DEFAULT_SOCKET_PATH;
+  }
+
+  if (args.shmem_index == -1) {
+    fprintf(stderr, "No -i option set; Use 0 as the shared memory index\n");
+    args.shmem_index = 0;
+  }
+  ivshmem_resolve_fence(&args);
+
+  bench_t open_start = now();
+  IvshmemConnection connection;
+  const int vector = ivshmem_vector(&args);
+  ivshmem_connect(&connection, args.intr_dev_path,
+                  vector + (args.loop_channel_count ? args.loop_channel_count
+                                                    : 1));
+
+  struct stat st;
+  if (fstat(connection.shm_fd, &st)) {
+    perror("fstat()");
+    exit(EXIT_FAILURE);
+  }
+  IvshmemRegion region;
+  ivshmem_region_init(&region, connection.shm_fd, st.st_size, 0, 1);
+  region.open_time = now() - open_start;
+
+  IvshmemSlot slots[LAYOUT_MAX_SLOTS], *slot = &slots[0];
+  if (args.loop_channel_count)
+    ivshmem_group_attach(slots, args.loop_channel_count, &region, &args, 0);
+  else if (args.channel_count)
+    ivshmem_group_attach(slots, args.channel_count, &region, &args, 0);
+  else if (args.buffer_count)
+    ivshmem_slot_attach(slot, &region, &args, args.buffer_count + 1,
+                        args.buffer_count, 0);
+  else
+    ivshmem_slot_attach(slot, &region, &args, 1, 1, 0);
+
+  /* Ids are handed out by the ivshmem-server; the slot tells who is who */
+  IvshmemPeer *server = ivshmem_pair(
+      &connection, slot->guards[slot->guard_count - 1], vector, 0);
+  fprintf(stderr, "Server is ivshmem peer %" PRId64 "\n", server->id);
+
+  if (args.is_nonblock) {
+    fprintf(stderr, "args.is_nonblock == 1\n");
+    if (fcntl(connection.self.eventfds[vector], F_SETFL, O_NONBLOCK)) {
+      perror("fcntl(F_SETFL)");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  EventfdDoorbell doorbell = {.wait_fd = connection.self.eventfds[vector],
+                              .notify_fd = server->eventfds[vector]};
+  if (args.loop_channel_count)
+    communicate_loop(slots, &connection, server, &args);
+  else if (args.channel_count)
+    communicate_channels(slots, &doorbell, &args);
+  else if (args.buffer_count)
+    communicate_stream(slot, &doorbell, &args);
+  else
+    communicate(slot, &doorbell, &args);
+
+  ivshmem_disconnect(&connection);
+  ivshmem_region_close(&region);
+
+  return EXIT_SUCCESS;
+}
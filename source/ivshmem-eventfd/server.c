@@ -0,0 +1,408 @@
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "common/common.h"
+#include "common/eventloop.h"
+#include "common/interference.h"
+#include "common/ivshmem.h"
+#include "common/layout.h"
+#include "common/peers.h"
+#include "common/pending.h"
+#include "common/realtime.h"
+#include "common/stream.h"
+#include "common/topology.h"
+
+__attribute__((hot, flatten)) void
+communicate(IvshmemSlot *slot, EventfdDoorbell *doorbell,
+            struct IvshmemArgs *args) {
+  void *buffer = malloc(args->size);
+  if (!buffer) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  uint32_t *guard = slot->guards[0];
+  void *payload = slot->buffers[0];
+
+  /* The client answered the pairing already; nothing to reset here */
+  eventfd_doorbell_wait(guard, 's', doorbell);
+
+  interference_start(args->interference);
+
+  struct Benchmarks bench;
+  setup_benchmarks(&bench, args->count);
+
+  for (uint64_t message = 0; message < args->count; ++message) {
+    bench.single_start = now();
+
+    /* STC */
+    memset(payload, STC_BITS_10101010, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(payload, args->size, STC_BITS_10101010);
+    shm_publish(guard, 'c', args->fence);
+    eventfd_doorbell_notify(doorbell);
+
+    /* CTS */
+    eventfd_doorbell_wait(guard, 's', doorbell);
+    memcpy(buffer, payload, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(buffer, args->size, CTS_BITS_01010101);
+
+    benchmark(&bench);
+  }
+
+  interference_stop();
+
+  struct Arguments tmp_arg;
+  tmp_arg.count = args->count;
+  tmp_arg.size = args->size;
+  evaluate(&bench, &tmp_arg);
+
+  free(buffer);
+}
+
+/* Streams STC through the buffers; the guard after theirs is the handshake */
+__attribute__((hot, flatten)) void
+communicate_stream(IvshmemSlot *slot, EventfdDoorbell *doorbell,
+                   struct IvshmemArgs *args) {
+  uint32_t *handshake = slot->guards[args->buffer_count];
+  ShmStream tx;
+  shm_stream_init(&tx, slot->guards, slot->buffers, args->buffer_count);
+  shm_stream_set_fence(&tx, args->fence);
+  const size_t chunk = slot->buffer_size;
+
+  /* The eventfd counter coalesces, so the stream re-checks its guards */
+  shm_stream_set_doorbell(&tx, eventfd_doorbell_wait, eventfd_doorbell_notify,
+                          doorbell);
+
+  eventfd_doorbell_wait(handshake, 's', doorbell);
+
+  interference_start(args->interference);
+
+  struct Benchmarks bench;
+  setup_benchmarks(&bench, args->count);
+
+  for (uint64_t message = 0; message < args->count; ++message) {
+    bench.single_start = now();
+
+    /* STC chunk by chunk, while the client drains the previous buffers */
+    for (size_t offset = 0; offset < args->size; offset += chunk) {
+      const size_t length =
+          (args->size - offset < chunk) ? args->size - offset : chunk;
+      void *payload = shm_stream_acquire(&tx);
+      memset(payload, STC_BITS_10101010, length);
+      if (unlikely(args->is_debug))
+        debug_validate(payload, length, STC_BITS_10101010);
+      shm_stream_publish(&tx);
+    }
+
+    benchmark(&bench);
+  }
+
+  /* Until the client has copied out the last message */
+  eventfd_doorbell_wait(handshake, 'd', doorbell);
+  const bench_t stream_time = now() - bench.total_start;
+
+  interference_stop();
+
+  benchmark_tag("Buffers", "%d", args->buffer_count);
+  if (chunk < args->size)
+    benchmark_tag("Chunk size", "%zu", chunk);
+  benchmark_tag("Stream throughput", "%.3f MB/s",
+                ((double)args->count * args->size) / (stream_time / 1e9) /
+                    1e6);
+
+  struct Arguments tmp_arg;
+  tmp_arg.count = args->count;
+  tmp_arg.size = args->size;
+  evaluate(&bench, &tmp_arg);
+}
+
+typedef struct ChannelGroup {
+  IvshmemSlot *slots;
+  void *buffer;
+  struct IvshmemArgs *args;
+  /* Before, a pending channel only means that the client is ready */
+  int is_running;
+} ChannelGroup;
+
+static void receive_channel(int channel, void *context) {
+  ChannelGroup *group = context;
+
+  if (!group->is_running)
+    return;
+  memcpy(group->buffer, group->slots[channel].buffers[0], group->args->size);
+  if (unlikely(group->args->is_debug))
+    debug_validate(group->buffer, group->args->size, CTS_BITS_01010101);
+}
+
+/* Ping-pong on a whole group of channels behind a single doorbell */
+__attribute__((hot, flatten)) void
+communicate_channels(IvshmemSlot *slots, EventfdDoorbell *doorbell,
+                     struct IvshmemArgs *args) {
+  void *buffer = malloc(args->size);
+  if (!buffer) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  uint32_t *to_server = slots[0].pending[LAYOUT_TO_SERVER];
+  uint32_t *to_client = slots[0].pending[LAYOUT_TO_CLIENT];
+  ChannelGroup group = {.slots = slots, .buffer = buffer, .args = args};
+  EventLoop loop, *waiter = ivshmem_waiter_init(&loop, doorbell->wait_fd, args);
+  uint64_t wakeups = 0;
+
+  for (int ready = 0; ready < args->channel_count;)
+    ready += pending_dispatch(to_server, doorbell->wait_fd, sizeof(uint64_t),
+                              waiter, receive_channel, &group);
+  group.is_running = 1;
+
+  interference_start(args->interference);
+
+  struct Benchmarks bench;
+  setup_benchmarks(&bench, args->count);
+
+  for (uint64_t message = 0; message < args->count; ++message) {
+    bench.single_start = now();
+
+    /* STC on every channel, announced by one doorbell */
+    for (int channel = 0; channel < args->channel_count; ++channel) {
+      void *payload = slots[channel].buffers[0];
+      memset(payload, STC_BITS_10101010, args->size);
+      if (unlikely(args->is_debug))
+        debug_validate(payload, args->size, STC_BITS_10101010);
+      pending_post(to_client, channel);
+    }
+    eventfd_doorbell_notify(doorbell);
+
+    /* CTS, in whatever order and batches the channels answer */
+    for (int answered = 0; answered < args->channel_count; ++wakeups)
+      answered += pending_dispatch(to_server, doorbell->wait_fd,
+                                   sizeof(uint64_t), waiter, receive_channel,
+                                   &group);
+
+    benchmark(&bench);
+  }
+
+  interference_stop();
+
+  benchmark_tag("Channels", "%d", args->channel_count);
+  benchmark_tag("Channels per wake-up", "%.2f",
+                (double)args->count * args->channel_count / wakeups);
+
+  struct Arguments tmp_arg;
+  tmp_arg.count = args->count;
+  tmp_arg.size = args->size;
+  evaluate(&bench, &tmp_arg);
+
+  ivshmem_waiter_close(waiter);
+  free(buffer);
+}
+
+typedef struct LoopChannel {
+  EventSource source;
+  IvshmemSlot *slot;
+  EventfdDoorbell doorbell;
+  struct IvshmemArgs *args;
+
+  uint64_t remaining;
+  bench_t sent_at;
+
+  /* Shared by all channels of the loop */
+  void *buffer;
+  Benchmarks *bench;
+  uint64_t *received;
+} LoopChannel;
+
+static void send_loop_channel(LoopChannel *channel) {
+  struct IvshmemArgs *args = channel->args;
+  void *payload = channel->slot->buffers[0];
+
+  channel->sent_at = now();
+  memset(payload, STC_BITS_10101010, args->size);
+  if (unlikely(args->is_debug))
+    debug_validate(payload, args->size, STC_BITS_10101010);
+  shm_publish(channel->slot->guards[0], 'c', args->fence);
+  eventfd_doorbell_notify(&channel->doorbell);
+}
+
+static void receive_loop_channel(EventSource *source) {
+  LoopChannel *channel = source->context;
+  struct IvshmemArgs *args = channel->args;
+
+  /* A coalesced or stale wake-up; the client has not answered yet */
+  if (shm_consume(channel->slot->guards[0]) != 's')
+    return;
+
+  memcpy(channel->buffer, channel->slot->buffers[0], args->size);
+  if (unlikely(args->is_debug))
+    debug_validate(channel->buffer, args->size, CTS_BITS_01010101);
+  channel->bench->single_start = channel->sent_at;
+  benchmark(channel->bench);
+  ++*channel->received;
+
+  if (--channel->remaining)
+    send_loop_channel(channel);
+}
+
+/* Ping-pong on every channel at once, all served by this one thread */
+__attribute__((hot, flatten)) void
+communicate_loop(IvshmemSlot *slots, IvshmemConnection *connection,
+                 IvshmemPeer *client, struct IvshmemArgs *args) {
+  const int count = args->loop_channel_count;
+  void *buffer = malloc(args->size);
+  LoopChannel *channels = calloc(count, sizeof(LoopChannel));
+  if (!buffer || !channels) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  struct Benchmarks bench;
+  /* Pairing only waited for the first vector; channel i needs its slot's */
+  client =
+      ivshmem_await_peer(connection, client->id, args->shmem_index + count);
+
+  EventLoop loop;
+  uint64_t received = 0;
+  event_loop_init(&loop);
+
+  /* Channel i rings and waits on the vector of its slot, -i plus i */
+  for (int i = 0; i < count; ++i) {
+    LoopChannel *channel = &channels[i];
+    channel->slot = &slots[i];
+    channel->doorbell.wait_fd =
+        connection->self.eventfds[args->shmem_index + i];
+    channel->doorbell.notify_fd = client->eventfds[args->shmem_index + i];
+    channel->args = args;
+    channel->remaining = args->count;
+    channel->buffer = buffer;
+    channel->bench = &bench;
+    channel->received = &received;
+
+    channel->source.fd = channel->doorbell.wait_fd;
+    channel->source.event_size = sizeof(uint64_t);
+    channel->source.handler = receive_loop_channel;
+    channel->source.context = channel;
+    event_loop_add(&loop, &channel->source);
+  }
+
+  /* Channel 0 still carries the pairing; the client's go follows on it */
+  eventfd_doorbell_wait(slots[0].guards[0], 's', &channels[0].doorbell);
+
+  interference_start(args->interference);
+
+  setup_benchmarks(&bench, args->count * count);
+
+  for (int i = 0; i < count; ++i)
+    send_loop_channel(&channels[i]);
+  while (received < args->count * count)
+    event_loop_run_once(&loop, -1);
+  const bench_t loop_time = now() - bench.total_start;
+
+  interference_stop();
+
+  benchmark_tag("Loop channels", "%d", count);
+  benchmark_tag("Channels per wake-up", "%.2f",
+                (double)loop.event_count / loop.wakeup_count);
+  benchmark_tag("Aggregate rate", "%.0f msg/s",
+                received / (loop_time / 1e9));
+
+  struct Arguments tmp_arg;
+  tmp_arg.count = received;
+  tmp_arg.size = args->size;
+  evaluate(&bench, &tmp_arg);
+
+  event_loop_close(&loop);
+  free(channels);
+  free(buffer);
+}
+
+int main(int argc, char *argv[]) {
+  struct IvshmemArgs args;
+  ivshmem_parse_args(&args, argc, argv, IVSHMEM_CAP_EVENT_LOOP);
+
+  pin_placement(args.server_cpu, args.server_cpu, args.client_cpu);
+  realtime_setup(args.rt_priority, args.is_thp_disabled);
+
+  if (!args.intr_dev_path) {
+    fprintf(stderr, "No -I option set; Use %s as the ivshmem-server socket\n",
+            IVSHMEM_DEFAULT_SOCKET_PATH);
+    args.intr_dev_path = IVSHMEM_DEFAULT_SOCKET_PATH;
+  }
+
+  if (args.shmem_index == -1) {
+    fprintf(stderr, "No -i option set; Use 0 as the shared memory index\n");
+    args.shmem_index = 0;
+  }
+  ivshmem_resolve_fence(&args);
+
+  bench_t open_start = now();
+  IvshmemConnection connection;
+  const int vector = ivshmem_vector(&args);
+  ivshmem_connect(&connection, args.intr_dev_path,
+                  vector + (args.loop_channel_count ? args.loop_channel_count
+                                                    : 1));
+
+  struct stat st;
+  if (fstat(connection.shm_fd, &st)) {
+    perror("fstat()");
+    exit(EXIT_FAILURE);
+  }
+  IvshmemRegion region;
+  ivshmem_region_init(&region, connection.shm_fd, st.st_size, 0, 1);
+  region.open_time = now() - open_start;
+
+  IvshmemSlot slots[LAYOUT_MAX_SLOTS], *slot = &slots[0];
+  if (args.loop_channel_count)
+    ivshmem_group_attach(slots, args.loop_channel_count, &region, &args, 1);
+  else if (args.channel_count)
+    ivshmem_group_attach(slots, args.channel_count, &region, &args, 1);
+  else if (args.buffer_count)
+    ivshmem_slot_attach(slot, &region, &args, args.buffer_count + 1,
+                        args.buffer_count, 1);
+  else
+    ivshmem_slot_attach(slot, &region, &args, 1, 1, 1);
+
+  /* Ids are handed out by the ivshmem-server; the slot tells who is who */
+  IvshmemPeer *client = ivshmem_pair(
+      &connection, slot->guards[slot->guard_count - 1], vector, 1);
+  fprintf(stderr, "Client is ivshmem peer %" PRId64 "\n", client->id);
+
+  if (args.is_nonblock) {
+    fprintf(stderr, "args.is_nonblock == 1\n");
+    if (fcntl(connection.self.eventfds[vector], F_SETFL, O_NONBLOCK)) {
+      perror("fcntl(F_SETFL)");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  EventfdDoorbell doorbell = {.wait_fd = connection.self.eventfds[vector],
+                              .notify_fd = client->eventfds[vector]};
+  if (args.loop_channel_count)
+    communicate_loop(slots, &connection, client, &args);
+  else if (args.channel_count)
+    communicate_channels(slots, &doorbell, &args);
+  else if (args.buffer_count)
+    communicate_stream(slot, &doorbell, &args);
+  else
+    communicate(slot, &doorbell, &args);
+
+  ivshmem_disconnect(&connection);
+  ivshmem_region_close(&region);
+
+  return EXIT_SUCCESS;
+}
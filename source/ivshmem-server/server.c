@@ -0,0 +1,255 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "common/arguments.h"
+#include "common/peers.h"
+
+/**
+ * A stand-in for QEMU's ivshmem-server: hands out the shared memory and an
+ * eventfd per vector of every peer, so that host processes can use the
+ * doorbell protocol of ivshmem guests (see common/peers.h).
+ */
+
+#define DEFAULT_SHM_SIZE (4UL << 20)
+#define MAX_PEER_ID UINT16_MAX
+
+typedef struct ServerArgs {
+  const char *socket_path;
+  const char *shm_path;
+  size_t shm_size;
+  int vector_count;
+} ServerArgs;
+
+/* Peer i is served through poll_fds[i + 1]; [0] is the listening socket */
+static IvshmemPeer peers[IVSHMEM_MAX_PEERS];
+static struct pollfd poll_fds[IVSHMEM_MAX_PEERS + 1];
+static int64_t next_id = 0;
+
+static void usage(const char *progname) {
+  printf("Usage: %s [OPTION]...\n"
+         "  -S <socket_path> (default is %s)\n"
+         "  -M <shm_path>: Back the memory with this file (default is memfd)\n"
+         "  -l <shm_size> (default is 4m)\n"
+         "  -n <vectors>: Eventfds per peer, 1-%d (default is 1)\n",
+         progname, IVSHMEM_DEFAULT_SOCKET_PATH, IVSHMEM_MAX_VECTORS);
+}
+static void parse_args(ServerArgs *args, int argc, char *argv[]) {
+  int c;
+
+  args->socket_path = IVSHMEM_DEFAULT_SOCKET_PATH;
+  args->shm_path = NULL;
+  args->shm_size = DEFAULT_SHM_SIZE;
+  args->vector_count = 1;
+
+  while ((c = getopt(argc, argv, "hS:M:l:n:")) != -1) {
+    switch (c) {
+    case 'S': /* Socket path */
+      args->socket_path = optarg;
+      break;
+    case 'M': /* Memory file path */
+      args->shm_path = optarg;
+      break;
+    case 'l': /* Memory size */
+      args->shm_size = parse_size(optarg);
+      break;
+    case 'n': /* Vectors */
+      args->vector_count = atoi(optarg);
+      if ((args->vector_count < 1) ||
+          (args->vector_count > IVSHMEM_MAX_VECTORS)) {
+        fprintf(stderr, "-n expects 1 to %d vectors\n", IVSHMEM_MAX_VECTORS);
+        exit(EXIT_FAILURE);
+      }
+      break;
+
+    case 'h': /* help */
+    default:
+      usage(argv[0]);
+      exit(1);
+      break;
+    }
+  }
+}
+
+static int create_memory(ServerArgs *args) {
+  int fd;
+
+  if (args->shm_path)
+    fd = open(args->shm_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  else
+    fd = memfd_create("ivshmem", MFD_CLOEXEC);
+  if (fd < 0) {
+    perror(args->shm_path ? "open()" : "memfd_create()");
+    exit(EXIT_FAILURE);
+  }
+  if (ftruncate(fd, args->shm_size)) {
+    perror("ftruncate()");
+    exit(EXIT_FAILURE);
+  }
+
+  return fd;
+}
+
+static int create_listener(ServerArgs *args) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  int fd;
+
+  if (strlen(args->socket_path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path \"%s\" is too long!\n", args->socket_path);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(address.sun_path, args->socket_path);
+
+  if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+    perror("socket()");
+    exit(EXIT_FAILURE);
+  }
+  /* A previous run may have left its socket behind */
+  if (unlink(args->socket_path) && (errno != ENOENT)) {
+    perror("unlink()");
+    exit(EXIT_FAILURE);
+  }
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address))) {
+    perror("bind()");
+    exit(EXIT_FAILURE);
+  }
+  if (listen(fd, IVSHMEM_MAX_PEERS)) {
+    perror("listen()");
+    exit(EXIT_FAILURE);
+  }
+
+  return fd;
+}
+
+static int is_id_used(int64_t id) {
+  for (int i = 0; i < IVSHMEM_MAX_PEERS; ++i)
+    if (peers[i].id == id)
+      return 1;
+  return 0;
+}
+
+static void add_peer(int listen_fd, int shm_fd, ServerArgs *args) {
+  int socket_fd, index;
+
+  if ((socket_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC)) < 0) {
+    perror("accept4()");
+    exit(EXIT_FAILURE);
+  }
+  for (index = 0; index < IVSHMEM_MAX_PEERS; ++index)
+    if (peers[index].id == -1)
+      break;
+  if (index == IVSHMEM_MAX_PEERS) {
+    fprintf(stderr, "More than %d peers; Refuse the connection\n",
+            IVSHMEM_MAX_PEERS);
+    close(socket_fd);
+    return;
+  }
+
+  IvshmemPeer *peer = &peers[index];
+  while (is_id_used(next_id))
+    next_id = (next_id + 1) % (MAX_PEER_ID + 1);
+  peer->id = next_id;
+  next_id = (next_id + 1) % (MAX_PEER_ID + 1);
+  for (peer->vector_count = 0; peer->vector_count < args->vector_count;
+       ++peer->vector_count)
+    if ((peer->eventfds[peer->vector_count] = eventfd(0, EFD_CLOEXEC)) < 0) {
+      perror("eventfd()");
+      exit(EXIT_FAILURE);
+    }
+  poll_fds[index + 1].fd = socket_fd;
+
+  ivshmem_send_message(socket_fd, IVSHMEM_PROTOCOL_VERSION, -1);
+  ivshmem_send_message(socket_fd, peer->id, -1);
+  ivshmem_send_message(socket_fd, -1, shm_fd);
+
+  /* Introduce the peers to each other */
+  for (int i = 0; i < IVSHMEM_MAX_PEERS; ++i) {
+    if ((i == index) || (peers[i].id == -1))
+      continue;
+    for (int vector = 0; vector < peers[i].vector_count; ++vector)
+      ivshmem_send_message(socket_fd, peers[i].id, peers[i].eventfds[vector]);
+    for (int vector = 0; vector < peer->vector_count; ++vector)
+      ivshmem_send_message(poll_fds[i + 1].fd, peer->id,
+                           peer->eventfds[vector]);
+  }
+
+  /* Its own vectors come last */
+  for (int vector = 0; vector < peer->vector_count; ++vector)
+    ivshmem_send_message(socket_fd, peer->id, peer->eventfds[vector]);
+
+  fprintf(stderr, "Peer %" PRId64 " connected\n", peer->id);
+}
+
+static void remove_peer(int index) {
+  IvshmemPeer *peer = &peers[index];
+
+  for (int i = 0; i < IVSHMEM_MAX_PEERS; ++i)
+    if ((i != index) && (peers[i].id != -1))
+      ivshmem_send_message(poll_fds[i + 1].fd, peer->id, -1);
+
+  for (int vector = 0; vector < peer->vector_count; ++vector)
+    close(peer->eventfds[vector]);
+  close(poll_fds[index + 1].fd);
+  poll_fds[index + 1].fd = -1;
+
+  fprintf(stderr, "Peer %" PRId64 " disconnected\n", peer->id);
+  peer->id = -1;
+  peer->vector_count = 0;
+}
+
+int main(int argc, char *argv[]) {
+  ServerArgs args;
+  parse_args(&args, argc, argv);
+
+  const int shm_fd = create_memory(&args);
+  poll_fds[0].fd = create_listener(&args);
+  poll_fds[0].events = POLLIN;
+  for (int i = 0; i < IVSHMEM_MAX_PEERS; ++i) {
+    peers[i].id = -1;
+    peers[i].vector_count = 0;
+    poll_fds[i + 1].fd = -1;
+    poll_fds[i + 1].events = POLLIN;
+  }
+
+  fprintf(stderr, "Serving %zu bytes with %d vectors per peer on %s\n",
+          args.shm_size, args.vector_count, args.socket_path);
+
+  for (;;) {
+    if (poll(poll_fds, IVSHMEM_MAX_PEERS + 1, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("poll()");
+      exit(EXIT_FAILURE);
+    }
+
+    /**
+     * Peers never talk; anything readable is a hang-up. Messages to a peer
+     * that hung up meanwhile are dropped; its turn comes on the next poll.
+     */
+    for (int i = 0; i < IVSHMEM_MAX_PEERS; ++i) {
+      char byte;
+      if ((poll_fds[i + 1].fd >= 0) && poll_fds[i + 1].revents &&
+          (recv(poll_fds[i + 1].fd, &byte, 1, MSG_DONTWAIT) <= 0))
+        remove_peer(i);
+    }
+
+    if (poll_fds[0].revents & POLLIN)
+      add_peer(poll_fds[0].fd, shm_fd, &args);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -12,39 +12,107 @@
 
 #include "common/common.h"
 #include "common/ivshmem.h"
+#include "common/layout.h"
+#include "common/realtime.h"
+#include "common/stamped.h"
+#include "common/stream.h"
+#include "common/topology.h"
 
-void cleanup(void *shared_memory, size_t size) {
-  if (munmap(shared_memory, size)) {
-    perror("munmap()");
+__attribute__((hot, flatten)) void communicate(IvshmemSlot *slot,
+                                               struct IvshmemArgs *args) {
+  void *buffer = malloc(args->size);
+  if (!buffer) {
+    perror("malloc()");
     exit(EXIT_FAILURE);
   }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  uint32_t *guard = slot->guards[0];
+  void *payload = slot->buffers[0];
+
+  userspace_shm_notify(guard, 's');
+
+  for (; args->count > 0; --args->count) {
+    /* STC */
+    userspace_shm_wait(guard, 'c');
+    memcpy(buffer, payload, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(buffer, args->size, STC_BITS_10101010);
+
+    /* CTS */
+    memset(payload, CTS_BITS_01010101, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(payload, args->size, CTS_BITS_01010101);
+    publish_hint_lines(payload, args->size, args->hint);
+    shm_publish(guard, 's', args->fence);
+  }
+
+  free(buffer);
 }
 
-__attribute__((hot, flatten)) void communicate(void *shared_memory,
-                                               struct IvshmemArgs *args) {
+/* Drains the STC stream; the guard after the buffers' is the handshake */
+__attribute__((hot, flatten)) void
+communicate_stream(IvshmemSlot *slot, struct IvshmemArgs *args) {
+  void *buffer = malloc(args->size);
+  if (!buffer) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  uint32_t *handshake = slot->guards[args->buffer_count];
+  ShmStream rx;
+  shm_stream_init(&rx, slot->guards, slot->buffers, args->buffer_count);
+  shm_stream_set_fence(&rx, args->fence);
+  const size_t chunk = slot->buffer_size;
+
+  userspace_shm_notify(handshake, 's');
+
+  for (; args->count > 0; --args->count) {
+    /* STC, reassembled from its chunks */
+    for (size_t offset = 0; offset < args->size; offset += chunk) {
+      const size_t length =
+          (args->size - offset < chunk) ? args->size - offset : chunk;
+      memcpy(buffer + offset, shm_stream_receive(&rx), length);
+      shm_stream_release(&rx);
+    }
+    if (unlikely(args->is_debug))
+      debug_validate(buffer, args->size, STC_BITS_10101010);
+  }
+
+  userspace_shm_notify(handshake, 'd');
+
+  free(buffer);
+}
+
+/* Answers over stamped lines, reading STC while the server writes it */
+__attribute__((hot, flatten)) void
+communicate_stamped(IvshmemSlot *slot, struct IvshmemArgs *args) {
   void *buffer = malloc(args->size);
   if (!buffer) {
     perror("malloc()");
     exit(EXIT_FAILURE);
   }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
 
-  uint32_t *guard = (uint32_t *)shared_memory;
+  uint32_t *guard = slot->guards[0];
+  void *lines = slot->buffers[0];
+  /* Odd stamps for STC, even ones for CTS; the cleared lines carry 0 */
+  uint32_t stamp = 0;
 
   userspace_shm_notify(guard, 's');
 
   for (; args->count > 0; --args->count) {
     /* STC */
-    userspace_shm_wait(guard, 'c');
-    memcpy(buffer, shared_memory + sizeof(*guard), args->size);
+    stamped_read(buffer, lines, args->size, ++stamp);
     if (unlikely(args->is_debug))
       debug_validate(buffer, args->size, STC_BITS_10101010);
 
     /* CTS */
-    memset(shared_memory + sizeof(*guard), CTS_BITS_01010101, args->size);
-    if (unlikely(args->is_debug))
-      debug_validate(shared_memory + sizeof(*guard), args->size,
-                     CTS_BITS_01010101);
-    userspace_shm_notify(guard, 's');
+    stamped_fill(lines, CTS_BITS_01010101, args->size, ++stamp, args->fence);
   }
 
   free(buffer);
@@ -53,72 +121,48 @@ __attribute__((hot, flatten)) void communicate(void *shared_memory,
 static const char IVSHMEM_MEM_DEFAULT_PATH[] = "/dev/usernet_ivshmem0";
 int main(int argc, char *argv[]) {
   struct IvshmemArgs args;
-  ivshmem_parse_args(&args, argc, argv);
+  ivshmem_parse_args(&args, argc, argv, IVSHMEM_CAP_STAMPED);
+
+  pin_placement(args.client_cpu, args.server_cpu, args.client_cpu);
+  realtime_setup(args.rt_priority, args.is_thp_disabled);
 
   if (!args.mem_dev_path) {
     fprintf(stderr, "No -M option set; Use %s as the memory device path\n",
             IVSHMEM_MEM_DEFAULT_PATH);
     args.mem_dev_path = IVSHMEM_MEM_DEFAULT_PATH;
   }
+  ivshmem_resolve_fence(&args);
+  ivshmem_resolve_hint(&args);
 
   if (args.shmem_index == -1) {
     fprintf(stderr, "No -i option set; Use 0 as the shared memory index\n");
     args.shmem_index = 0;
   }
 
-  int ivshmem_fd;
+  IvshmemRegion region;
   if (args.is_nonblock) {
     fprintf(stderr, "args.is_nonblock == 1\n");
-    ivshmem_fd = open(args.mem_dev_path, O_RDWR | O_ASYNC | O_NONBLOCK);
+    ivshmem_region_open(&region, args.mem_dev_path,
+                        O_RDWR | O_ASYNC | O_NONBLOCK, args.mem_size_force);
   } else
-    ivshmem_fd = open(args.mem_dev_path, O_RDWR | O_ASYNC);
-  if (ivshmem_fd < 0) {
-    perror("open()");
-    exit(EXIT_FAILURE);
-  }
-
-  loff_t ivshmem_mmap_offset = 0;
-  size_t ivshmem_size = 0;
-  if (args.mem_size_force)
-    ivshmem_size = args.mem_size_force;
-  else {
-    struct stat st;
-    if (stat(args.mem_dev_path, &st)) {
-      perror("stat()");
-      exit(EXIT_FAILURE);
-    }
-    ivshmem_size = st.st_size;
-
-    if (!ivshmem_size) {
-      /* Try usernet_ivshmem's way */
-      if (ioctl(ivshmem_fd, IOCTL_GETSIZE, &ivshmem_size) < 0) {
-        perror("ioctl(IOCTL_GETSIZE)");
-        exit(EXIT_FAILURE);
-      }
-      ivshmem_mmap_offset = IVSHMEM_MMAP_MEM_OFFSET;
-    }
-  }
-
-  fprintf(stderr, "ivshmem_size == %lu\n", ivshmem_size);
-  void *shared_memory = mmap(NULL, ivshmem_size, PROT_READ | PROT_WRITE,
-                             MAP_SHARED, ivshmem_fd, ivshmem_mmap_offset);
-  if (shared_memory == MAP_FAILED) {
-    perror("mmap()");
-    exit(EXIT_FAILURE);
-  }
-
-  void *passed_memory =
-      shared_memory + ivshmem_size -
-      ((args.shmem_index + 1) * (args.size + sizeof(uint32_t)));
-
-  communicate(passed_memory, &args);
-
-  cleanup(shared_memory, ivshmem_size);
-
-  if (close(ivshmem_fd)) {
-    perror("close(ivshmem_fd)");
-    exit(EXIT_FAILURE);
-  }
+    ivshmem_region_open(&region, args.mem_dev_path, O_RDWR | O_ASYNC,
+                        args.mem_size_force);
+
+  IvshmemSlot slot;
+  if (args.buffer_count)
+    ivshmem_slot_attach(&slot, &region, &args, args.buffer_count + 1,
+                        args.buffer_count, 0);
+  else
+    ivshmem_slot_attach(&slot, &region, &args, 1, 1, 0);
+
+  if (args.buffer_count)
+    communicate_stream(&slot, &args);
+  else if (args.layout == LAYOUT_STAMPED)
+    communicate_stamped(&slot, &args);
+  else
+    communicate(&slot, &args);
+
+  ivshmem_region_close(&region);
 
   return EXIT_SUCCESS;
 }
@@ -11,50 +11,158 @@
 #include <sys/stat.h>
 
 #include "common/common.h"
+#include "common/interference.h"
 #include "common/ivshmem.h"
+#include "common/layout.h"
+#include "common/realtime.h"
+#include "common/stamped.h"
+#include "common/stream.h"
+#include "common/topology.h"
 
-void cleanup(void *shared_memory, size_t size) {
-  if (munmap(shared_memory, size)) {
-    perror("munmap()");
-    exit(EXIT_FAILURE);
-  }
-}
-
-__attribute__((hot, flatten)) void communicate(void *shared_memory,
+__attribute__((hot, flatten)) void communicate(IvshmemSlot *slot,
                                                struct IvshmemArgs *args) {
   void *buffer = malloc(args->size);
   if (!buffer) {
     perror("malloc()");
     exit(EXIT_FAILURE);
   }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
 
-  uint32_t *guard = (uint32_t *)shared_memory;
+  uint32_t *guard = slot->guards[0];
+  void *payload = slot->buffers[0];
   userspace_shm_notify(guard, 'c');
 
   userspace_shm_wait(guard, 's');
 
+  interference_start(args->interference);
+
   struct Benchmarks bench;
-  setup_benchmarks(&bench);
+  setup_benchmarks(&bench, args->count);
 
-  for (int message = 0; message < args->count; ++message) {
+  for (uint64_t message = 0; message < args->count; ++message) {
     bench.single_start = now();
 
     /* STC */
-    memset(shared_memory + sizeof(*guard), STC_BITS_10101010, args->size);
+    memset(payload, STC_BITS_10101010, args->size);
     if (args->is_debug)
-      debug_validate(shared_memory + sizeof(*guard), args->size,
-                     STC_BITS_10101010);
-    userspace_shm_notify(guard, 'c');
+      debug_validate(payload, args->size, STC_BITS_10101010);
+    publish_hint_lines(payload, args->size, args->hint);
+    shm_publish(guard, 'c', args->fence);
 
     /* CTS */
     userspace_shm_wait(guard, 's');
-    memcpy(buffer, shared_memory + sizeof(*guard), args->size);
+    memcpy(buffer, payload, args->size);
     if (args->is_debug)
       debug_validate(buffer, args->size, CTS_BITS_01010101);
 
     benchmark(&bench);
   }
 
+  interference_stop();
+
+  struct Arguments tmp_arg;
+  tmp_arg.count = args->count;
+  tmp_arg.size = args->size;
+  evaluate(&bench, &tmp_arg);
+
+  free(buffer);
+}
+
+/* Streams STC through the buffers; the guard after theirs is the handshake */
+__attribute__((hot, flatten)) void
+communicate_stream(IvshmemSlot *slot, struct IvshmemArgs *args) {
+  uint32_t *handshake = slot->guards[args->buffer_count];
+  ShmStream tx;
+  shm_stream_init(&tx, slot->guards, slot->buffers, args->buffer_count);
+  shm_stream_set_fence(&tx, args->fence);
+  const size_t chunk = slot->buffer_size;
+
+  userspace_shm_wait(handshake, 's');
+
+  interference_start(args->interference);
+
+  struct Benchmarks bench;
+  setup_benchmarks(&bench, args->count);
+
+  for (uint64_t message = 0; message < args->count; ++message) {
+    bench.single_start = now();
+
+    /* STC chunk by chunk, while the client drains the previous buffers */
+    for (size_t offset = 0; offset < args->size; offset += chunk) {
+      const size_t length =
+          (args->size - offset < chunk) ? args->size - offset : chunk;
+      void *payload = shm_stream_acquire(&tx);
+      memset(payload, STC_BITS_10101010, length);
+      if (unlikely(args->is_debug))
+        debug_validate(payload, length, STC_BITS_10101010);
+      publish_hint_lines(payload, length, args->hint);
+      shm_stream_publish(&tx);
+    }
+
+    benchmark(&bench);
+  }
+
+  /* Until the client has copied out the last message */
+  userspace_shm_wait(handshake, 'd');
+  const bench_t stream_time = now() - bench.total_start;
+
+  interference_stop();
+
+  benchmark_tag("Buffers", "%d", args->buffer_count);
+  if (chunk < args->size)
+    benchmark_tag("Chunk size", "%zu", chunk);
+  benchmark_tag("Stream throughput", "%.3f MB/s",
+                ((double)args->count * args->size) / (stream_time / 1e9) /
+                    1e6);
+
+  struct Arguments tmp_arg;
+  tmp_arg.count = args->count;
+  tmp_arg.size = args->size;
+  evaluate(&bench, &tmp_arg);
+}
+
+/* Ping-pong over stamped lines; the guard only tells that the client is up */
+__attribute__((hot, flatten)) void
+communicate_stamped(IvshmemSlot *slot, struct IvshmemArgs *args) {
+  void *buffer = malloc(args->size);
+  if (!buffer) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  uint32_t *guard = slot->guards[0];
+  void *lines = slot->buffers[0];
+  /* Odd stamps for STC, even ones for CTS; the cleared lines carry 0 */
+  uint32_t stamp = 0;
+
+  userspace_shm_wait(guard, 's');
+
+  interference_start(args->interference);
+
+  struct Benchmarks bench;
+  setup_benchmarks(&bench, args->count);
+
+  for (uint64_t message = 0; message < args->count; ++message) {
+    bench.single_start = now();
+
+    /* STC */
+    stamped_fill(lines, STC_BITS_10101010, args->size, ++stamp, args->fence);
+
+    /* CTS, copied line by line while the client still writes the rest */
+    stamped_read(buffer, lines, args->size, ++stamp);
+    if (unlikely(args->is_debug))
+      debug_validate(buffer, args->size, CTS_BITS_01010101);
+
+    benchmark(&bench);
+  }
+
+  interference_stop();
+
+  benchmark_tag("Payload per line", "%zu B", STAMPED_LINE_DATA);
+
   struct Arguments tmp_arg;
   tmp_arg.count = args->count;
   tmp_arg.size = args->size;
@@ -66,73 +174,48 @@ __attribute__((hot, flatten)) void communicate(void *shared_memory,
 static const char IVSHMEM_MEM_DEFAULT_PATH[] = "/dev/usernet_ivshmem0";
 int main(int argc, char *argv[]) {
   struct IvshmemArgs args;
-  ivshmem_parse_args(&args, argc, argv);
+  ivshmem_parse_args(&args, argc, argv, IVSHMEM_CAP_STAMPED);
+
+  pin_placement(args.server_cpu, args.server_cpu, args.client_cpu);
+  realtime_setup(args.rt_priority, args.is_thp_disabled);
 
   if (!args.mem_dev_path) {
     fprintf(stderr, "No -M option set; Use %s as the memory device path\n",
             IVSHMEM_MEM_DEFAULT_PATH);
     args.mem_dev_path = IVSHMEM_MEM_DEFAULT_PATH;
   }
+  ivshmem_resolve_fence(&args);
+  ivshmem_resolve_hint(&args);
 
   if (args.shmem_index == -1) {
     fprintf(stderr, "No -i option set; Use 0 as the shared memory index\n");
     args.shmem_index = 0;
   }
 
-  int ivshmem_fd;
+  IvshmemRegion region;
   if (args.is_nonblock) {
     fprintf(stderr, "args.is_nonblock == 1\n");
-    ivshmem_fd = open(args.mem_dev_path, O_RDWR | O_ASYNC | O_NONBLOCK);
+    ivshmem_region_open(&region, args.mem_dev_path,
+                        O_RDWR | O_ASYNC | O_NONBLOCK, args.mem_size_force);
   } else
-    ivshmem_fd = open(args.mem_dev_path, O_RDWR | O_ASYNC);
-  if (ivshmem_fd < 0) {
-    perror("open()");
-    exit(EXIT_FAILURE);
-  }
-
-  loff_t ivshmem_mmap_offset = 0;
-  size_t ivshmem_size = 0;
-  if (args.mem_size_force)
-    ivshmem_size = args.mem_size_force;
-  else {
-    struct stat st;
-    if (stat(args.mem_dev_path, &st)) {
-      perror("stat()");
-      exit(EXIT_FAILURE);
-    }
-    ivshmem_size = st.st_size;
-
-    if (!ivshmem_size) {
-      /* Try usernet_ivshmem's way */
-      if (ioctl(ivshmem_fd, IOCTL_GETSIZE, &ivshmem_size) < 0) {
-        perror("ioctl(IOCTL_GETSIZE)");
-        exit(EXIT_FAILURE);
-      }
-      ivshmem_mmap_offset = IVSHMEM_MMAP_MEM_OFFSET;
-    }
-  }
-
-  fprintf(stderr, "ivshmem_size == %lu\n", ivshmem_size);
-  void *shared_memory = mmap(NULL, ivshmem_size, PROT_READ | PROT_WRITE,
-                             MAP_SHARED, ivshmem_fd, ivshmem_mmap_offset);
-  if (shared_memory == MAP_FAILED) {
-    perror("mmap()");
-    exit(EXIT_FAILURE);
-  }
-
-  void *passed_memory =
-      shared_memory + ivshmem_size -
-      ((args.shmem_index + 1) * (args.size + sizeof(uint32_t)));
-  memset(passed_memory, 0, args.size + sizeof(uint32_t));
-
-  communicate(passed_memory, &args);
-
-  cleanup(shared_memory, ivshmem_size);
-
-  if (close(ivshmem_fd)) {
-    perror("close(ivshmem_fd)");
-    exit(EXIT_FAILURE);
-  }
+    ivshmem_region_open(&region, args.mem_dev_path, O_RDWR | O_ASYNC,
+                        args.mem_size_force);
+
+  IvshmemSlot slot;
+  if (args.buffer_count)
+    ivshmem_slot_attach(&slot, &region, &args, args.buffer_count + 1,
+                        args.buffer_count, 1);
+  else
+    ivshmem_slot_attach(&slot, &region, &args, 1, 1, 1);
+
+  if (args.buffer_count)
+    communicate_stream(&slot, &args);
+  else if (args.layout == LAYOUT_STAMPED)
+    communicate_stamped(&slot, &args);
+  else
+    communicate(&slot, &args);
+
+  ivshmem_region_close(&region);
 
   return EXIT_SUCCESS;
 }
@@ -11,21 +11,21 @@
 
 #include "common/common.h"
 #include "common/ivshmem.h"
+#include "common/layout.h"
+#include "common/pending.h"
+#include "common/realtime.h"
+#include "common/stream.h"
+#include "common/topology.h"
 
-void cleanup(void *shared_memory, size_t size) {
-  if (munmap(shared_memory, size)) {
-    perror("munmap()");
-    exit(EXIT_FAILURE);
-  }
-}
-
-__attribute__((hot, flatten)) void communicate(int fd, void *shared_memory,
+__attribute__((hot, flatten)) void communicate(int fd, IvshmemSlot *slot,
                                                struct IvshmemArgs *args) {
   void *buffer = malloc(args->size);
   if (!buffer) {
     perror("malloc()");
     exit(EXIT_FAILURE);
   }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
 
   struct ivshmem_reg *reg_ptr =
       mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
@@ -36,25 +36,36 @@ __attribute__((hot, flatten)) void communicate(int fd, void *shared_memory,
 
   fprintf(stderr, "reg_ptr->ivposition == %d\n", reg_ptr->ivposition);
 
-  uint32_t *guard = (uint32_t *)shared_memory;
+  uint32_t *guard = slot->guards[0];
+  void *payload = slot->buffers[0];
+
+  UioUring uio, *uring = NULL;
+  if (args->uio_wait_mode != UIO_WAIT_READ) {
+    uio_uring_init(&uio, fd, args);
+    uring = &uio;
+  }
+  EventLoop loop, *waiter = ivshmem_waiter_init(&loop, fd, args);
 
   uio_notify(guard, 's', reg_ptr, args);
 
   for (; args->count > 0; --args->count) {
     /* STC */
-    uio_wait(fd, guard, 'c', reg_ptr, args);
-    memcpy(buffer, shared_memory + sizeof(*guard), args->size);
+    uio_wait(fd, uring, waiter, guard, 'c', reg_ptr, args);
+    memcpy(buffer, payload, args->size);
     if (unlikely(args->is_debug))
       debug_validate(buffer, args->size, STC_BITS_10101010);
 
     /* CTS */
-    memset(shared_memory + sizeof(*guard), CTS_BITS_01010101, args->size);
+    memset(payload, CTS_BITS_01010101, args->size);
     if (unlikely(args->is_debug))
-      debug_validate(shared_memory + sizeof(*guard), args->size,
-                     CTS_BITS_01010101);
+      debug_validate(payload, args->size, CTS_BITS_01010101);
     uio_notify(guard, 's', reg_ptr, args);
   }
 
+  if (uring)
+    uio_uring_close(uring);
+  ivshmem_waiter_close(waiter);
+
   if (munmap(reg_ptr, 256)) {
     perror("munmap()");
     exit(EXIT_FAILURE);
@@ -63,12 +74,248 @@ __attribute__((hot, flatten)) void communicate(int fd, void *shared_memory,
   free(buffer);
 }
 
+/* Drains the STC stream; the guard after the buffers' is the handshake */
+__attribute__((hot, flatten)) void
+communicate_stream(int fd, IvshmemSlot *slot, struct IvshmemArgs *args) {
+  void *buffer = malloc(args->size);
+  if (!buffer) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  uint32_t *handshake = slot->guards[args->buffer_count];
+  ShmStream rx;
+  shm_stream_init(&rx, slot->guards, slot->buffers, args->buffer_count);
+  shm_stream_set_fence(&rx, args->fence);
+  const size_t chunk = slot->buffer_size;
+
+  struct ivshmem_reg *reg_ptr =
+      mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (reg_ptr == MAP_FAILED) {
+    perror("mmap()");
+    exit(EXIT_FAILURE);
+  }
+
+  /* Interrupts coalesce, so the stream re-checks its guards on wake-up */
+  EventLoop loop;
+  UioDoorbell doorbell = {.fd = fd,
+                          .waiter = ivshmem_waiter_init(&loop, fd, args),
+                          .reg_ptr = reg_ptr,
+                          .args = args};
+  shm_stream_set_doorbell(&rx, uio_doorbell_wait, uio_doorbell_notify,
+                          &doorbell);
+
+  userspace_shm_notify(handshake, 's');
+  uio_doorbell_notify(&doorbell);
+
+  for (; args->count > 0; --args->count) {
+    /* STC, reassembled from its chunks */
+    for (size_t offset = 0; offset < args->size; offset += chunk) {
+      const size_t length =
+          (args->size - offset < chunk) ? args->size - offset : chunk;
+      memcpy(buffer + offset, shm_stream_receive(&rx), length);
+      shm_stream_release(&rx);
+    }
+    if (unlikely(args->is_debug))
+      debug_validate(buffer, args->size, STC_BITS_10101010);
+  }
+
+  userspace_shm_notify(handshake, 'd');
+  uio_doorbell_notify(&doorbell);
+  ivshmem_waiter_close(doorbell.waiter);
+
+  if (munmap(reg_ptr, 256)) {
+    perror("munmap()");
+    exit(EXIT_FAILURE);
+  }
+
+  free(buffer);
+}
+
+typedef struct ChannelGroup {
+  IvshmemSlot *slots;
+  void *buffer;
+  struct IvshmemArgs *args;
+} ChannelGroup;
+
+static void serve_channel(int channel, void *context) {
+  ChannelGroup *group = context;
+  IvshmemSlot *slot = &group->slots[channel];
+  struct IvshmemArgs *args = group->args;
+
+  /* STC */
+  memcpy(group->buffer, slot->buffers[0], args->size);
+  if (unlikely(args->is_debug))
+    debug_validate(group->buffer, args->size, STC_BITS_10101010);
+
+  /* CTS */
+  memset(slot->buffers[0], CTS_BITS_01010101, args->size);
+  if (unlikely(args->is_debug))
+    debug_validate(slot->buffers[0], args->size, CTS_BITS_01010101);
+  pending_post(slot->pending[LAYOUT_TO_SERVER], channel);
+}
+
+/* Answers a whole group of channels behind a single interrupt */
+__attribute__((hot, flatten)) void
+communicate_channels(int fd, IvshmemSlot *slots, struct IvshmemArgs *args) {
+  void *buffer = malloc(args->size);
+  if (!buffer) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  struct ivshmem_reg *reg_ptr =
+      mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (reg_ptr == MAP_FAILED) {
+    perror("mmap()");
+    exit(EXIT_FAILURE);
+  }
+  EventLoop loop;
+  UioDoorbell doorbell = {.fd = fd,
+                          .waiter = ivshmem_waiter_init(&loop, fd, args),
+                          .reg_ptr = reg_ptr,
+                          .args = args};
+
+  uint32_t *to_client = slots[0].pending[LAYOUT_TO_CLIENT];
+  ChannelGroup group = {.slots = slots, .buffer = buffer, .args = args};
+
+  for (int channel = 0; channel < args->channel_count; ++channel)
+    pending_post(slots[0].pending[LAYOUT_TO_SERVER], channel);
+  uio_doorbell_notify(&doorbell);
+
+  for (uint64_t served = 0; served < args->count * args->channel_count;) {
+    served += pending_dispatch(to_client, fd, sizeof(uint32_t),
+                               doorbell.waiter, serve_channel, &group);
+    /* One interrupt for all the channels served on this wake-up */
+    uio_doorbell_notify(&doorbell);
+  }
+
+  ivshmem_waiter_close(doorbell.waiter);
+  if (munmap(reg_ptr, 256)) {
+    perror("munmap()");
+    exit(EXIT_FAILURE);
+  }
+
+  free(buffer);
+}
+
+typedef struct LoopChannel {
+  EventSource source;
+  IvshmemSlot *slot;
+  /* The vector of the channel's slot (see uio_open_channel()) */
+  int vector;
+  struct ivshmem_reg *reg_ptr;
+  struct IvshmemArgs *args;
+
+  /* Shared by all channels of the loop */
+  void *buffer;
+  uint64_t *answered;
+} LoopChannel;
+
+static void answer_loop_channel(EventSource *source) {
+  LoopChannel *channel = source->context;
+  struct IvshmemArgs *args = channel->args;
+  void *payload = channel->slot->buffers[0];
+
+  /* A coalesced or stale wake-up; the server has not sent anything new */
+  if (shm_consume(channel->slot->guards[0]) != 'c')
+    return;
+
+  /* STC */
+  memcpy(channel->buffer, payload, args->size);
+  if (unlikely(args->is_debug))
+    debug_validate(channel->buffer, args->size, STC_BITS_10101010);
+
+  /* CTS */
+  memset(payload, CTS_BITS_01010101, args->size);
+  if (unlikely(args->is_debug))
+    debug_validate(payload, args->size, CTS_BITS_01010101);
+  shm_publish(channel->slot->guards[0], 's', args->fence);
+  channel->reg_ptr->doorbell =
+      IVSHMEM_DOORBELL_MSG(args->peer_id, channel->vector);
+  ++*channel->answered;
+}
+
+/* Answers every channel from this one thread, whichever rings */
+__attribute__((hot, flatten)) void
+communicate_loop(int fd, IvshmemSlot *slots, struct IvshmemArgs *args) {
+  const int count = args->loop_channel_count;
+  void *buffer = malloc(args->size);
+  LoopChannel *channels = calloc(count, sizeof(LoopChannel));
+  if (!buffer || !channels) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  struct ivshmem_reg *reg_ptr =
+      mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (reg_ptr == MAP_FAILED) {
+    perror("mmap()");
+    exit(EXIT_FAILURE);
+  }
+
+  EventLoop loop;
+  uint64_t answered = 0;
+  event_loop_init(&loop);
+
+  for (int i = 0; i < count; ++i) {
+    LoopChannel *channel = &channels[i];
+    channel->slot = &slots[i];
+    channel->vector = args->shmem_index + i;
+    channel->reg_ptr = reg_ptr;
+    channel->args = args;
+    channel->buffer = buffer;
+    channel->answered = &answered;
+
+    channel->source.fd = i ? uio_open_channel(args, i) : fd;
+    channel->source.event_size = sizeof(uint32_t);
+    channel->source.handler = answer_loop_channel;
+    channel->source.context = channel;
+    event_loop_add(&loop, &channel->source);
+  }
+
+  /* Every device is open; the server may start on channel 0 */
+  shm_publish(slots[0].guards[0], 's', args->fence);
+  reg_ptr->doorbell = IVSHMEM_DOORBELL_MSG(args->peer_id, 0);
+
+  while (answered < args->count * count)
+    event_loop_run_once(&loop, -1);
+
+  event_loop_close(&loop);
+  for (int i = 1; i < count; ++i)
+    if (close(channels[i].source.fd)) {
+      perror("close()");
+      exit(EXIT_FAILURE);
+    }
+  if (munmap(reg_ptr, 256)) {
+    perror("munmap()");
+    exit(EXIT_FAILURE);
+  }
+
+  free(channels);
+  free(buffer);
+}
+
 static const char IVSHMEM_INTR_DEFAULT_PATH[] = "/dev/uio0";
 static const char IVSHMEM_MEM_DEFAULT_PATH[] =
     "/sys/class/uio/uio0/device/resource2_wc";
 int main(int argc, char *argv[]) {
   struct IvshmemArgs args;
-  ivshmem_parse_args(&args, argc, argv);
+  ivshmem_parse_args(&args, argc, argv, IVSHMEM_CAP_EVENT_LOOP);
+  if ((args.uio_wait_mode != UIO_WAIT_READ) &&
+      (args.loop_channel_count || args.channel_count || args.buffer_count)) {
+    fprintf(stderr, "Only ping-pong waits on io_uring; Use -u read\n");
+    args.uio_wait_mode = UIO_WAIT_READ;
+  }
+
+  pin_placement(args.client_cpu, args.server_cpu, args.client_cpu);
+  realtime_setup(args.rt_priority, args.is_thp_disabled);
 
   if (!args.intr_dev_path) {
     fprintf(stderr, "No -I option set; Use %s as the interrupt device path\n",
@@ -80,6 +327,7 @@ int main(int argc, char *argv[]) {
             IVSHMEM_MEM_DEFAULT_PATH);
     args.mem_dev_path = IVSHMEM_MEM_DEFAULT_PATH;
   }
+  ivshmem_resolve_fence(&args);
 
   if (args.peer_id == -1) {
     fprintf(stderr,
@@ -92,6 +340,7 @@ int main(int argc, char *argv[]) {
     args.shmem_index = 0;
   }
 
+  bench_t open_start = now();
   int ivshmem_uiofd;
   if (args.is_nonblock) {
     fprintf(stderr, "args.is_nonblock == 1\n");
@@ -108,20 +357,22 @@ int main(int argc, char *argv[]) {
     perror("stat()");
     exit(EXIT_FAILURE);
   }
-  size_t ivshmem_size = st.st_size;
-  fprintf(stderr, "ivshmem_size == %lu\n", ivshmem_size);
+  /* UIO selects the BAR by mmap() offset and maps it only as a whole */
+  IvshmemRegion region;
+  ivshmem_region_init(&region, ivshmem_uiofd, st.st_size,
+                      IVSHMEM_MMAP_MEM_OFFSET, 0);
+  region.open_time = now() - open_start;
 
-  void *shared_memory =
-      mmap(NULL, ivshmem_size, PROT_READ | PROT_WRITE, MAP_SHARED,
-           ivshmem_uiofd, IVSHMEM_MMAP_MEM_OFFSET);
-  if (shared_memory == MAP_FAILED) {
-    perror("mmap()");
-    exit(EXIT_FAILURE);
-  }
-
-  void *passed_memory =
-      shared_memory + ivshmem_size -
-      ((args.shmem_index + 1) * (args.size + sizeof(uint32_t)));
+  IvshmemSlot slots[LAYOUT_MAX_SLOTS], *slot = &slots[0];
+  if (args.loop_channel_count)
+    ivshmem_group_attach(slots, args.loop_channel_count, &region, &args, 0);
+  else if (args.channel_count)
+    ivshmem_group_attach(slots, args.channel_count, &region, &args, 0);
+  else if (args.buffer_count)
+    ivshmem_slot_attach(slot, &region, &args, args.buffer_count + 1,
+                        args.buffer_count, 0);
+  else
+    ivshmem_slot_attach(slot, &region, &args, 1, 1, 0);
 
   int flags = fcntl(ivshmem_uiofd, F_GETFL, 0);
   if (flags == -1) {
@@ -168,14 +419,16 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "flags & O_NONBLOCK == %d\n", flags & O_NONBLOCK);
   }
 
-  communicate(ivshmem_uiofd, passed_memory, &args);
+  if (args.loop_channel_count)
+    communicate_loop(ivshmem_uiofd, slots, &args);
+  else if (args.channel_count)
+    communicate_channels(ivshmem_uiofd, slots, &args);
+  else if (args.buffer_count)
+    communicate_stream(ivshmem_uiofd, slot, &args);
+  else
+    communicate(ivshmem_uiofd, slot, &args);
 
-  cleanup(shared_memory, ivshmem_size);
-
-  if (close(ivshmem_uiofd)) {
-    perror("close(ivshmem_uiofd)");
-    exit(EXIT_FAILURE);
-  }
+  ivshmem_region_close(&region);
 
   return EXIT_SUCCESS;
 }
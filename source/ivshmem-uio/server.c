@@ -10,22 +10,23 @@
 #include <sys/stat.h>
 
 #include "common/common.h"
+#include "common/interference.h"
 #include "common/ivshmem.h"
+#include "common/layout.h"
+#include "common/pending.h"
+#include "common/realtime.h"
+#include "common/stream.h"
+#include "common/topology.h"
 
-void cleanup(void *shared_memory, size_t size) {
-  if (munmap(shared_memory, size)) {
-    perror("munmap()");
-    exit(EXIT_FAILURE);
-  }
-}
-
-__attribute__((hot, flatten)) void communicate(int fd, void *shared_memory,
+__attribute__((hot, flatten)) void communicate(int fd, IvshmemSlot *slot,
                                                struct IvshmemArgs *args) {
   void *buffer = malloc(args->size);
   if (!buffer) {
     perror("malloc()");
     exit(EXIT_FAILURE);
   }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
 
   struct ivshmem_reg *reg_ptr =
       mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
@@ -36,35 +37,55 @@ __attribute__((hot, flatten)) void communicate(int fd, void *shared_memory,
 
   fprintf(stderr, "reg_ptr->ivposition == %d\n", reg_ptr->ivposition);
 
-  uint32_t *guard = (uint32_t *)shared_memory;
+  uint32_t *guard = slot->guards[0];
+  void *payload = slot->buffers[0];
+
+  UioUring uio, *uring = NULL;
+  if (args->uio_wait_mode != UIO_WAIT_READ) {
+    uio_uring_init(&uio, fd, args);
+    uring = &uio;
+  }
+  EventLoop loop, *waiter = ivshmem_waiter_init(&loop, fd, args);
   userspace_shm_notify(guard, 'c');
 
-  uio_wait(fd, guard, 's', reg_ptr, args);
+  uio_wait(fd, uring, waiter, guard, 's', reg_ptr, args);
+
+  interference_start(args->interference);
 
   struct Benchmarks bench;
-  setup_benchmarks(&bench);
+  setup_benchmarks(&bench, args->count);
 
-  for (int message = 0; message < args->count; ++message) {
+  for (uint64_t message = 0; message < args->count; ++message) {
     bench.single_start = now();
 
     /* STC */
-    memset(shared_memory + sizeof(*guard), STC_BITS_10101010, args->size);
+    memset(payload, STC_BITS_10101010, args->size);
     if (unlikely(args->is_debug))
-      debug_validate(shared_memory + sizeof(*guard), args->size,
-                     STC_BITS_10101010);
+      debug_validate(payload, args->size, STC_BITS_10101010);
     uio_notify(guard, 'c', reg_ptr, args);
 
     /* Write END */
 
     /* CTS */
-    uio_wait(fd, guard, 's', reg_ptr, args);
-    memcpy(buffer, shared_memory + sizeof(*guard), args->size);
+    uio_wait(fd, uring, waiter, guard, 's', reg_ptr, args);
+    memcpy(buffer, payload, args->size);
     if (unlikely(args->is_debug))
       debug_validate(buffer, args->size, CTS_BITS_01010101);
 
     benchmark(&bench);
   }
 
+  interference_stop();
+
+  benchmark_tag("UIO wait", "%s", uio_wait_mode_name(args->uio_wait_mode));
+  if (uring) {
+    /* The posts the ring made on its own did not cost a syscall */
+    benchmark_tag("io_uring enters per message", "%.3f",
+                  (double)uring->ring.enter_count / args->count);
+    uio_uring_close(uring);
+  }
+  ivshmem_waiter_close(waiter);
+
   struct Arguments tmp_arg;
   tmp_arg.count = args->count;
   tmp_arg.size = args->size;
@@ -78,12 +99,330 @@ __attribute__((hot, flatten)) void communicate(int fd, void *shared_memory,
   free(buffer);
 }
 
+/* Streams STC through the buffers; the guard after theirs is the handshake */
+__attribute__((hot, flatten)) void
+communicate_stream(int fd, IvshmemSlot *slot, struct IvshmemArgs *args) {
+  uint32_t *handshake = slot->guards[args->buffer_count];
+  ShmStream tx;
+  shm_stream_init(&tx, slot->guards, slot->buffers, args->buffer_count);
+  shm_stream_set_fence(&tx, args->fence);
+  const size_t chunk = slot->buffer_size;
+
+  struct ivshmem_reg *reg_ptr =
+      mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (reg_ptr == MAP_FAILED) {
+    perror("mmap()");
+    exit(EXIT_FAILURE);
+  }
+
+  /* Interrupts coalesce, so the stream re-checks its guards on wake-up */
+  EventLoop loop;
+  UioDoorbell doorbell = {.fd = fd,
+                          .waiter = ivshmem_waiter_init(&loop, fd, args),
+                          .reg_ptr = reg_ptr,
+                          .args = args};
+  shm_stream_set_doorbell(&tx, uio_doorbell_wait, uio_doorbell_notify,
+                          &doorbell);
+
+  uio_doorbell_wait(handshake, 's', &doorbell);
+
+  interference_start(args->interference);
+
+  struct Benchmarks bench;
+  setup_benchmarks(&bench, args->count);
+
+  for (uint64_t message = 0; message < args->count; ++message) {
+    bench.single_start = now();
+
+    /* STC chunk by chunk, while the client drains the previous buffers */
+    for (size_t offset = 0; offset < args->size; offset += chunk) {
+      const size_t length =
+          (args->size - offset < chunk) ? args->size - offset : chunk;
+      void *payload = shm_stream_acquire(&tx);
+      memset(payload, STC_BITS_10101010, length);
+      if (unlikely(args->is_debug))
+        debug_validate(payload, length, STC_BITS_10101010);
+      shm_stream_publish(&tx);
+    }
+
+    benchmark(&bench);
+  }
+
+  /* Until the client has copied out the last message */
+  uio_doorbell_wait(handshake, 'd', &doorbell);
+  const bench_t stream_time = now() - bench.total_start;
+
+  interference_stop();
+
+  benchmark_tag("Buffers", "%d", args->buffer_count);
+  if (chunk < args->size)
+    benchmark_tag("Chunk size", "%zu", chunk);
+  benchmark_tag("Stream throughput", "%.3f MB/s",
+                ((double)args->count * args->size) / (stream_time / 1e9) /
+                    1e6);
+
+  struct Arguments tmp_arg;
+  tmp_arg.count = args->count;
+  tmp_arg.size = args->size;
+  evaluate(&bench, &tmp_arg);
+  ivshmem_waiter_close(doorbell.waiter);
+
+  if (munmap(reg_ptr, 256)) {
+    perror("munmap()");
+    exit(EXIT_FAILURE);
+  }
+}
+
+typedef struct ChannelGroup {
+  IvshmemSlot *slots;
+  void *buffer;
+  struct IvshmemArgs *args;
+  /* Before, a pending channel only means that the client is ready */
+  int is_running;
+} ChannelGroup;
+
+static void receive_channel(int channel, void *context) {
+  ChannelGroup *group = context;
+
+  if (!group->is_running)
+    return;
+  memcpy(group->buffer, group->slots[channel].buffers[0], group->args->size);
+  if (unlikely(group->args->is_debug))
+    debug_validate(group->buffer, group->args->size, CTS_BITS_01010101);
+}
+
+/* Ping-pong on a whole group of channels behind a single interrupt */
+__attribute__((hot, flatten)) void
+communicate_channels(int fd, IvshmemSlot *slots, struct IvshmemArgs *args) {
+  void *buffer = malloc(args->size);
+  if (!buffer) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  struct ivshmem_reg *reg_ptr =
+      mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (reg_ptr == MAP_FAILED) {
+    perror("mmap()");
+    exit(EXIT_FAILURE);
+  }
+  EventLoop loop;
+  UioDoorbell doorbell = {.fd = fd,
+                          .waiter = ivshmem_waiter_init(&loop, fd, args),
+                          .reg_ptr = reg_ptr,
+                          .args = args};
+
+  uint32_t *to_server = slots[0].pending[LAYOUT_TO_SERVER];
+  uint32_t *to_client = slots[0].pending[LAYOUT_TO_CLIENT];
+  ChannelGroup group = {.slots = slots, .buffer = buffer, .args = args};
+  uint64_t wakeups = 0;
+
+  for (int ready = 0; ready < args->channel_count;)
+    ready += pending_dispatch(to_server, fd, sizeof(uint32_t),
+                              doorbell.waiter, receive_channel, &group);
+  group.is_running = 1;
+
+  interference_start(args->interference);
+
+  struct Benchmarks bench;
+  setup_benchmarks(&bench, args->count);
+
+  for (uint64_t message = 0; message < args->count; ++message) {
+    bench.single_start = now();
+
+    /* STC on every channel, announced by one interrupt */
+    for (int channel = 0; channel < args->channel_count; ++channel) {
+      void *payload = slots[channel].buffers[0];
+      memset(payload, STC_BITS_10101010, args->size);
+      if (unlikely(args->is_debug))
+        debug_validate(payload, args->size, STC_BITS_10101010);
+      pending_post(to_client, channel);
+    }
+    uio_doorbell_notify(&doorbell);
+
+    /* CTS, in whatever order and batches the channels answer */
+    for (int answered = 0; answered < args->channel_count; ++wakeups)
+      answered += pending_dispatch(to_server, fd, sizeof(uint32_t),
+                                   doorbell.waiter, receive_channel, &group);
+
+    benchmark(&bench);
+  }
+
+  interference_stop();
+
+  benchmark_tag("Channels", "%d", args->channel_count);
+  benchmark_tag("Channels per wake-up", "%.2f",
+                (double)args->count * args->channel_count / wakeups);
+
+  struct Arguments tmp_arg;
+  tmp_arg.count = args->count;
+  tmp_arg.size = args->size;
+  evaluate(&bench, &tmp_arg);
+
+  ivshmem_waiter_close(doorbell.waiter);
+  if (munmap(reg_ptr, 256)) {
+    perror("munmap()");
+    exit(EXIT_FAILURE);
+  }
+
+  free(buffer);
+}
+
+typedef struct LoopChannel {
+  EventSource source;
+  IvshmemSlot *slot;
+  /* The vector of the channel's slot (see uio_open_channel()) */
+  int vector;
+  struct ivshmem_reg *reg_ptr;
+  struct IvshmemArgs *args;
+
+  uint64_t remaining;
+  bench_t sent_at;
+
+  /* Shared by all channels of the loop */
+  void *buffer;
+  Benchmarks *bench;
+  uint64_t *received;
+} LoopChannel;
+
+static void send_loop_channel(LoopChannel *channel) {
+  struct IvshmemArgs *args = channel->args;
+  void *payload = channel->slot->buffers[0];
+
+  channel->sent_at = now();
+  memset(payload, STC_BITS_10101010, args->size);
+  if (unlikely(args->is_debug))
+    debug_validate(payload, args->size, STC_BITS_10101010);
+  shm_publish(channel->slot->guards[0], 'c', args->fence);
+  channel->reg_ptr->doorbell =
+      IVSHMEM_DOORBELL_MSG(args->peer_id, channel->vector);
+}
+
+static void receive_loop_channel(EventSource *source) {
+  LoopChannel *channel = source->context;
+  struct IvshmemArgs *args = channel->args;
+
+  /* A coalesced or stale wake-up; the client has not answered yet */
+  if (shm_consume(channel->slot->guards[0]) != 's')
+    return;
+
+  memcpy(channel->buffer, channel->slot->buffers[0], args->size);
+  if (unlikely(args->is_debug))
+    debug_validate(channel->buffer, args->size, CTS_BITS_01010101);
+  channel->bench->single_start = channel->sent_at;
+  benchmark(channel->bench);
+  ++*channel->received;
+
+  if (--channel->remaining)
+    send_loop_channel(channel);
+}
+
+/* Ping-pong on every channel at once, all served by this one thread */
+__attribute__((hot, flatten)) void
+communicate_loop(int fd, IvshmemSlot *slots, struct IvshmemArgs *args) {
+  const int count = args->loop_channel_count;
+  void *buffer = malloc(args->size);
+  LoopChannel *channels = calloc(count, sizeof(LoopChannel));
+  if (!buffer || !channels) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  struct ivshmem_reg *reg_ptr =
+      mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (reg_ptr == MAP_FAILED) {
+    perror("mmap()");
+    exit(EXIT_FAILURE);
+  }
+
+  struct Benchmarks bench;
+  EventLoop loop;
+  uint64_t received = 0;
+  event_loop_init(&loop);
+
+  for (int i = 0; i < count; ++i) {
+    LoopChannel *channel = &channels[i];
+    channel->slot = &slots[i];
+    channel->vector = args->shmem_index + i;
+    channel->reg_ptr = reg_ptr;
+    channel->args = args;
+    channel->remaining = args->count;
+    channel->buffer = buffer;
+    channel->bench = &bench;
+    channel->received = &received;
+
+    channel->source.fd = i ? uio_open_channel(args, i) : fd;
+    channel->source.event_size = sizeof(uint32_t);
+    channel->source.handler = receive_loop_channel;
+    channel->source.context = channel;
+    event_loop_add(&loop, &channel->source);
+  }
+
+  /* The client's go comes on channel 0 */
+  EventLoop waiter;
+  UioDoorbell doorbell = {.fd = fd,
+                          .waiter = ivshmem_waiter_init(&waiter, fd, args),
+                          .reg_ptr = reg_ptr,
+                          .args = args};
+  uio_doorbell_wait(slots[0].guards[0], 's', &doorbell);
+  ivshmem_waiter_close(doorbell.waiter);
+
+  interference_start(args->interference);
+
+  setup_benchmarks(&bench, args->count * count);
+
+  for (int i = 0; i < count; ++i)
+    send_loop_channel(&channels[i]);
+  while (received < args->count * count)
+    event_loop_run_once(&loop, -1);
+  const bench_t loop_time = now() - bench.total_start;
+
+  interference_stop();
+
+  benchmark_tag("Loop channels", "%d", count);
+  benchmark_tag("Channels per wake-up", "%.2f",
+                (double)loop.event_count / loop.wakeup_count);
+  benchmark_tag("Aggregate rate", "%.0f msg/s",
+                received / (loop_time / 1e9));
+
+  struct Arguments tmp_arg;
+  tmp_arg.count = received;
+  tmp_arg.size = args->size;
+  evaluate(&bench, &tmp_arg);
+
+  event_loop_close(&loop);
+  for (int i = 1; i < count; ++i)
+    if (close(channels[i].source.fd)) {
+      perror("close()");
+      exit(EXIT_FAILURE);
+    }
+  if (munmap(reg_ptr, 256)) {
+    perror("munmap()");
+    exit(EXIT_FAILURE);
+  }
+
+  free(channels);
+  free(buffer);
+}
+
 static const char IVSHMEM_INTR_DEFAULT_PATH[] = "/dev/uio0";
 static const char IVSHMEM_MEM_DEFAULT_PATH[] =
     "/sys/class/uio/uio0/device/resource2_wc";
 int main(int argc, char *argv[]) {
   struct IvshmemArgs args;
-  ivshmem_parse_args(&args, argc, argv);
+  ivshmem_parse_args(&args, argc, argv, IVSHMEM_CAP_EVENT_LOOP);
+  if ((args.uio_wait_mode != UIO_WAIT_READ) &&
+      (args.loop_channel_count || args.channel_count || args.buffer_count)) {
+    fprintf(stderr, "Only ping-pong waits on io_uring; Use -u read\n");
+    args.uio_wait_mode = UIO_WAIT_READ;
+  }
+
+  pin_placement(args.server_cpu, args.server_cpu, args.client_cpu);
+  realtime_setup(args.rt_priority, args.is_thp_disabled);
 
   if (!args.intr_dev_path) {
     fprintf(stderr, "No -I option set; Use %s as the interrupt device path\n",
@@ -95,6 +434,7 @@ int main(int argc, char *argv[]) {
             IVSHMEM_MEM_DEFAULT_PATH);
     args.mem_dev_path = IVSHMEM_MEM_DEFAULT_PATH;
   }
+  ivshmem_resolve_fence(&args);
 
   if (args.peer_id == -1) {
     fprintf(stderr,
@@ -107,6 +447,10 @@ int main(int argc, char *argv[]) {
     args.shmem_index = 0;
   }
 
+  /* Both uio_ivshmem and usernet_ivshmem name their vectors after the driver */
+  noise_track_irq("ivshmem");
+
+  bench_t open_start = now();
   int ivshmem_uiofd;
 
   if (args.is_nonblock) {
@@ -124,21 +468,22 @@ int main(int argc, char *argv[]) {
     perror("stat()");
     exit(EXIT_FAILURE);
   }
-  size_t ivshmem_size = st.st_size;
-  fprintf(stderr, "ivshmem_size == %lu\n", ivshmem_size);
-
-  void *shared_memory =
-      mmap(NULL, ivshmem_size, PROT_READ | PROT_WRITE, MAP_SHARED,
-           ivshmem_uiofd, IVSHMEM_MMAP_MEM_OFFSET);
-  if (shared_memory == MAP_FAILED) {
-    perror("mmap()");
-    exit(EXIT_FAILURE);
-  }
-
-  void *passed_memory =
-      shared_memory + ivshmem_size -
-      ((args.shmem_index + 1) * (args.size + sizeof(uint32_t)));
-  memset(passed_memory, 0, args.size + sizeof(uint32_t));
+  /* UIO selects the BAR by mmap() offset and maps it only as a whole */
+  IvshmemRegion region;
+  ivshmem_region_init(&region, ivshmem_uiofd, st.st_size,
+                      IVSHMEM_MMAP_MEM_OFFSET, 0);
+  region.open_time = now() - open_start;
+
+  IvshmemSlot slots[LAYOUT_MAX_SLOTS], *slot = &slots[0];
+  if (args.loop_channel_count)
+    ivshmem_group_attach(slots, args.loop_channel_count, &region, &args, 1);
+  else if (args.channel_count)
+    ivshmem_group_attach(slots, args.channel_count, &region, &args, 1);
+  else if (args.buffer_count)
+    ivshmem_slot_attach(slot, &region, &args, args.buffer_count + 1,
+                        args.buffer_count, 1);
+  else
+    ivshmem_slot_attach(slot, &region, &args, 1, 1, 1);
 
   int flags = fcntl(ivshmem_uiofd, F_GETFL, 0);
   if (flags == -1) {
@@ -185,14 +530,16 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "flags & O_NONBLOCK == %d\n", flags & O_NONBLOCK);
   }
 
-  communicate(ivshmem_uiofd, passed_memory, &args);
-
-  cleanup(shared_memory, ivshmem_size);
+  if (args.loop_channel_count)
+    communicate_loop(ivshmem_uiofd, slots, &args);
+  else if (args.channel_count)
+    communicate_channels(ivshmem_uiofd, slots, &args);
+  else if (args.buffer_count)
+    communicate_stream(ivshmem_uiofd, slot, &args);
+  else
+    communicate(ivshmem_uiofd, slot, &args);
 
-  if (close(ivshmem_uiofd)) {
-    perror("close(ivshmem_uiofd)");
-    exit(EXIT_FAILURE);
-  }
+  ivshmem_region_close(&region);
 
   return EXIT_SUCCESS;
 }
@@ -10,13 +10,9 @@
 
 #include "common/common.h"
 #include "common/ivshmem.h"
-
-void cleanup(void *shared_memory, size_t size) {
-  if (munmap(shared_memory, size)) {
-    perror("munmap()");
-    exit(EXIT_FAILURE);
-  }
-}
+#include "common/layout.h"
+#include "common/realtime.h"
+#include "common/topology.h"
 
 __attribute__((hot, flatten)) void communicate(int fd, void *shared_memory,
                                                struct IvshmemArgs *args) {
@@ -25,26 +21,18 @@ __attribute__((hot, flatten)) void communicate(int fd, void *shared_memory,
     perror("malloc()");
     exit(EXIT_FAILURE);
   }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
 
-  if (ioctl(fd, IOCTL_BIND, args->shmem_index)) {
-    perror("ioctl(IOCTL_BIND)");
-    exit(EXIT_FAILURE);
-  }
-  if (ioctl(fd, IOCTL_CLEAR, 0)) {
-    perror("ioctl(IOCTL_CLEAR)");
-    exit(EXIT_FAILURE);
-  }
-  if (ioctl(fd, IOCTL_CONNECT,
-            USERNET_IVSHMEM_IDENT(args->peer_id, args->shmem_index))) {
-    perror("ioctl(IOCTL_CONNECT)");
-    exit(EXIT_FAILURE);
-  }
+  EventLoop loop, *waiter = ivshmem_waiter_init(&loop, fd, args);
+
+  usernet_connect(fd, args);
 
   usernet_intr_notify(fd, args);
 
   for (; args->count > 0; --args->count) {
     /* STC */
-    usernet_intr_wait(fd, args);
+    usernet_intr_wait(fd, waiter, args);
     memcpy(buffer, shared_memory, args->size);
     if (unlikely(args->is_debug))
       debug_validate(buffer, args->size, STC_BITS_10101010);
@@ -56,19 +44,152 @@ __attribute__((hot, flatten)) void communicate(int fd, void *shared_memory,
     usernet_intr_notify(fd, args);
   }
 
+  ivshmem_waiter_close(waiter);
+  free(buffer);
+}
+
+/* Answers on a polled guard; the ioctls only put a late peer to sleep */
+__attribute__((hot, flatten)) void
+communicate_polled(int fd, IvshmemSlot *slot, struct IvshmemArgs *args) {
+  void *buffer = malloc(args->size);
+  if (!buffer) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  uint32_t *guard = slot->guards[0];
+  void *payload = slot->buffers[0];
+  UsernetPoller poller;
+  EventLoop loop;
+  usernet_poller_init(&poller, fd, ivshmem_waiter_init(&loop, fd, args),
+                      args);
+
+  usernet_connect(fd, args);
+
+  usernet_poll_notify(&poller, guard, 's');
+
+  for (; args->count > 0; --args->count) {
+    /* STC */
+    usernet_poll_wait(&poller, guard, 'c');
+    memcpy(buffer, payload, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(buffer, args->size, STC_BITS_10101010);
+
+    /* CTS */
+    memset(payload, CTS_BITS_01010101, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(payload, args->size, CTS_BITS_01010101);
+    usernet_poll_notify(&poller, guard, 's');
+  }
+
+  ivshmem_waiter_close(poller.waiter);
+  free(buffer);
+}
+
+typedef struct LoopChannel {
+  EventSource source;
+  IvshmemSlot *slot;
+  struct IvshmemArgs *args;
+
+  /* Shared by all channels of the loop */
+  void *buffer;
+  uint64_t *answered;
+} LoopChannel;
+
+static void answer_loop_channel(EventSource *source) {
+  LoopChannel *channel = source->context;
+  struct IvshmemArgs *args = channel->args;
+  void *payload = channel->slot->buffers[0];
+
+  /* epoll only saw the interrupt; IOCTL_WAIT takes it without sleeping */
+  usernet_intr_wait(source->fd, NULL, args);
+  /* A coalesced or stale wake-up; the server has not sent anything new */
+  if (shm_consume(channel->slot->guards[0]) != 'c')
+    return;
+
+  /* STC */
+  memcpy(channel->buffer, payload, args->size);
+  if (unlikely(args->is_debug))
+    debug_validate(channel->buffer, args->size, STC_BITS_10101010);
+
+  /* CTS */
+  memset(payload, CTS_BITS_01010101, args->size);
+  if (unlikely(args->is_debug))
+    debug_validate(payload, args->size, CTS_BITS_01010101);
+  shm_publish(channel->slot->guards[0], 's', args->fence);
+  usernet_intr_notify(source->fd, args);
+  ++*channel->answered;
+}
+
+/* Answers every channel, a port each, from this one thread */
+__attribute__((hot, flatten)) void
+communicate_loop(int fd, IvshmemSlot *slots, struct IvshmemArgs *args) {
+  const int count = args->loop_channel_count;
+  void *buffer = malloc(args->size);
+  LoopChannel *channels = calloc(count, sizeof(LoopChannel));
+  if (!buffer || !channels) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  EventLoop loop;
+  uint64_t answered = 0;
+  event_loop_init(&loop);
+
+  usernet_connect(fd, args);
+  for (int i = 0; i < count; ++i) {
+    LoopChannel *channel = &channels[i];
+    channel->slot = &slots[i];
+    channel->args = args;
+    channel->buffer = buffer;
+    channel->answered = &answered;
+
+    channel->source.fd = i ? usernet_open_channel(args, i) : fd;
+    channel->source.event_size = 0;
+    channel->source.handler = answer_loop_channel;
+    channel->source.context = channel;
+    event_loop_add(&loop, &channel->source);
+  }
+
+  /* Every port is connected; the server may start on channel 0 */
+  shm_publish(slots[0].guards[0], 's', args->fence);
+  usernet_intr_notify(fd, args);
+
+  while (answered < args->count * count)
+    event_loop_run_once(&loop, -1);
+
+  event_loop_close(&loop);
+  for (int i = 1; i < count; ++i)
+    if (close(channels[i].source.fd)) {
+      perror("close()");
+      exit(EXIT_FAILURE);
+    }
+  free(channels);
   free(buffer);
 }
 
 static const char IVSHMEM_INTR_DEFAULT_PATH[] = "/dev/usernet_ivshmem0";
 int main(int argc, char *argv[]) {
   struct IvshmemArgs args;
-  ivshmem_parse_args(&args, argc, argv);
+  ivshmem_parse_args(&args, argc, argv, IVSHMEM_CAP_EVENT_LOOP);
+  if (args.chunk_size) {
+    fprintf(stderr, "Usernet sends whole messages; Ignore -k\n");
+    args.chunk_size = 0;
+  }
+
+  pin_placement(args.client_cpu, args.server_cpu, args.client_cpu);
+  realtime_setup(args.rt_priority, args.is_thp_disabled);
 
   if (!args.intr_dev_path) {
     fprintf(stderr, "No -I option set; Use %s as the interrupt device path\n",
             IVSHMEM_INTR_DEFAULT_PATH);
     args.intr_dev_path = IVSHMEM_INTR_DEFAULT_PATH;
   }
+  ivshmem_resolve_fence(&args);
 
   if (args.peer_id == -1) {
     fprintf(stderr,
@@ -81,6 +202,7 @@ int main(int argc, char *argv[]) {
     args.shmem_index = 0;
   }
 
+  bench_t open_start = now();
   int ivshmem_fd;
   if (args.is_nonblock) {
     fprintf(stderr, "args.is_nonblock == 1\n");
@@ -97,17 +219,18 @@ int main(int argc, char *argv[]) {
     perror("ioctl(IOCTL_GETSIZE)");
     exit(EXIT_FAILURE);
   }
-  fprintf(stderr, "ivshmem_size == %lu\n", ivshmem_size);
-
-  void *shared_memory = mmap(NULL, ivshmem_size, PROT_READ | PROT_WRITE,
-                             MAP_SHARED, ivshmem_fd, IVSHMEM_MMAP_MEM_OFFSET);
-  if (shared_memory == MAP_FAILED) {
-    perror("mmap()");
-    exit(EXIT_FAILURE);
-  }
-
-  void *passed_memory =
-      shared_memory + ivshmem_size - ((args.shmem_index + 1) * args.size);
+  IvshmemRegion region;
+  ivshmem_region_init(&region, ivshmem_fd, ivshmem_size,
+                      IVSHMEM_MMAP_MEM_OFFSET, 0);
+  region.open_time = now() - open_start;
+
+  /* Interrupts only, unless polling or the event loop needs guard words */
+  IvshmemSlot slots[LAYOUT_MAX_SLOTS], *slot = &slots[0];
+  if (args.loop_channel_count)
+    ivshmem_group_attach(slots, args.loop_channel_count, &region, &args, 0);
+  else
+    ivshmem_slot_attach(slot, &region, &args, args.poll_spin_us ? 1 : 0, 1,
+                        0);
 
   if (args.is_reset) {
     if (ioctl(ivshmem_fd, IOCTL_CLEAR, 0)) {
@@ -116,14 +239,14 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  communicate(ivshmem_fd, passed_memory, &args);
+  if (args.loop_channel_count)
+    communicate_loop(ivshmem_fd, slots, &args);
+  else if (args.poll_spin_us)
+    communicate_polled(ivshmem_fd, slot, &args);
+  else
+    communicate(ivshmem_fd, slot->buffers[0], &args);
 
-  cleanup(shared_memory, ivshmem_size);
-
-  if (close(ivshmem_fd)) {
-    perror("close(ivshmem_fd)");
-    exit(EXIT_FAILURE);
-  }
+  ivshmem_region_close(&region);
 
   return EXIT_SUCCESS;
 }
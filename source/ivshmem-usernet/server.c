@@ -1,3 +1,4 @@
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,14 +10,11 @@
 #include <sys/mman.h>
 
 #include "common/common.h"
+#include "common/interference.h"
 #include "common/ivshmem.h"
-
-void cleanup(void *shared_memory, size_t size) {
-  if (munmap(shared_memory, size)) {
-    perror("munmap()");
-    exit(EXIT_FAILURE);
-  }
-}
+#include "common/layout.h"
+#include "common/realtime.h"
+#include "common/topology.h"
 
 __attribute__((hot, flatten)) void communicate(int fd, void *shared_memory,
                                                struct IvshmemArgs *args) {
@@ -25,27 +23,21 @@ __attribute__((hot, flatten)) void communicate(int fd, void *shared_memory,
     perror("malloc()");
     exit(EXIT_FAILURE);
   }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
 
-  if (ioctl(fd, IOCTL_BIND, args->shmem_index)) {
-    perror("ioctl(IOCTL_BIND)");
-    exit(EXIT_FAILURE);
-  }
-  if (ioctl(fd, IOCTL_CLEAR, 0)) {
-    perror("ioctl(IOCTL_CLEAR)");
-    exit(EXIT_FAILURE);
-  }
-  if (ioctl(fd, IOCTL_CONNECT,
-            USERNET_IVSHMEM_IDENT(args->peer_id, args->shmem_index))) {
-    perror("ioctl(IOCTL_CONNECT)");
-    exit(EXIT_FAILURE);
-  }
+  EventLoop loop, *waiter = ivshmem_waiter_init(&loop, fd, args);
+
+  usernet_connect(fd, args);
+
+  usernet_intr_wait(fd, waiter, args);
 
-  usernet_intr_wait(fd, args);
+  interference_start(args->interference);
 
   struct Benchmarks bench;
-  setup_benchmarks(&bench);
+  setup_benchmarks(&bench, args->count);
 
-  for (int message = 0; message < args->count; ++message) {
+  for (uint64_t message = 0; message < args->count; ++message) {
     bench.single_start = now();
 
     /* STC */
@@ -55,7 +47,7 @@ __attribute__((hot, flatten)) void communicate(int fd, void *shared_memory,
     usernet_intr_notify(fd, args);
 
     /* CTS */
-    usernet_intr_wait(fd, args);
+    usernet_intr_wait(fd, waiter, args);
     memcpy(buffer, shared_memory, args->size);
     if (unlikely(args->is_debug))
       debug_validate(buffer, args->size, CTS_BITS_01010101);
@@ -63,24 +55,217 @@ __attribute__((hot, flatten)) void communicate(int fd, void *shared_memory,
     benchmark(&bench);
   }
 
+  interference_stop();
+
+  struct Arguments tmp_arg;
+  tmp_arg.count = args->count;
+  tmp_arg.size = args->size;
+  evaluate(&bench, &tmp_arg);
+
+  ivshmem_waiter_close(waiter);
+  free(buffer);
+}
+
+/* Ping-pong on a polled guard; the ioctls only put a late peer to sleep */
+__attribute__((hot, flatten)) void
+communicate_polled(int fd, IvshmemSlot *slot, struct IvshmemArgs *args) {
+  void *buffer = malloc(args->size);
+  if (!buffer) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  uint32_t *guard = slot->guards[0];
+  void *payload = slot->buffers[0];
+  UsernetPoller poller;
+  EventLoop loop;
+  usernet_poller_init(&poller, fd, ivshmem_waiter_init(&loop, fd, args),
+                      args);
+
+  usernet_connect(fd, args);
+
+  usernet_poll_wait(&poller, guard, 's');
+
+  interference_start(args->interference);
+
+  struct Benchmarks bench;
+  setup_benchmarks(&bench, args->count);
+
+  for (uint64_t message = 0; message < args->count; ++message) {
+    bench.single_start = now();
+
+    /* STC */
+    memset(payload, STC_BITS_10101010, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(payload, args->size, STC_BITS_10101010);
+    usernet_poll_notify(&poller, guard, 'c');
+
+    /* CTS */
+    usernet_poll_wait(&poller, guard, 's');
+    memcpy(buffer, payload, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(buffer, args->size, CTS_BITS_01010101);
+
+    benchmark(&bench);
+  }
+
+  interference_stop();
+
+  benchmark_tag("Spin threshold", "%" PRIu64 " us", args->poll_spin_us);
+  benchmark_tag("Final spin limit", "%.3f us", poller.spin_limit / 1e3);
+  benchmark_tag("Waits that slept", "%.2f%%",
+                100.0 * poller.sleep_count / poller.wait_count);
+
   struct Arguments tmp_arg;
   tmp_arg.count = args->count;
   tmp_arg.size = args->size;
   evaluate(&bench, &tmp_arg);
 
+  ivshmem_waiter_close(poller.waiter);
+  free(buffer);
+}
+
+typedef struct LoopChannel {
+  EventSource source;
+  IvshmemSlot *slot;
+  struct IvshmemArgs *args;
+
+  uint64_t remaining;
+  bench_t sent_at;
+
+  /* Shared by all channels of the loop */
+  void *buffer;
+  Benchmarks *bench;
+  uint64_t *received;
+} LoopChannel;
+
+static void send_loop_channel(LoopChannel *channel) {
+  struct IvshmemArgs *args = channel->args;
+  void *payload = channel->slot->buffers[0];
+
+  channel->sent_at = now();
+  memset(payload, STC_BITS_10101010, args->size);
+  if (unlikely(args->is_debug))
+    debug_validate(payload, args->size, STC_BITS_10101010);
+  shm_publish(channel->slot->guards[0], 'c', args->fence);
+  usernet_intr_notify(channel->source.fd, args);
+}
+
+static void receive_loop_channel(EventSource *source) {
+  LoopChannel *channel = source->context;
+  struct IvshmemArgs *args = channel->args;
+
+  /* epoll only saw the interrupt; IOCTL_WAIT takes it without sleeping */
+  usernet_intr_wait(source->fd, NULL, args);
+  /* A coalesced or stale wake-up; the client has not answered yet */
+  if (shm_consume(channel->slot->guards[0]) != 's')
+    return;
+
+  memcpy(channel->buffer, channel->slot->buffers[0], args->size);
+  if (unlikely(args->is_debug))
+    debug_validate(channel->buffer, args->size, CTS_BITS_01010101);
+  channel->bench->single_start = channel->sent_at;
+  benchmark(channel->bench);
+  ++*channel->received;
+
+  if (--channel->remaining)
+    send_loop_channel(channel);
+}
+
+/* Ping-pong on every channel, a port each, all served by this one thread */
+__attribute__((hot, flatten)) void
+communicate_loop(int fd, IvshmemSlot *slots, struct IvshmemArgs *args) {
+  const int count = args->loop_channel_count;
+  void *buffer = malloc(args->size);
+  LoopChannel *channels = calloc(count, sizeof(LoopChannel));
+  if (!buffer || !channels) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  struct Benchmarks bench;
+  EventLoop loop;
+  uint64_t received = 0;
+  event_loop_init(&loop);
+
+  usernet_connect(fd, args);
+  for (int i = 0; i < count; ++i) {
+    LoopChannel *channel = &channels[i];
+    channel->slot = &slots[i];
+    channel->args = args;
+    channel->remaining = args->count;
+    channel->buffer = buffer;
+    channel->bench = &bench;
+    channel->received = &received;
+
+    channel->source.fd = i ? usernet_open_channel(args, i) : fd;
+    channel->source.event_size = 0;
+    channel->source.handler = receive_loop_channel;
+    channel->source.context = channel;
+    event_loop_add(&loop, &channel->source);
+  }
+
+  /* The client's go comes on channel 0 */
+  EventLoop loop_waiter, *waiter = ivshmem_waiter_init(&loop_waiter, fd, args);
+  while (shm_consume(slots[0].guards[0]) != 's')
+    usernet_intr_wait(fd, waiter, args);
+  ivshmem_waiter_close(waiter);
+
+  interference_start(args->interference);
+
+  setup_benchmarks(&bench, args->count * count);
+
+  for (int i = 0; i < count; ++i)
+    send_loop_channel(&channels[i]);
+  while (received < args->count * count)
+    event_loop_run_once(&loop, -1);
+  const bench_t loop_time = now() - bench.total_start;
+
+  interference_stop();
+
+  benchmark_tag("Loop channels", "%d", count);
+  benchmark_tag("Channels per wake-up", "%.2f",
+                (double)loop.event_count / loop.wakeup_count);
+  benchmark_tag("Aggregate rate", "%.0f msg/s",
+                received / (loop_time / 1e9));
+
+  struct Arguments tmp_arg;
+  tmp_arg.count = received;
+  tmp_arg.size = args->size;
+  evaluate(&bench, &tmp_arg);
+
+  event_loop_close(&loop);
+  for (int i = 1; i < count; ++i)
+    if (close(channels[i].source.fd)) {
+      perror("close()");
+      exit(EXIT_FAILURE);
+    }
+  free(channels);
   free(buffer);
 }
 
 static const char IVSHMEM_INTR_DEFAULT_PATH[] = "/dev/usernet_ivshmem0";
 int main(int argc, char *argv[]) {
   struct IvshmemArgs args;
-  ivshmem_parse_args(&args, argc, argv);
+  ivshmem_parse_args(&args, argc, argv, IVSHMEM_CAP_EVENT_LOOP);
+  if (args.chunk_size) {
+    fprintf(stderr, "Usernet sends whole messages; Ignore -k\n");
+    args.chunk_size = 0;
+  }
+
+  pin_placement(args.server_cpu, args.server_cpu, args.client_cpu);
+  realtime_setup(args.rt_priority, args.is_thp_disabled);
 
   if (!args.intr_dev_path) {
     fprintf(stderr, "No -I option set; Use %s as the interrupt device path\n",
             IVSHMEM_INTR_DEFAULT_PATH);
     args.intr_dev_path = IVSHMEM_INTR_DEFAULT_PATH;
   }
+  ivshmem_resolve_fence(&args);
 
   if (args.peer_id == -1) {
     fprintf(stderr,
@@ -93,6 +278,10 @@ int main(int argc, char *argv[]) {
     args.shmem_index = 0;
   }
 
+  /* Both uio_ivshmem and usernet_ivshmem name their vectors after the driver */
+  noise_track_irq("ivshmem");
+
+  bench_t open_start = now();
   int ivshmem_fd;
   if (args.is_nonblock) {
     fprintf(stderr, "args.is_nonblock == 1\n");
@@ -109,18 +298,18 @@ int main(int argc, char *argv[]) {
     perror("ioctl(IOCTL_GETSIZE)");
     exit(EXIT_FAILURE);
   }
-  fprintf(stderr, "ivshmem_size == %lu\n", ivshmem_size);
+  IvshmemRegion region;
+  ivshmem_region_init(&region, ivshmem_fd, ivshmem_size,
+                      IVSHMEM_MMAP_MEM_OFFSET, 0);
+  region.open_time = now() - open_start;
 
-  void *shared_memory = mmap(NULL, ivshmem_size, PROT_READ | PROT_WRITE,
-                             MAP_SHARED, ivshmem_fd, IVSHMEM_MMAP_MEM_OFFSET);
-  if (shared_memory == MAP_FAILED) {
-    perror("mmap()");
-    exit(EXIT_FAILURE);
-  }
-
-  void *passed_memory =
-      shared_memory + ivshmem_size - ((args.shmem_index + 1) * args.size);
-  memset(passed_memory, 0, args.size);
+  /* Interrupts only, unless polling or the event loop needs guard words */
+  IvshmemSlot slots[LAYOUT_MAX_SLOTS], *slot = &slots[0];
+  if (args.loop_channel_count)
+    ivshmem_group_attach(slots, args.loop_channel_count, &region, &args, 1);
+  else
+    ivshmem_slot_attach(slot, &region, &args, args.poll_spin_us ? 1 : 0, 1,
+                        1);
 
   if (args.is_reset) {
     if (ioctl(ivshmem_fd, IOCTL_CLEAR, 0)) {
@@ -129,14 +318,14 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  communicate(ivshmem_fd, passed_memory, &args);
-
-  cleanup(shared_memory, ivshmem_size);
+  if (args.loop_channel_count)
+    communicate_loop(ivshmem_fd, slots, &args);
+  else if (args.poll_spin_us)
+    communicate_polled(ivshmem_fd, slot, &args);
+  else
+    communicate(ivshmem_fd, slot->buffers[0], &args);
 
-  if (close(ivshmem_fd)) {
-    perror("close(ivshmem_fd)");
-    exit(EXIT_FAILURE);
-  }
+  ivshmem_region_close(&region);
 
   return EXIT_SUCCESS;
 }
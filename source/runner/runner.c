@@ -0,0 +1,578 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "common/common.h"
+#include "common/topology.h"
+
+#define RUNNER_DEFAULT_DELAY_MS 200
+#define RUNNER_MAX_ARGUMENTS 64
+/* 4 KiB to 16 MiB, by powers of 4 */
+#define RUNNER_ZEROCOPY_MIN_SIZE (4UL << 10)
+#define RUNNER_ZEROCOPY_SIZE_COUNT 7
+/* 1 to 64 datagrams per batch, by powers of 2 */
+#define RUNNER_BATCH_SIZE_COUNT 7
+/* 4 KiB to 1 MiB, by powers of 4 */
+#define RUNNER_SEGMENT_MIN_SIZE (4UL << 10)
+#define RUNNER_SEGMENT_SIZE_COUNT 5
+/* The largest message a single UDP datagram carries */
+#define RUNNER_UDP_MAX_PAYLOAD 65507
+/* 64 KiB to 16 MiB, by powers of 4 */
+#define RUNNER_RELIABLE_MIN_SIZE (64UL << 10)
+#define RUNNER_RELIABLE_SIZE_COUNT 5
+
+typedef struct RunnerArgs {
+  const char *transport;
+
+  /* Options passed through to both the server and the client */
+  int transport_argc;
+  char **transport_argv;
+
+  int is_topology;
+
+  /* Compare CFS against SCHED_FIFO with this priority */
+  int rt_priority;
+
+  /* Compare the socket I/O paths (socket-tcp, socket-udp) */
+  int is_io;
+  /* Sweep the size with and without zero-copy (socket-tcp) */
+  int is_zerocopy;
+  /* Sweep the sendmmsg/recvmmsg batch size (socket-udp) */
+  int is_batch;
+  /* Sweep the size in UDP segments of this size, with and without GSO/GRO */
+  const char *segment_size;
+  /* Sweep the size in reliable UDP datagrams of this size against TCP */
+  const char *reliable_size;
+
+  /* Run the server in this network namespace, e.g., behind a veth pair */
+  const char *netns;
+
+  int delay_ms;
+} RunnerArgs;
+
+/* What the runner picks out of the server's results block */
+typedef struct RunResult {
+  int is_valid;
+  double average;
+  double p999;
+  double system_cpu;
+  double message_rate;
+  double retransmits;
+} RunResult;
+
+static char binary_dir[PATH_MAX];
+
+static void resolve_binary(char *path, size_t size, const char *transport,
+                           const char *role) {
+  /* <build>/source/runner/ipc-bench-runner -> <build>/source/<transport>/ */
+  if (snprintf(path, size, "%s/../%s/%s-%s", binary_dir, transport, transport,
+               role) >= (int)size) {
+    fprintf(stderr, "Path of the %s binary is too long!\n", role);
+    exit(EXIT_FAILURE);
+  }
+  if (access(path, X_OK)) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static pid_t spawn(char *argv[], int stdout_fd) {
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork()");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    if (stdout_fd >= 0 && dup2(stdout_fd, STDOUT_FILENO) < 0) {
+      perror("dup2()");
+      exit(EXIT_FAILURE);
+    }
+    execvp(argv[0], argv);
+    perror("execvp()");
+    exit(EXIT_FAILURE);
+  }
+  return pid;
+}
+
+static void build_argv(char *argv[], const char *netns, char *binary,
+                       RunnerArgs *args, char *extra[], int extra_count) {
+  int argc = 0;
+
+  if (5 + args->transport_argc + extra_count >= RUNNER_MAX_ARGUMENTS) {
+    fprintf(stderr, "Too many transport options!\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (netns) {
+    argv[argc++] = "ip";
+    argv[argc++] = "netns";
+    argv[argc++] = "exec";
+    argv[argc++] = (char *)netns;
+  }
+  argv[argc++] = binary;
+  for (int i = 0; i < args->transport_argc; ++i)
+    argv[argc++] = args->transport_argv[i];
+  for (int i = 0; i < extra_count; ++i)
+    argv[argc++] = extra[i];
+  argv[argc] = NULL;
+}
+
+static int wait_child(pid_t pid, const char *role) {
+  int status;
+
+  while (waitpid(pid, &status, 0) < 0)
+    if (errno != EINTR) {
+      perror("waitpid()");
+      exit(EXIT_FAILURE);
+    }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+    fprintf(stderr, "The %s did not exit successfully!\n", role);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Runs one server/client pair with `extra` appended to the transport options.
+ * The server's results are echoed to stdout while being parsed.
+ */
+static RunResult run_pair(RunnerArgs *args, char *extra[], int extra_count) {
+  char server_binary[PATH_MAX], client_binary[PATH_MAX];
+  char *server_argv[RUNNER_MAX_ARGUMENTS], *client_argv[RUNNER_MAX_ARGUMENTS];
+  RunResult result = {0};
+  int pipe_fds[2];
+  char *line = NULL;
+  size_t capacity = 0;
+  double value;
+
+  resolve_binary(server_binary, sizeof(server_binary), args->transport,
+                 "server");
+  resolve_binary(client_binary, sizeof(client_binary), args->transport,
+                 "client");
+  build_argv(server_argv, args->netns, server_binary, args, extra,
+             extra_count);
+  build_argv(client_argv, NULL, client_binary, args, extra, extra_count);
+
+  if (pipe(pipe_fds)) {
+    perror("pipe()");
+    exit(EXIT_FAILURE);
+  }
+
+  fflush(stdout);
+  pid_t server_pid = spawn(server_argv, pipe_fds[1]);
+  close(pipe_fds[1]);
+
+  /* The server has to be listening (or have reset the memory) first */
+  usleep(args->delay_ms * 1000);
+  pid_t client_pid = spawn(client_argv, -1);
+
+  FILE *server_output = fdopen(pipe_fds[0], "r");
+  if (!server_output) {
+    perror("fdopen()");
+    exit(EXIT_FAILURE);
+  }
+  while (getline(&line, &capacity, server_output) > 0) {
+    fputs(line, stdout);
+    if (sscanf(line, "Average duration: %lf", &value) == 1) {
+      result.average = value;
+      result.is_valid = 1;
+    } else if (sscanf(line, "99.9th percentile: %lf", &value) == 1)
+      result.p999 = value;
+    else if (sscanf(line, "System CPU time: %lf", &value) == 1)
+      result.system_cpu = value;
+    else if (sscanf(line, "Message rate: %lf", &value) == 1)
+      result.message_rate = value;
+    else if (sscanf(line, "Retransmitted: %lf", &value) == 1)
+      result.retransmits = value;
+  }
+  free(line);
+  fclose(server_output);
+
+  if (wait_child(server_pid, "server") | wait_child(client_pid, "client"))
+    result.is_valid = 0;
+
+  return result;
+}
+
+static void run_topology(RunnerArgs *args) {
+  CpuTopology cpus[TOPOLOGY_MAX_CPUS];
+  RunResult results[PLACEMENT_COUNT];
+  int pairs[PLACEMENT_COUNT][2];
+  char pinning[32];
+
+  int count = topology_read(cpus, TOPOLOGY_MAX_CPUS);
+  fprintf(stderr, "%d online CPUs\n", count);
+
+  for (Placement placement = PLACEMENT_SMT; placement < PLACEMENT_COUNT;
+       ++placement) {
+    results[placement].is_valid = 0;
+    if (topology_find_pair(cpus, count, placement, &pairs[placement][0],
+                           &pairs[placement][1])) {
+      fprintf(stderr, "No %s CPU pair on this machine; Skipping\n",
+              placement_name(placement));
+      pairs[placement][0] = -1;
+      continue;
+    }
+
+    fprintf(stderr, "Placement %s: server on cpu %d, client on cpu %d\n",
+            placement_name(placement), pairs[placement][0],
+            pairs[placement][1]);
+    snprintf(pinning, sizeof(pinning), "%d,%d", pairs[placement][0],
+             pairs[placement][1]);
+    char *extra[] = {"-P", pinning};
+    results[placement] = run_pair(args, extra, 2);
+  }
+
+  printf("\n============ PLACEMENTS =============\n");
+  for (Placement placement = PLACEMENT_SMT; placement < PLACEMENT_COUNT;
+       ++placement) {
+    if (pairs[placement][0] < 0)
+      printf("%-12s(no such CPU pair)\n", placement_name(placement));
+    else if (!results[placement].is_valid)
+      printf("%-12scpu %d <-> cpu %d\tfailed\n", placement_name(placement),
+             pairs[placement][0], pairs[placement][1]);
+    else
+      printf("%-12scpu %d <-> cpu %d\tavg %.3f us\tp99.9 %.3f us\n",
+             placement_name(placement), pairs[placement][0],
+             pairs[placement][1], results[placement].average,
+             results[placement].p999);
+  }
+  printf("=====================================\n");
+}
+
+static void run_realtime_comparison(RunnerArgs *args) {
+  char priority[16];
+
+  fprintf(stderr, "Run with the default CFS policy\n");
+  RunResult cfs = run_pair(args, NULL, 0);
+
+  fprintf(stderr, "Run with SCHED_FIFO/%d\n", args->rt_priority);
+  snprintf(priority, sizeof(priority), "%d", args->rt_priority);
+  char *extra[] = {"-F", priority};
+  RunResult fifo = run_pair(args, extra, 2);
+
+  printf("\n============ SCHEDULING =============\n");
+  if (!cfs.is_valid || !fifo.is_valid) {
+    printf("At least one run failed\n");
+  } else {
+    printf("CFS p99.9:          %.3f\tus\n", cfs.p999);
+    printf("SCHED_FIFO p99.9:   %.3f\tus\n", fifo.p999);
+    printf("Difference:         %.3f\tus (%+.1f%%)\n", fifo.p999 - cfs.p999,
+           (fifo.p999 - cfs.p999) / cfs.p999 * 100.0);
+    printf("CFS average:        %.3f\tus\n", cfs.average);
+    printf("SCHED_FIFO average: %.3f\tus\n", fifo.average);
+  }
+  printf("=====================================\n");
+}
+
+static void run_io_comparison(RunnerArgs *args) {
+  static char *const IO_NAMES[] = {"syscall", "uring", "sqpoll"};
+  const int io_count = sizeof(IO_NAMES) / sizeof(IO_NAMES[0]);
+  RunResult results[io_count];
+
+  for (int io = 0; io < io_count; ++io) {
+    fprintf(stderr, "Run with %s socket I/O\n", IO_NAMES[io]);
+    char *extra[] = {"-u", IO_NAMES[io]};
+    results[io] = run_pair(args, extra, 2);
+  }
+
+  printf("\n============ SOCKET I/O =============\n");
+  for (int io = 0; io < io_count; ++io)
+    if (!results[io].is_valid)
+      printf("%-10sfailed\n", IO_NAMES[io]);
+    else
+      printf("%-10savg %.3f us\tp99.9 %.3f us\tsys %.3f ms\n",
+             IO_NAMES[io], results[io].average, results[io].p999,
+             results[io].system_cpu);
+  printf("=====================================\n");
+}
+
+static void run_zerocopy_sweep(RunnerArgs *args) {
+  RunResult copies[RUNNER_ZEROCOPY_SIZE_COUNT];
+  RunResult zeros[RUNNER_ZEROCOPY_SIZE_COUNT];
+  char size_arg[32];
+  size_t size, crossover = 0;
+  int step;
+
+  for (step = 0, size = RUNNER_ZEROCOPY_MIN_SIZE;
+       step < RUNNER_ZEROCOPY_SIZE_COUNT; ++step, size *= 4) {
+    snprintf(size_arg, sizeof(size_arg), "%zu", size);
+
+    fprintf(stderr, "Run %zu B with copies\n", size);
+    char *copy_extra[] = {"-b", size_arg};
+    copies[step] = run_pair(args, copy_extra, 2);
+
+    fprintf(stderr, "Run %zu B with MSG_ZEROCOPY and TCP_ZEROCOPY_RECEIVE\n",
+            size);
+    char *zero_extra[] = {"-b", size_arg, "-z", "-Z"};
+    zeros[step] = run_pair(args, zero_extra, 4);
+  }
+
+  printf("\n============= ZERO-COPY =============\n");
+  printf("%-10s%14s%14s%10s\n", "Size", "Copy (us)", "Zero (us)",
+         "Speedup");
+  for (step = 0, size = RUNNER_ZEROCOPY_MIN_SIZE;
+       step < RUNNER_ZEROCOPY_SIZE_COUNT; ++step, size *= 4) {
+    if (!copies[step].is_valid || !zeros[step].is_valid) {
+      printf("%-10zufailed\n", size);
+      continue;
+    }
+    printf("%-10zu%14.3f%14.3f%10.2f\n", size, copies[step].average,
+           zeros[step].average, copies[step].average / zeros[step].average);
+    if (!crossover && (zeros[step].average < copies[step].average))
+      crossover = size;
+  }
+  if (crossover)
+    printf("Zero-copy pays off from %zu B\n", crossover);
+  else
+    printf("Zero-copy did not pay off up to %zu B\n", size / 4);
+  printf("=====================================\n");
+}
+
+static void run_batch_sweep(RunnerArgs *args) {
+  RunResult results[RUNNER_BATCH_SIZE_COUNT];
+  char batch_arg[16];
+  int step, batch;
+
+  for (step = 0, batch = 1; step < RUNNER_BATCH_SIZE_COUNT;
+       ++step, batch *= 2) {
+    snprintf(batch_arg, sizeof(batch_arg), "%d", batch);
+    fprintf(stderr, "Run batches of %d datagrams\n", batch);
+    char *extra[] = {"-B", batch_arg};
+    results[step] = run_pair(args, extra, 2);
+  }
+
+  printf("\n============= BATCHING ==============\n");
+  printf("%-10s%14s%10s\n", "Batch", "Rate (msg/s)", "Speedup");
+  for (step = 0, batch = 1; step < RUNNER_BATCH_SIZE_COUNT;
+       ++step, batch *= 2) {
+    if (!results[step].is_valid)
+      printf("%-10dfailed\n", batch);
+    else if (!results[0].is_valid)
+      printf("%-10d%14.0f\n", batch, results[step].message_rate);
+    else
+      printf("%-10d%14.0f%10.2f\n", batch, results[step].message_rate,
+             results[step].message_rate / results[0].message_rate);
+  }
+  printf("=====================================\n");
+}
+
+static void run_segment_sweep(RunnerArgs *args) {
+  RunResult plains[RUNNER_SEGMENT_SIZE_COUNT];
+  RunResult segments[RUNNER_SEGMENT_SIZE_COUNT];
+  RunResult offloads[RUNNER_SEGMENT_SIZE_COUNT];
+  char size_arg[32];
+  size_t size;
+  int step;
+
+  for (step = 0, size = RUNNER_SEGMENT_MIN_SIZE;
+       step < RUNNER_SEGMENT_SIZE_COUNT; ++step, size *= 4) {
+    snprintf(size_arg, sizeof(size_arg), "%zu", size);
+
+    /* Beyond the MTU, IP fragments what fits into a datagram at all */
+    plains[step].is_valid = 0;
+    if (size <= RUNNER_UDP_MAX_PAYLOAD) {
+      fprintf(stderr, "Run %zu B in a single datagram\n", size);
+      char *plain_extra[] = {"-b", size_arg};
+      plains[step] = run_pair(args, plain_extra, 2);
+    }
+
+    fprintf(stderr, "Run %zu B in %s B datagrams\n", size,
+            args->segment_size);
+    char *segment_extra[] = {"-b", size_arg, "-g", (char *)args->segment_size,
+                             "-G"};
+    segments[step] = run_pair(args, segment_extra, 5);
+
+    fprintf(stderr, "Run %zu B in %s B datagrams through GSO/GRO\n", size,
+            args->segment_size);
+    offloads[step] = run_pair(args, segment_extra, 4);
+  }
+
+  printf("\n============= UDP GSO/GRO ===========\n");
+  printf("%-10s%14s%14s%14s%10s\n", "Size", "Whole (us)", "Segment (us)",
+         "GSO/GRO (us)", "Speedup");
+  for (step = 0, size = RUNNER_SEGMENT_MIN_SIZE;
+       step < RUNNER_SEGMENT_SIZE_COUNT; ++step, size *= 4) {
+    printf("%-10zu", size);
+    if (plains[step].is_valid)
+      printf("%14.3f", plains[step].average);
+    else
+      printf("%14s", (size <= RUNNER_UDP_MAX_PAYLOAD) ? "failed" : "-");
+    if (!segments[step].is_valid || !offloads[step].is_valid)
+      printf("%14s\n", "failed");
+    else
+      printf("%14.3f%14.3f%10.2f\n", segments[step].average,
+             offloads[step].average,
+             segments[step].average / offloads[step].average);
+  }
+  printf("=====================================\n");
+}
+
+static void run_reliable_sweep(RunnerArgs *args) {
+  RunResult udps[RUNNER_RELIABLE_SIZE_COUNT];
+  RunResult tcps[RUNNER_RELIABLE_SIZE_COUNT];
+  const char *transport = args->transport;
+  char size_arg[32];
+  size_t size;
+  int step;
+
+  for (step = 0, size = RUNNER_RELIABLE_MIN_SIZE;
+       step < RUNNER_RELIABLE_SIZE_COUNT; ++step, size *= 4) {
+    snprintf(size_arg, sizeof(size_arg), "%zu", size);
+
+    fprintf(stderr, "Run %zu B in reliable %s B datagrams\n", size,
+            args->reliable_size);
+    char *udp_extra[] = {"-b", size_arg, "-R", (char *)args->reliable_size};
+    udps[step] = run_pair(args, udp_extra, 4);
+
+    fprintf(stderr, "Run %zu B over TCP\n", size);
+    char *tcp_extra[] = {"-b", size_arg};
+    args->transport = "socket-tcp";
+    tcps[step] = run_pair(args, tcp_extra, 2);
+    args->transport = transport;
+  }
+
+  printf("\n============ RELIABLE UDP ===========\n");
+  printf("%-10s%14s%14s%10s%14s\n", "Size", "UDP (us)", "TCP (us)",
+         "UDP/TCP", "Retransmits");
+  for (step = 0, size = RUNNER_RELIABLE_MIN_SIZE;
+       step < RUNNER_RELIABLE_SIZE_COUNT; ++step, size *= 4) {
+    if (!udps[step].is_valid || !tcps[step].is_valid)
+      printf("%-10zufailed\n", size);
+    else
+      printf("%-10zu%14.3f%14.3f%10.2f%14.0f\n", size, udps[step].average,
+             tcps[step].average, udps[step].average / tcps[step].average,
+             udps[step].retransmits);
+  }
+  printf("=====================================\n");
+}
+
+static void runner_usage(const char *progname) {
+  printf("Usage: %s [OPTION]... <transport> [TRANSPORT OPTION]...\n"
+         "  -T: Run the same-core SMT, same-LLC, cross-LLC and cross-node "
+         "placements\n"
+         "  -F <priority>: Compare CFS against SCHED_FIFO with mlockall\n"
+         "  -u: Compare syscall, io_uring and SQPOLL socket I/O\n"
+         "  -z: Sweep the size to find where zero-copy TCP pays off\n"
+         "  -B: Sweep the sendmmsg/recvmmsg batch size of socket-udp\n"
+         "  -g <segment_size>: Sweep the size in socket-udp datagrams of this "
+         "size, with and without GSO/GRO (pass a -r that holds the largest "
+         "message)\n"
+         "  -R <datagram_size>: Sweep the size in reliable socket-udp "
+         "datagrams of this size against socket-tcp\n"
+         "  -n <netns>: Run the server in this network namespace (see "
+         "setup-veth.sh)\n"
+         "  -d <delay_ms>: Delay between starting server and client "
+         "(default is %d)\n"
+         "e.g., %s -T ivshmem-shm -M /dev/kvmfr0 -b 64\n",
+         progname, RUNNER_DEFAULT_DELAY_MS, progname);
+}
+static void runner_parse_args(RunnerArgs *args, int argc, char *argv[]) {
+  int c;
+
+  args->is_topology = 0;
+  args->rt_priority = 0;
+  args->is_io = 0;
+  args->is_zerocopy = 0;
+  args->is_batch = 0;
+  args->segment_size = NULL;
+  args->reliable_size = NULL;
+  args->netns = NULL;
+  args->delay_ms = RUNNER_DEFAULT_DELAY_MS;
+
+  /* '+' stops at the transport name; the rest belongs to the transport */
+  while ((c = getopt(argc, argv, "+hTuzBF:g:R:n:d:")) != -1) {
+    switch (c) {
+    case 'T': /* Topology sweep */
+      args->is_topology = 1;
+      break;
+    case 'F': /* CFS vs. SCHED_FIFO */
+      args->rt_priority = atoi(optarg);
+      break;
+    case 'u': /* Socket I/O comparison */
+      args->is_io = 1;
+      break;
+    case 'z': /* Zero-copy sweep */
+      args->is_zerocopy = 1;
+      break;
+    case 'B': /* Batch sweep */
+      args->is_batch = 1;
+      break;
+    case 'g': /* GSO/GRO sweep */
+      args->segment_size = optarg;
+      break;
+    case 'R': /* Reliable UDP sweep */
+      args->reliable_size = optarg;
+      break;
+    case 'n': /* Server's network namespace */
+      args->netns = optarg;
+      break;
+    case 'd': /* Start delay */
+      args->delay_ms = atoi(optarg);
+      break;
+
+    case 'h': /* help */
+    default:
+      runner_usage(argv[0]);
+      exit(EXIT_FAILURE);
+      break;
+    }
+  }
+
+  if (optind >= argc) {
+    runner_usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  args->transport = argv[optind];
+  args->transport_argc = argc - optind - 1;
+  args->transport_argv = argv + optind + 1;
+}
+
+int main(int argc, char *argv[]) {
+  struct RunnerArgs args;
+  runner_parse_args(&args, argc, argv);
+
+  char self_path[PATH_MAX];
+  ssize_t length = readlink("/proc/self/exe", self_path, PATH_MAX - 1);
+  if (length < 0) {
+    perror("readlink(/proc/self/exe)");
+    exit(EXIT_FAILURE);
+  }
+  self_path[length] = '\0';
+  snprintf(binary_dir, sizeof(binary_dir), "%s", dirname(self_path));
+
+  if (args.is_topology + !!args.rt_priority + args.is_io + args.is_zerocopy +
+          args.is_batch + !!args.segment_size + !!args.reliable_size >
+      1) {
+    fprintf(stderr, "Only one of -T, -F, -u, -z, -B, -g and -R can be used "
+                    "at a time!\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (args.is_topology)
+    run_topology(&args);
+  else if (args.rt_priority)
+    run_realtime_comparison(&args);
+  else if (args.is_io)
+    run_io_comparison(&args);
+  else if (args.is_zerocopy)
+    run_zerocopy_sweep(&args);
+  else if (args.is_batch)
+    run_batch_sweep(&args);
+  else if (args.segment_size)
+    run_segment_sweep(&args);
+  else if (args.reliable_size)
+    run_reliable_sweep(&args);
+  else if (!run_pair(&args, NULL, 0).is_valid)
+    return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
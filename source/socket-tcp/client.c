@@ -11,7 +11,9 @@
 #include <sys/socket.h>
 
 #include "common/common.h"
+#include "common/realtime.h"
 #include "common/sockets.h"
+#include "common/topology.h"
 
 __attribute__((hot, flatten)) void communicate(int sockfd,
                                                struct SocketArgs *args) {
@@ -20,6 +22,8 @@ __attribute__((hot, flatten)) void communicate(int sockfd,
     perror("malloc()");
     exit(EXIT_FAILURE);
   }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
 
   for (; args->count > 0; --args->count) {
     /* STC */
@@ -37,9 +41,79 @@ __attribute__((hot, flatten)) void communicate(int sockfd,
   free(buffer);
 }
 
+/* Answers through an io_uring; CTS and the next STC read go in one batch */
+__attribute__((hot, flatten)) void
+communicate_uring(int sockfd, struct SocketArgs *args) {
+  SocketUring uring;
+  socket_uring_init(&uring, sockfd, args);
+
+  socket_uring_read(&uring, args->size);
+  for (; args->count > 0; --args->count) {
+    /* STC */
+    socket_uring_complete(&uring);
+    if (unlikely(args->is_debug))
+      debug_validate(uring.rx, args->size, STC_BITS_10101010);
+
+    /* CTS */
+    memset(uring.tx, CTS_BITS_01010101, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(uring.tx, args->size, CTS_BITS_01010101);
+    socket_uring_write(&uring, args->size);
+    if (args->count > 1)
+      socket_uring_read(&uring, args->size);
+  }
+  socket_uring_complete(&uring);
+
+  socket_uring_close(&uring);
+}
+
+/* Answers with zero-copy sends and/or receives; CTS has its own buffer */
+__attribute__((hot, flatten)) void
+communicate_zerocopy(int sockfd, struct SocketArgs *args) {
+  void *buffer = malloc(args->size), *tx;
+  /* Page-aligned, so that a zero-copy receiver can map whole pages of it */
+  if (!buffer || posix_memalign(&tx, getpagesize(), args->size)) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority) {
+    prefault_memory(buffer, args->size, 1);
+    prefault_memory(tx, args->size, 1);
+  }
+
+  TcpZerocopy zc;
+  tcp_zerocopy_init(&zc, sockfd, args->size, args);
+
+  for (; args->count > 0; --args->count) {
+    /* STC */
+    int part_count;
+    const struct iovec *parts =
+        tcp_zerocopy_read(&zc, buffer, args->size, &part_count, args);
+    if (unlikely(args->is_debug))
+      for (int part = 0; part < part_count; ++part)
+        debug_validate(parts[part].iov_base, parts[part].iov_len,
+                       STC_BITS_10101010);
+
+    /* CTS, once the kernel has let go of the previous one */
+    tcp_zerocopy_flush(&zc);
+    memset(tx, CTS_BITS_01010101, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(tx, args->size, CTS_BITS_01010101);
+    tcp_zerocopy_write(&zc, tx, args->size, args);
+  }
+
+  tcp_zerocopy_close(&zc);
+
+  free(tx);
+  free(buffer);
+}
+
 int main(int argc, char *argv[]) {
   struct SocketArgs args;
-  socket_parse_args(&args, argc, argv);
+  socket_parse_args(&args, argc, argv, SOCKET_CAP_URING | SOCKET_CAP_ZEROCOPY);
+
+  pin_placement(args.client_cpu, args.server_cpu, args.client_cpu);
+  realtime_setup(args.rt_priority, args.is_thp_disabled);
 
   int sockfd = socket(AF_INET, SOCK_STREAM, 0);
   if (sockfd < 0) {
@@ -161,7 +235,12 @@ int main(int argc, char *argv[]) {
     }
   } while (ret < 0);
 
-  communicate(sockfd, &args);
+  if (args.io != SOCKET_IO_SYSCALL)
+    communicate_uring(sockfd, &args);
+  else if (args.is_zerocopy_send || args.is_zerocopy_receive)
+    communicate_zerocopy(sockfd, &args);
+  else
+    communicate(sockfd, &args);
 
   if (close(sockfd)) {
     perror("close()");
@@ -11,7 +11,10 @@
 #include <sys/socket.h>
 
 #include "common/common.h"
+#include "common/interference.h"
+#include "common/realtime.h"
 #include "common/sockets.h"
+#include "common/topology.h"
 
 __attribute__((hot, flatten)) void communicate(int sockfd,
                                                struct SocketArgs *args) {
@@ -20,11 +23,15 @@ __attribute__((hot, flatten)) void communicate(int sockfd,
     perror("malloc()");
     exit(EXIT_FAILURE);
   }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  interference_start(args->interference);
 
   struct Benchmarks bench;
-  setup_benchmarks(&bench);
+  setup_benchmarks(&bench, args->count);
 
-  for (int message = 0; message < args->count; ++message) {
+  for (uint64_t message = 0; message < args->count; ++message) {
     bench.single_start = now();
 
     /* STC */
@@ -41,17 +48,121 @@ __attribute__((hot, flatten)) void communicate(int sockfd,
     benchmark(&bench);
   }
 
+  interference_stop();
+
+  struct Arguments tmp_arg;
+  tmp_arg.count = args->count;
+  tmp_arg.size = args->size;
+  evaluate(&bench, &tmp_arg);
+
+  free(buffer);
+}
+
+/* Ping-pong through an io_uring; STC and the CTS read go in one submission */
+__attribute__((hot, flatten)) void
+communicate_uring(int sockfd, struct SocketArgs *args) {
+  SocketUring uring;
+  socket_uring_init(&uring, sockfd, args);
+
+  interference_start(args->interference);
+
+  struct Benchmarks bench;
+  setup_benchmarks(&bench, args->count);
+
+  for (uint64_t message = 0; message < args->count; ++message) {
+    bench.single_start = now();
+
+    /* STC */
+    memset(uring.tx, STC_BITS_10101010, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(uring.tx, args->size, STC_BITS_10101010);
+    socket_uring_write(&uring, args->size);
+
+    /* CTS */
+    socket_uring_read(&uring, args->size);
+    socket_uring_complete(&uring);
+    if (unlikely(args->is_debug))
+      debug_validate(uring.rx, args->size, CTS_BITS_01010101);
+
+    benchmark(&bench);
+  }
+
+  interference_stop();
+
+  socket_uring_report(&uring, args->count);
+
+  struct Arguments tmp_arg;
+  tmp_arg.count = args->count;
+  tmp_arg.size = args->size;
+  evaluate(&bench, &tmp_arg);
+
+  socket_uring_close(&uring);
+}
+
+/* Ping-pong with zero-copy sends and/or receives; STC has its own buffer */
+__attribute__((hot, flatten)) void
+communicate_zerocopy(int sockfd, struct SocketArgs *args) {
+  void *buffer = malloc(args->size), *tx;
+  /* Page-aligned, so that a zero-copy receiver can map whole pages of it */
+  if (!buffer || posix_memalign(&tx, getpagesize(), args->size)) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority) {
+    prefault_memory(buffer, args->size, 1);
+    prefault_memory(tx, args->size, 1);
+  }
+
+  TcpZerocopy zc;
+  tcp_zerocopy_init(&zc, sockfd, args->size, args);
+
+  interference_start(args->interference);
+
+  struct Benchmarks bench;
+  setup_benchmarks(&bench, args->count);
+
+  for (uint64_t message = 0; message < args->count; ++message) {
+    bench.single_start = now();
+
+    /* STC, once the kernel has let go of the previous one */
+    tcp_zerocopy_flush(&zc);
+    memset(tx, STC_BITS_10101010, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(tx, args->size, STC_BITS_10101010);
+    tcp_zerocopy_write(&zc, tx, args->size, args);
+
+    /* CTS */
+    int part_count;
+    const struct iovec *parts =
+        tcp_zerocopy_read(&zc, buffer, args->size, &part_count, args);
+    if (unlikely(args->is_debug))
+      for (int part = 0; part < part_count; ++part)
+        debug_validate(parts[part].iov_base, parts[part].iov_len,
+                       CTS_BITS_01010101);
+
+    benchmark(&bench);
+  }
+
+  interference_stop();
+
+  tcp_zerocopy_close(&zc);
+  tcp_zerocopy_report(&zc);
+
   struct Arguments tmp_arg;
   tmp_arg.count = args->count;
   tmp_arg.size = args->size;
   evaluate(&bench, &tmp_arg);
 
+  free(tx);
   free(buffer);
 }
 
 int main(int argc, char *argv[]) {
   struct SocketArgs args;
-  socket_parse_args(&args, argc, argv);
+  socket_parse_args(&args, argc, argv, SOCKET_CAP_URING | SOCKET_CAP_ZEROCOPY);
+
+  pin_placement(args.server_cpu, args.server_cpu, args.client_cpu);
+  realtime_setup(args.rt_priority, args.is_thp_disabled);
 
   int sockfd = socket(AF_INET, SOCK_STREAM, 0);
   if (sockfd < 0) {
@@ -195,7 +306,12 @@ int main(int argc, char *argv[]) {
     }
   } while (client_fd < 0);
 
-  communicate(client_fd, &args);
+  if (args.io != SOCKET_IO_SYSCALL)
+    communicate_uring(client_fd, &args);
+  else if (args.is_zerocopy_send || args.is_zerocopy_receive)
+    communicate_zerocopy(client_fd, &args);
+  else
+    communicate(client_fd, &args);
 
   if (close(client_fd)) {
     perror("close()");
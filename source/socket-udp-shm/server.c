@@ -8,15 +8,19 @@
 
 #include <sys/ioctl.h>
 #include <sys/mman.h>
-#include <sys/shm.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 
 #include "common/common.h"
+#include "common/interference.h"
 #include "common/ivshmem.h"
+#include "common/realtime.h"
+#include "common/shmem.h"
 #include "common/sockets.h"
+#include "common/topology.h"
 
-int segment_id;
+IvshmemRegion ivshmem_region;
+LocalShmem local_shmem;
 
 __attribute__((hot, flatten)) void communicate(int sockfd, void *shared_memory,
                                                struct SocketArgs *args) {
@@ -28,6 +32,8 @@ __attribute__((hot, flatten)) void communicate(int sockfd, void *shared_memory,
     perror("malloc()");
     exit(EXIT_FAILURE);
   }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
 
   /* Handshake */
   uint8_t dummy_message = 'c';
@@ -39,10 +45,12 @@ __attribute__((hot, flatten)) void communicate(int sockfd, void *shared_memory,
   }
   fprintf(stderr, "Handshaking done!\n");
 
+  interference_start(args->interference);
+
   struct Benchmarks bench;
-  setup_benchmarks(&bench);
+  setup_benchmarks(&bench, args->count);
 
-  for (int message = 0; message < args->count; ++message) {
+  for (uint64_t message = 0; message < args->count; ++message) {
     bench.single_start = now();
 
     /* STC */
@@ -60,6 +68,8 @@ __attribute__((hot, flatten)) void communicate(int sockfd, void *shared_memory,
     benchmark(&bench);
   }
 
+  interference_stop();
+
   struct Arguments tmp_arg;
   tmp_arg.count = args->count;
   tmp_arg.size = args->size;
@@ -70,7 +80,10 @@ __attribute__((hot, flatten)) void communicate(int sockfd, void *shared_memory,
 
 int main(int argc, char *argv[]) {
   struct SocketArgs args;
-  socket_parse_args(&args, argc, argv);
+  socket_parse_args(&args, argc, argv, 0);
+
+  pin_placement(args.server_cpu, args.server_cpu, args.client_cpu);
+  realtime_setup(args.rt_priority, args.is_thp_disabled);
 
   if (args.shmem_index == -1) {
     fprintf(stderr, "No -i option set; Use 0 as the shared memory index\n");
@@ -81,60 +94,20 @@ int main(int argc, char *argv[]) {
   if (args.shmem_backend) {
     /* For compatibiliy, assume it is IVSHMEM backend. */
 
-    int ivshmem_memfd = open(args.shmem_backend, O_RDWR | O_ASYNC | O_NONBLOCK);
-    if (ivshmem_memfd < 0) {
-      perror("open(ivshmem_memfd)");
-      exit(EXIT_FAILURE);
-    }
-
-    loff_t ivshmem_mmap_offset = 0;
-    size_t ivshmem_size = 0;
-    if (args.shmem_size_force)
-      ivshmem_size = args.shmem_size_force;
-    else {
-      struct stat st;
-      if (stat(args.shmem_backend, &st)) {
-        perror("stat()");
-        exit(EXIT_FAILURE);
-      }
-      ivshmem_size = st.st_size;
-
-      if (!ivshmem_size) {
-        /* Try usernet_ivshmem's way */
-        if (ioctl(ivshmem_memfd, IOCTL_GETSIZE, &ivshmem_size) < 0) {
-          perror("ioctl(IOCTL_GETSIZE)");
-          exit(EXIT_FAILURE);
-        }
-        ivshmem_mmap_offset = IVSHMEM_MMAP_MEM_OFFSET;
-      }
-    }
-
-    fprintf(stderr, "ivshmem_size == %lu\n", ivshmem_size);
-    void *shared_memory = mmap(NULL, ivshmem_size, PROT_READ | PROT_WRITE,
-                               MAP_SHARED, ivshmem_memfd, ivshmem_mmap_offset);
-    if (shared_memory == MAP_FAILED) {
-      perror("mmap()");
-      exit(EXIT_FAILURE);
-    }
-
-    passed_memory =
-        shared_memory + ivshmem_size - ((args.shmem_index + 1) * args.size);
+    ivshmem_region_open(&ivshmem_region, args.shmem_backend,
+                        O_RDWR | O_ASYNC | O_NONBLOCK, args.shmem_size_force);
+    passed_memory = ivshmem_region_map(
+        &ivshmem_region,
+        ivshmem_region.size - (args.shmem_index + 1) * args.size, args.size,
+        args.is_window, args.prefault_threads);
   } else {
     /* Use local shared memory. */
 
-    fprintf(stderr,
-            "No shared memory backend specified; Create anonymous one\n");
-    key_t segment_key = ftok("shmem", args.shmem_index);
-
-    segment_id = shmget(segment_key, args.size, IPC_CREAT | 0666);
-    if (segment_id < 0) {
-      throw("Could not get segment");
-    }
-
-    passed_memory = (char *)shmat(segment_id, NULL, 0);
-    if (passed_memory == MAP_FAILED) {
-      throw("Could not attach segment");
-    }
+    fprintf(stderr, "No shared memory backend specified; Create local %s\n",
+            args.shmem_local);
+    local_shmem_create(&local_shmem, args.shmem_local, args.shmem_index,
+                       args.size, args.shmem_node);
+    passed_memory = local_shmem.memory;
   }
 
   int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -223,10 +196,10 @@ int main(int argc, char *argv[]) {
     exit(EXIT_FAILURE);
   }
 
-  if (!args.shmem_backend) {
-    shmdt(passed_memory);
-    shmctl(segment_id, IPC_RMID, NULL);
-  }
+  if (args.shmem_backend)
+    ivshmem_region_close(&ivshmem_region);
+  else
+    local_shmem_release(&local_shmem);
 
   return EXIT_SUCCESS;
 }
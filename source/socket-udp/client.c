@@ -9,7 +9,9 @@
 #include <sys/socket.h>
 
 #include "common/common.h"
+#include "common/realtime.h"
 #include "common/sockets.h"
+#include "common/topology.h"
 
 __attribute__((hot, flatten)) void communicate(int sockfd,
                                                struct SocketArgs *args) {
@@ -25,6 +27,8 @@ __attribute__((hot, flatten)) void communicate(int sockfd,
     perror("malloc()");
     exit(EXIT_FAILURE);
   }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
 
   /* Handshake */
   char handshake_msg = 's';
@@ -49,9 +53,225 @@ __attribute__((hot, flatten)) void communicate(int sockfd,
   free(buffer);
 }
 
+/* Answers through an io_uring on the socket connected to the server */
+__attribute__((hot, flatten)) void
+communicate_uring(int sockfd, struct SocketArgs *args) {
+  struct sockaddr_in server_addr = {0};
+  socklen_t sock_len = sizeof(server_addr);
+
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_addr.s_addr = inet_addr(args->server_addr);
+  server_addr.sin_port = htons(args->server_port);
+  /* Fixed reads and writes carry no address */
+  if (connect(sockfd, (const struct sockaddr *)&server_addr, sock_len)) {
+    perror("connect()");
+    exit(EXIT_FAILURE);
+  }
+
+  SocketUring uring;
+  socket_uring_init(&uring, sockfd, args);
+
+  /* Handshake */
+  char handshake_msg = 's';
+  socket_udp_write_data(sockfd, &handshake_msg, sizeof(handshake_msg),
+                        &server_addr, sock_len, args);
+
+  socket_uring_read(&uring, args->size);
+  for (; args->count > 0; --args->count) {
+    /* STC */
+    socket_uring_complete(&uring);
+    if (unlikely(args->is_debug))
+      debug_validate(uring.rx, args->size, STC_BITS_10101010);
+
+    /* CTS */
+    memset(uring.tx, CTS_BITS_01010101, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(uring.tx, args->size, CTS_BITS_01010101);
+    socket_uring_write(&uring, args->size);
+    if (args->count > 1)
+      socket_uring_read(&uring, args->size);
+  }
+  socket_uring_complete(&uring);
+
+  socket_uring_close(&uring);
+}
+
+/* Answers with messages cut into datagrams of -g bytes */
+__attribute__((hot, flatten)) void
+communicate_segments(int sockfd, struct SocketArgs *args) {
+  struct sockaddr_in server_addr = {0};
+  socklen_t sock_len = sizeof(server_addr);
+
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_addr.s_addr = inet_addr(args->server_addr);
+  server_addr.sin_port = htons(args->server_port);
+  if (connect(sockfd, (const struct sockaddr *)&server_addr, sock_len)) {
+    perror("connect()");
+    exit(EXIT_FAILURE);
+  }
+
+  void *buffer = malloc(args->size);
+  if (!buffer) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  UdpSegments segments;
+  udp_segments_init(&segments, sockfd, args);
+
+  /* Handshake */
+  char handshake_msg = 's';
+  socket_udp_write_data(sockfd, &handshake_msg, sizeof(handshake_msg),
+                        &server_addr, sock_len, args);
+
+  for (; args->count > 0; --args->count) {
+    /* STC */
+    udp_segments_read(&segments, buffer, args->size, args);
+    if (unlikely(args->is_debug))
+      debug_validate(buffer, args->size, STC_BITS_10101010);
+
+    /* CTS */
+    memset(buffer, CTS_BITS_01010101, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(buffer, args->size, CTS_BITS_01010101);
+    udp_segments_write(&segments, buffer, args->size, args);
+  }
+
+  free(buffer);
+}
+
+/* Answers with messages of any size in reliable fragments */
+__attribute__((hot, flatten)) void
+communicate_reliable(int sockfd, struct SocketArgs *args) {
+  struct sockaddr_in server_addr = {0};
+  socklen_t sock_len = sizeof(server_addr);
+
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_addr.s_addr = inet_addr(args->server_addr);
+  server_addr.sin_port = htons(args->server_port);
+  if (connect(sockfd, (const struct sockaddr *)&server_addr, sock_len)) {
+    perror("connect()");
+    exit(EXIT_FAILURE);
+  }
+
+  void *buffer = malloc(args->size);
+  if (!buffer) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  UdpReliable reliable;
+  udp_reliable_init(&reliable, sockfd, args);
+
+  /* Handshake */
+  char handshake_msg = 's';
+  socket_udp_write_data(sockfd, &handshake_msg, sizeof(handshake_msg),
+                        &server_addr, sock_len, args);
+
+  for (; args->count > 0; --args->count) {
+    /* STC */
+    void *payload = udp_reliable_read(&reliable, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(payload, args->size, STC_BITS_10101010);
+
+    /* CTS */
+    memset(buffer, CTS_BITS_01010101, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(buffer, args->size, CTS_BITS_01010101);
+    udp_reliable_write(&reliable, buffer, args->size);
+  }
+
+  udp_reliable_close(&reliable);
+  free(buffer);
+}
+
+/* Grants the server credit for sending `credit` more datagrams */
+static void send_credit(int sockfd, uint64_t credit) {
+  while (send(sockfd, &credit, sizeof(credit), 0) < 0)
+    if ((errno != EAGAIN) && (errno != EINTR)) {
+      perror("send()");
+      exit(EXIT_FAILURE);
+    }
+}
+
+/* How many datagrams of `size` surely fit into the receive buffer */
+static uint64_t credit_window(int sockfd, size_t size) {
+  int rcvbuf;
+  socklen_t optlen = sizeof(rcvbuf);
+
+  if (getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen)) {
+    perror("getsockopt(SO_RCVBUF)");
+    exit(EXIT_FAILURE);
+  }
+  /* The buffer is charged for the skb too, and small ones round up a lot */
+  const uint64_t window = rcvbuf / (2 * size + 1024);
+  return window ? window : 1;
+}
+
+/* Drains the STC stream in recvmmsg() batches, returning credit as it goes */
+__attribute__((hot, flatten)) void
+communicate_batch(int sockfd, struct SocketArgs *args) {
+  struct sockaddr_in server_addr = {0};
+  socklen_t sock_len = sizeof(server_addr);
+  uint64_t received = 0, pending = 0;
+  size_t length;
+
+  server_addr.sin_family = AF_INET;
+  server_addr.sin_addr.s_addr = inet_addr(args->server_addr);
+  server_addr.sin_port = htons(args->server_port);
+  /* Batched headers carry no address */
+  if (connect(sockfd, (const struct sockaddr *)&server_addr, sock_len)) {
+    perror("connect()");
+    exit(EXIT_FAILURE);
+  }
+
+  UdpBatch rx;
+  udp_batch_init(&rx, sockfd, args->size, args);
+  const uint64_t window = credit_window(sockfd, args->size);
+
+  /* Handshake */
+  char handshake_msg = 's';
+  socket_udp_write_data(sockfd, &handshake_msg, sizeof(handshake_msg),
+                        &server_addr, sock_len, args);
+  send_credit(sockfd, window);
+
+  while (received < args->count) {
+    /* STC */
+    const int count = udp_batch_receive(&rx);
+    for (int i = 0; i < count; ++i) {
+      void *payload = udp_batch_message(&rx, i, &length);
+      if (unlikely(length != args->size)) {
+        fprintf(stderr, "Datagram of %zu bytes received!\n", length);
+        exit(EXIT_FAILURE);
+      }
+      if (unlikely(args->is_debug))
+        debug_validate(payload, args->size, STC_BITS_10101010);
+    }
+    received += count;
+
+    /* Half the window back at a time keeps the server from stalling */
+    if (((pending += count) >= (window + 1) / 2) ||
+        (received == args->count)) {
+      send_credit(sockfd, pending);
+      pending = 0;
+    }
+  }
+
+  udp_batch_close(&rx);
+}
+
 int main(int argc, char *argv[]) {
   struct SocketArgs args;
-  socket_parse_args(&args, argc, argv);
+  socket_parse_args(&args, argc, argv,
+                    SOCKET_CAP_URING | SOCKET_CAP_UDP_BATCH |
+                        SOCKET_CAP_UDP_SEGMENT | SOCKET_CAP_UDP_RELIABLE);
+
+  pin_placement(args.client_cpu, args.server_cpu, args.client_cpu);
+  realtime_setup(args.rt_priority, args.is_thp_disabled);
 
   int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
   if (sockfd < 0) {
@@ -111,7 +331,16 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  communicate(sockfd, &args);
+  if (args.io != SOCKET_IO_SYSCALL)
+    communicate_uring(sockfd, &args);
+  else if (args.reliable_size)
+    communicate_reliable(sockfd, &args);
+  else if (args.segment_size)
+    communicate_segments(sockfd, &args);
+  else if (args.batch_size)
+    communicate_batch(sockfd, &args);
+  else
+    communicate(sockfd, &args);
 
   if (close(sockfd)) {
     perror("close()");
@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,7 +10,10 @@
 #include <sys/socket.h>
 
 #include "common/common.h"
+#include "common/interference.h"
+#include "common/realtime.h"
 #include "common/sockets.h"
+#include "common/topology.h"
 
 __attribute__((hot, flatten)) void communicate(int sockfd,
                                                struct SocketArgs *args) {
@@ -21,6 +25,8 @@ __attribute__((hot, flatten)) void communicate(int sockfd,
     perror("malloc()");
     exit(EXIT_FAILURE);
   }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
 
   /* Handshake */
   char handshake_msg = 'c';
@@ -32,10 +38,12 @@ __attribute__((hot, flatten)) void communicate(int sockfd,
   }
   fprintf(stderr, "Handshaking done!\n");
 
+  interference_start(args->interference);
+
   struct Benchmarks bench;
-  setup_benchmarks(&bench);
+  setup_benchmarks(&bench, args->count);
 
-  for (int message = 0; message < args->count; ++message) {
+  for (uint64_t message = 0; message < args->count; ++message) {
     bench.single_start = now();
 
     /* STC */
@@ -54,17 +62,320 @@ __attribute__((hot, flatten)) void communicate(int sockfd,
     benchmark(&bench);
   }
 
+  interference_stop();
+
+  struct Arguments tmp_arg;
+  tmp_arg.count = args->count;
+  tmp_arg.size = args->size;
+  evaluate(&bench, &tmp_arg);
+
+  free(buffer);
+}
+
+/* Ping-pong through an io_uring on the socket connected to the client */
+__attribute__((hot, flatten)) void
+communicate_uring(int sockfd, struct SocketArgs *args) {
+  struct sockaddr_in client_addr = {0};
+  socklen_t sock_len = sizeof(client_addr);
+
+  /* Handshake */
+  char handshake_msg = 'c';
+  socket_udp_read_data(sockfd, &handshake_msg, sizeof(handshake_msg),
+                       &client_addr, &sock_len, args);
+  if (handshake_msg != 's') {
+    fprintf(stderr, "Handshaking failed!\n");
+    exit(EXIT_FAILURE);
+  }
+  fprintf(stderr, "Handshaking done!\n");
+  /* Fixed reads and writes carry no address */
+  if (connect(sockfd, (const struct sockaddr *)&client_addr, sock_len)) {
+    perror("connect()");
+    exit(EXIT_FAILURE);
+  }
+
+  SocketUring uring;
+  socket_uring_init(&uring, sockfd, args);
+
+  interference_start(args->interference);
+
+  struct Benchmarks bench;
+  setup_benchmarks(&bench, args->count);
+
+  for (uint64_t message = 0; message < args->count; ++message) {
+    bench.single_start = now();
+
+    /* STC */
+    memset(uring.tx, STC_BITS_10101010, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(uring.tx, args->size, STC_BITS_10101010);
+    socket_uring_write(&uring, args->size);
+
+    /* CTS */
+    socket_uring_read(&uring, args->size);
+    socket_uring_complete(&uring);
+    if (unlikely(args->is_debug))
+      debug_validate(uring.rx, args->size, CTS_BITS_01010101);
+
+    benchmark(&bench);
+  }
+
+  interference_stop();
+
+  socket_uring_report(&uring, args->count);
+
+  struct Arguments tmp_arg;
+  tmp_arg.count = args->count;
+  tmp_arg.size = args->size;
+  evaluate(&bench, &tmp_arg);
+
+  socket_uring_close(&uring);
+}
+
+/* Ping-pong with messages cut into datagrams of -g bytes */
+__attribute__((hot, flatten)) void
+communicate_segments(int sockfd, struct SocketArgs *args) {
+  struct sockaddr_in client_addr = {0};
+  socklen_t sock_len = sizeof(client_addr);
+
+  void *buffer = malloc(args->size);
+  if (!buffer) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  /* Handshake */
+  char handshake_msg = 'c';
+  socket_udp_read_data(sockfd, &handshake_msg, sizeof(handshake_msg),
+                       &client_addr, &sock_len, args);
+  if (handshake_msg != 's') {
+    fprintf(stderr, "Handshaking failed!\n");
+    exit(EXIT_FAILURE);
+  }
+  fprintf(stderr, "Handshaking done!\n");
+  if (connect(sockfd, (const struct sockaddr *)&client_addr, sock_len)) {
+    perror("connect()");
+    exit(EXIT_FAILURE);
+  }
+
+  UdpSegments segments;
+  udp_segments_init(&segments, sockfd, args);
+
+  interference_start(args->interference);
+
+  struct Benchmarks bench;
+  setup_benchmarks(&bench, args->count);
+
+  for (uint64_t message = 0; message < args->count; ++message) {
+    bench.single_start = now();
+
+    /* STC */
+    memset(buffer, STC_BITS_10101010, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(buffer, args->size, STC_BITS_10101010);
+    udp_segments_write(&segments, buffer, args->size, args);
+
+    /* CTS */
+    udp_segments_read(&segments, buffer, args->size, args);
+    if (unlikely(args->is_debug))
+      debug_validate(buffer, args->size, CTS_BITS_01010101);
+
+    benchmark(&bench);
+  }
+
+  interference_stop();
+
+  udp_segments_report(&segments);
+
+  struct Arguments tmp_arg;
+  tmp_arg.count = args->count;
+  tmp_arg.size = args->size;
+  evaluate(&bench, &tmp_arg);
+
+  free(buffer);
+}
+
+/* Ping-pong with messages of any size in reliable fragments */
+__attribute__((hot, flatten)) void
+communicate_reliable(int sockfd, struct SocketArgs *args) {
+  struct sockaddr_in client_addr = {0};
+  socklen_t sock_len = sizeof(client_addr);
+
+  void *buffer = malloc(args->size);
+  if (!buffer) {
+    perror("malloc()");
+    exit(EXIT_FAILURE);
+  }
+  if (args->rt_priority)
+    prefault_memory(buffer, args->size, 1);
+
+  /* Handshake */
+  char handshake_msg = 'c';
+  socket_udp_read_data(sockfd, &handshake_msg, sizeof(handshake_msg),
+                       &client_addr, &sock_len, args);
+  if (handshake_msg != 's') {
+    fprintf(stderr, "Handshaking failed!\n");
+    exit(EXIT_FAILURE);
+  }
+  fprintf(stderr, "Handshaking done!\n");
+  if (connect(sockfd, (const struct sockaddr *)&client_addr, sock_len)) {
+    perror("connect()");
+    exit(EXIT_FAILURE);
+  }
+
+  UdpReliable reliable;
+  udp_reliable_init(&reliable, sockfd, args);
+
+  interference_start(args->interference);
+
+  struct Benchmarks bench;
+  setup_benchmarks(&bench, args->count);
+
+  for (uint64_t message = 0; message < args->count; ++message) {
+    bench.single_start = now();
+
+    /* STC */
+    memset(buffer, STC_BITS_10101010, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(buffer, args->size, STC_BITS_10101010);
+    udp_reliable_write(&reliable, buffer, args->size);
+
+    /* CTS */
+    void *payload = udp_reliable_read(&reliable, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(payload, args->size, CTS_BITS_01010101);
+
+    benchmark(&bench);
+  }
+
+  interference_stop();
+
+  udp_reliable_report(&reliable);
+
   struct Arguments tmp_arg;
   tmp_arg.count = args->count;
   tmp_arg.size = args->size;
   evaluate(&bench, &tmp_arg);
 
+  udp_reliable_close(&reliable);
   free(buffer);
 }
 
+/* Reads a credit datagram; 0 if there is none and MSG_DONTWAIT was asked */
+static uint64_t receive_credit(int sockfd, int flags) {
+  uint64_t credit;
+  ssize_t ret;
+
+  for (;;) {
+    if ((ret = recv(sockfd, &credit, sizeof(credit), flags)) ==
+        sizeof(credit))
+      return credit;
+    if (ret >= 0) {
+      fprintf(stderr, "Credit of %zd bytes received!\n", ret);
+      exit(EXIT_FAILURE);
+    }
+    if ((errno == EAGAIN) && (flags & MSG_DONTWAIT))
+      return 0;
+    if ((errno != EAGAIN) && (errno != EINTR)) {
+      perror("recv()");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/**
+ * Streams STC in sendmmsg() batches. UDP drops what does not fit into the
+ * client's receive buffer, so the client grants credit for as many
+ * datagrams as it can hold and returns it as it drains them.
+ */
+__attribute__((hot, flatten)) void
+communicate_batch(int sockfd, struct SocketArgs *args) {
+  struct sockaddr_in client_addr = {0};
+  socklen_t sock_len = sizeof(client_addr);
+  uint64_t credit, sent = 0;
+
+  /* Handshake */
+  char handshake_msg = 'c';
+  socket_udp_read_data(sockfd, &handshake_msg, sizeof(handshake_msg),
+                       &client_addr, &sock_len, args);
+  if (handshake_msg != 's') {
+    fprintf(stderr, "Handshaking failed!\n");
+    exit(EXIT_FAILURE);
+  }
+  fprintf(stderr, "Handshaking done!\n");
+  /* Batched headers carry no address, and only credit comes back */
+  if (connect(sockfd, (const struct sockaddr *)&client_addr, sock_len)) {
+    perror("connect()");
+    exit(EXIT_FAILURE);
+  }
+  const uint64_t window = receive_credit(sockfd, 0);
+  uint64_t granted = window;
+
+  UdpBatch tx;
+  udp_batch_init(&tx, sockfd, args->size, args);
+
+  interference_start(args->interference);
+
+  struct Benchmarks bench;
+  setup_benchmarks(&bench, args->count);
+
+  for (uint64_t message = 0; message < args->count; ++message) {
+    bench.single_start = now();
+
+    if (sent == granted) {
+      /* What is queued has to go out before the client can return credit */
+      udp_batch_flush(&tx);
+      granted += receive_credit(sockfd, 0);
+      while ((credit = receive_credit(sockfd, MSG_DONTWAIT)))
+        granted += credit;
+    }
+
+    /* STC */
+    void *payload = udp_batch_acquire(&tx);
+    memset(payload, STC_BITS_10101010, args->size);
+    if (unlikely(args->is_debug))
+      debug_validate(payload, args->size, STC_BITS_10101010);
+    udp_batch_send(&tx, args->size);
+    ++sent;
+
+    benchmark(&bench);
+  }
+  udp_batch_flush(&tx);
+
+  /* Until the client has drained the last datagram */
+  while (granted < args->count + window)
+    granted += receive_credit(sockfd, 0);
+  const bench_t stream_time = now() - bench.total_start;
+
+  interference_stop();
+
+  benchmark_tag("Batch size", "%d", args->batch_size);
+  if (args->batch_timeout_us)
+    benchmark_tag("Batch timeout", "%d us", args->batch_timeout_us);
+  benchmark_tag("Credit window", "%" PRIu64 " datagrams", window);
+  benchmark_tag("sendmmsg per message", "%.3f",
+                (double)tx.call_count / args->count);
+  benchmark_tag("Stream throughput", "%.3f MB/s",
+                ((double)args->count * args->size) / (stream_time / 1e9) /
+                    1e6);
+
+  struct Arguments tmp_arg;
+  tmp_arg.count = args->count;
+  tmp_arg.size = args->size;
+  evaluate(&bench, &tmp_arg);
+
+  udp_batch_close(&tx);
+}
+
 int main(int argc, char *argv[]) {
   struct SocketArgs args;
-  socket_parse_args(&args, argc, argv);
+  socket_parse_args(&args, argc, argv,
+                    SOCKET_CAP_URING | SOCKET_CAP_UDP_BATCH |
+                        SOCKET_CAP_UDP_SEGMENT | SOCKET_CAP_UDP_RELIABLE);
+
+  pin_placement(args.server_cpu, args.server_cpu, args.client_cpu);
+  realtime_setup(args.rt_priority, args.is_thp_disabled);
 
   int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
   if (sockfd < 0) {
@@ -145,7 +456,16 @@ int main(int argc, char *argv[]) {
     exit(EXIT_FAILURE);
   }
 
-  communicate(sockfd, &args);
+  if (args.io != SOCKET_IO_SYSCALL)
+    communicate_uring(sockfd, &args);
+  else if (args.reliable_size)
+    communicate_reliable(sockfd, &args);
+  else if (args.segment_size)
+    communicate_segments(sockfd, &args);
+  else if (args.batch_size)
+    communicate_batch(sockfd, &args);
+  else
+    communicate(sockfd, &args);
 
   if (close(sockfd)) {
     perror("close()");